@@ -2,6 +2,9 @@
 #
 # perl build_cluster_hierarchy.pl <hidden_layer_trace> <vocabulary_size> <lvl1_size> [ <lvl2_size> [...] ]
 #
+# Each cluster of a level (except the first one) is linked to the closest
+# cluster of the previous level with a "#parent <id>" comment.
+#
 # Gwénolé Lecorvé
 # Idiap
 # 2011-2012
@@ -24,6 +27,9 @@ my $VOCAB_SIZE = shift(@ARGV);
 #生成类似/tmp/f058hAScGn的文件名
 my $tmpdir = tempdir(DIR => $TEMP_DIR, CLEANUP => 1);
 
+# means of the previous level
+my @PREV_CENTRES = ();
+
 
 sub log10 
 {
@@ -65,6 +71,27 @@ sub compute_word_probs
 	}
 }
 
+sub closest_centre 
+{
+	my $p_mean = shift;
+	my $best = 0;
+	my $best_dist = -1;
+	for (my $k=0; $k < @PREV_CENTRES; $k++) 
+	{
+		my $dist = 0;
+		for (my $i=0; $i < @$p_mean; $i++) 
+		{
+			$dist += ($$p_mean[$i] - $PREV_CENTRES[$k][$i])**2;
+		}
+		if ($best_dist < 0 || $dist < $best_dist) 
+		{
+			$best_dist = $dist;
+			$best = $k;
+		}
+	}
+	return $best;
+}
+
 sub compute_cluster 
 {
 	my $s = shift; #cluster size
@@ -94,12 +121,20 @@ sub compute_cluster
 	# writing cluster definitions
 	open(F, "$f.cluster_centres");
 	my $k = 0;
+	my @centres = ();
 	while (<F>) 
 	{
 		chomp;
 		$_ =~ /^(\d+) (.*)$/;
-		# cluster prob and mean
-		print sprintf("%.6f",$freq[$1]/$total)." $2\n";
+		my @mean = split(/\s+/, $2);
+		push(@centres, \@mean);
+		# cluster prob and mean (and parent in the previous level)
+		my $parent = "";
+		if (@PREV_CENTRES > 0) 
+		{
+			$parent = " #parent ".closest_centre(\@mean);
+		}
+		print sprintf("%.6f",$freq[$1]/$total)." $2$parent\n";
 		foreach my $w (sort {$a <=> $b} (keys(%{$w_probs{$k}}))) 
 		{
 			print log($w_probs{$k}{$w})."\n";
@@ -113,6 +148,7 @@ sub compute_cluster
 	
 	print "--\n";
 	close(F);
+	@PREV_CENTRES = @centres;
 	
 }
 
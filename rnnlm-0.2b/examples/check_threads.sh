@@ -0,0 +1,38 @@
+#!/bin/bash
+
+#Checks that the conversions with several threads give the same FST as with a single thread
+#(the states are expanded concurrently, and -lsh-flip looks up the existing states from the threads)
+#Run from rnnlm-0.2b once the tools are built:
+#	examples/check_threads.sh [<rnn_model> <trace> [<threads>]]
+
+MODEL=${1:-examples/rnn2wfst.model}
+TRACE=${2:-examples/rnn2wfst.train.trace}
+THREADS=${3:-4}
+TMP=`mktemp -d`
+STATUS=0
+
+bin/train-lsh -trace $TRACE -bits 8 -pca > $TMP/m.lsh 2> /dev/null || exit 1
+bin/train-pq -trace $TRACE -subspaces 2 -codes 4 > $TMP/m.pq 2> /dev/null || exit 1
+
+#compare <name> <options>: same FST with 1 and $THREADS threads
+compare()
+{
+	NAME=$1
+	shift
+	bin/rnn2fst -rnnlm $MODEL "$@" -threads 1 -fst $TMP/$NAME.1.fst > /dev/null 2>&1 || { echo "$NAME: conversion failed"; STATUS=1; return; }
+	bin/rnn2fst -rnnlm $MODEL "$@" -threads $THREADS -fst $TMP/$NAME.$THREADS.fst > /dev/null 2>&1 || { echo "$NAME: conversion failed"; STATUS=1; return; }
+	if cmp -s $TMP/$NAME.1.fst $TMP/$NAME.$THREADS.fst
+	then
+		echo "$NAME: OK"
+	else
+		echo "$NAME: the FST differs with $THREADS threads"
+		STATUS=1
+	fi
+}
+
+compare lsh-flip -discretize $TMP/m.lsh -lsh -lsh-flip -prune 1e-4 -backoff 4
+compare lsh -discretize $TMP/m.lsh -lsh -prune 1e-4 -backoff 4
+compare pq -discretize $TMP/m.pq -pq -prune 1e-4 -backoff 3
+
+rm -rf $TMP
+exit $STATUS
@@ -38,7 +38,17 @@ class Discretizer {
 	}
 	
 	virtual void discretize(FstHistory* const fsth, const struct neuron * const layer) const = 0;	
+	
+	//number of ids produced for one vector by discretizeBatch()
+	virtual int getCodeSize() const = 0;
+	//discretizes n vectors at once: x is a row-major n x ld matrix (only the
+	//first getNumDims() values of each row are used), ids a row-major n x getCodeSize() matrix
+	virtual void discretizeBatch(int * const ids, const real * const x, int n, int ld) const = 0;
+	
 	virtual void undiscretize(struct neuron * const layer, const FstHistory * const fsth) const = 0;
+	//product of the recurrent weights and of the undiscretized history, if it
+	//has been precomputed (see CRnnLM::setRecurrentInput()), NULL otherwise
+	const real *getRecurrentInput(const FstHistory &fsth) const { return NULL; }
 	virtual bool load(string fn) = 0;
 	
 };
@@ -66,51 +66,18 @@ void FstBuilder::addPred(map< FstIndex, set<FstIndex> > &m, FstIndex k, FstIndex
 
 
 /**
- * Try to add a state in the FST for a given history and return the ID
- * of the new state.
- * If the history already exists, the ID of the corresponding state is
- * just returned and the FST is not modified.
- */
-bool FstBuilder::addFstState(FstIndex &id, const FstHistory *h, VectorFst<LogArc> &fst) {
-	map<const FstHistory*,int>::iterator it = h2state.find(h);
-	//if new history, then add
-	if (it == h2state.end()) {
-		id = (FstIndex) fst.AddState();
-		h2state[h] = id;
-		return true;
-	}
-	else {
-		delete h;
-		id = (FstIndex) it->second;
-		return false;
-	}
-}
-
-
-
-
-
-
-
-
-
-
-
-/**
- * Compute all conditionals for a given discretize state (FstHistory)
+ * Compute all conditionals for the state loaded in the input layer
  * and store them in a vector
  */
-vector<real> FstBuilder::computeAllConditionals(CRnnLM &rnnlm, const FstHistory & fsth) {
+vector<real> FstBuilder::computeAllConditionals(CRnnLM &rnnlm, int last_word) {
 	vector<real> res(rnnlm.getVocabSize());
 	struct neuron* output_layer = rnnlm.getOutputLayer();
 	int w=0;
 	
-	fsth.loadAsInput(rnnlm, *dzer);
-	
 	//store all conditionals
- 	rnnlm.computeClassProbs(fsth.getLastWord());
+ 	rnnlm.computeClassProbs(last_word);
 	for (int c = 0; c < rnnlm.getClassSize(); c++) {
-	 	rnnlm.computeClassWordProbs(fsth.getLastWord(), rnnlm.getWordFromClass(0, c));
+	 	rnnlm.computeClassWordProbs(last_word, rnnlm.getWordFromClass(0, c));
 		for (int i = 0; i < rnnlm.getNumWordsInClass(c); i++) {
 			w = rnnlm.getWordFromClass(i, c);
 			//compute and store P(w|current_state);
@@ -132,16 +99,14 @@ vector<real> FstBuilder::computeAllConditionals(CRnnLM &rnnlm, const FstHistory
 
 
 /**
- * Compute all conditionals for a given discretize state (FstHistory)
+ * Compute all conditionals for the state loaded in the input layer
  * and store them in a vector
  */
-vector<real> FstBuilder::computeSomeConditionals(CRnnLM &rnnlm, const FstHistory & fsth, vector<int> &words) {
+vector<real> FstBuilder::computeSomeConditionals(CRnnLM &rnnlm, int last_word, vector<int> &words) {
 	vector<real> res(rnnlm.getVocabSize());
 	struct neuron* output_layer = rnnlm.getOutputLayer();
 	int w=0;
 	
-	fsth.loadAsInput(rnnlm, *dzer);
-	
 	vector<real> mask(rnnlm.getVocabSize(), MY_LOG_ZERO); // 0, 1 mask to disregard some dims
 	
 	for (int i = 0; i < words.size(); i++) {
@@ -149,9 +114,9 @@ vector<real> FstBuilder::computeSomeConditionals(CRnnLM &rnnlm, const FstHistory
 	}
 	
 	//store all conditionals
- 	rnnlm.computeClassProbs(fsth.getLastWord());
+ 	rnnlm.computeClassProbs(last_word);
 	for (int c = 0; c < rnnlm.getClassSize(); c++) {
-	 	rnnlm.computeClassWordProbs(fsth.getLastWord(), rnnlm.getWordFromClass(0, c));
+	 	rnnlm.computeClassWordProbs(last_word, rnnlm.getWordFromClass(0, c));
 		for (int i = 0; i < rnnlm.getNumWordsInClass(c); i++) {
 			w = rnnlm.getWordFromClass(i, c);
 			//compute and store P(w|current_state);
@@ -176,21 +141,11 @@ vector<real> FstBuilder::computeSomeConditionals(CRnnLM &rnnlm, const FstHistory
 
 
 /**
- * Compute all conditionals for a given discretize state (FstHistory)
+ * Compute all conditionals for the state loaded in the input layer
  * and store them in a vector
  * Entropy is computed at the same time for speed reasons
  */
-void FstBuilder::computeEntropyAndConditionals(real &entropy, vector<real> &res, CRnnLM &rnnlm, const FstHistory & fsth) {
-	computeEntropyAndConditionals(entropy, res, rnnlm, fsth, 0.0);
-}
-
-
-/**
- * Compute all conditionals for a given discretize state (FstHistory)
- * and store them in a vector
- * Entropy is computed at the same time for speed reasons
- */
-void FstBuilder::computeEntropyAndConditionals(real &entropy, vector<real> &res, CRnnLM &rnnlm, const FstHistory & fsth, real posterior) {
+void FstBuilder::computeEntropyAndConditionals(real &entropy, vector<real> &res, CRnnLM &rnnlm, int last_word, real posterior) {
 	struct neuron* output_layer = rnnlm.getOutputLayer();
 	real p	 = 0.0;
 	real p_joint = 0.0;
@@ -199,12 +154,10 @@ void FstBuilder::computeEntropyAndConditionals(real &entropy, vector<real> &res,
 	
 	entropy = 0.0;
 	
-	fsth.loadAsInput(rnnlm, *dzer);
-	
 	//store all conditionals
- 	rnnlm.computeClassProbs(fsth.getLastWord());
+ 	rnnlm.computeClassProbs(last_word);
 	for (int c = 0; c < rnnlm.getClassSize(); c++) {
-	 	rnnlm.computeClassWordProbs(fsth.getLastWord(), rnnlm.getWordFromClass(0, c));
+	 	rnnlm.computeClassWordProbs(last_word, rnnlm.getWordFromClass(0, c));
 		for (int i = 0; i < rnnlm.getNumWordsInClass(c); i++) {
 			w = rnnlm.getWordFromClass(i, c);
 			p = log(output_layer[rnnlm.getVocabSize()+c].ac)
@@ -56,20 +56,22 @@ class FstBuilder {
 	Discretizer *dzer; //Pointer to allow for dynamic cast over an abstract class
 	int max_backoff_path;
 	real pruning_threshold;
+	
+	//memory of the cache of the backoff distributions (see typed_fstbuilder.h)
+	size_t dist_cache_bytes;
 
-	map<const FstHistory*,int, FstHistoryCmp> h2state;
+	//the map from histories to states is typed, see typed_fstbuilder.h;
+	//histories of the processed states, owned by that map
 	vector<const FstHistory*> state2h;
 	
 	
 	//Basic methods
 	void addPred(map< FstIndex, set<FstIndex> > &m, FstIndex k, FstIndex v);
-	bool addFstState(FstIndex &id, const FstHistory *h, VectorFst<LogArc> &fst);
 	
-	//Computation of probs
-	vector<real> computeAllConditionals(CRnnLM &rnnlm, const FstHistory &fsth);
-	vector<real> computeSomeConditionals(CRnnLM &rnnlm, const FstHistory &fsth, vector<int> &words);
-	void computeEntropyAndConditionals(real &entropy, vector<real> &res, CRnnLM &rnnlm, const FstHistory &fsth);
-	void computeEntropyAndConditionals(real &entropy, vector<real> &res, CRnnLM &rnnlm, const FstHistory &fsth, real posterior);
+	//Computation of probs, once the history has been loaded in the input layer
+	vector<real> computeAllConditionals(CRnnLM &rnnlm, int last_word);
+	vector<real> computeSomeConditionals(CRnnLM &rnnlm, int last_word, vector<int> &words);
+	void computeEntropyAndConditionals(real &entropy, vector<real> &res, CRnnLM &rnnlm, int last_word, real posterior);
 	
 	//Debug
 	void dprintf( int min_dbg_lvl, const char* format, ... );
@@ -79,27 +81,18 @@ class FstBuilder {
 	FstBuilder(Discretizer *d) {
 		debug_mode = 0;
 		dzer = d;
+		dist_cache_bytes = 0;
 	}
 	
-	~FstBuilder() {
-		const FstHistory *key;
-		map<const FstHistory*,int, FstHistoryCmp>::iterator mit;
-		for (mit = h2state.begin(); mit != h2state.end(); ++mit) {
-			key = mit->first;
-			h2state.erase(mit);
-			delete key;
-		}
-		vector<const FstHistory*>::iterator vit;
-		for (vit = state2h.begin(); vit != state2h.end(); ++vit) {
-			key = *vit;
-			delete key;
-		}
-		state2h.clear();
-	}
+	virtual ~FstBuilder() {}
 
 	void setDebugMode(int lvl) {
 		debug_mode = lvl;
 	}
+
+	void setDistributionCacheSize(size_t bytes) {
+		dist_cache_bytes = bytes;
+	}
 	
 	//Static methods
 	static real distanceL2(vector<real> u, vector<real> v) {
@@ -14,7 +14,9 @@
 #include <stdlib.h>
 #include <cmath>
 #include <string.h>
+#include <stdint.h>
 #include <string>
+#include <vector>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -41,6 +43,7 @@ class FstHistory {
 	// Constructor
 	FstHistory() { last_word = -1; }
 	FstHistory(const FstHistory& fsth) { last_word = fsth.getLastWord(); }
+	virtual ~FstHistory() {}
 	
 	// Getters
 	int getLastWord() const { return last_word; }
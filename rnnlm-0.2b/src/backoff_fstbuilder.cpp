@@ -0,0 +1,598 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Pruning and backoff computations shared by the builders whose
+// backoff states are given by their discretizer (hierarchical
+// clusters, product quantization, sign projections)
+//
+///////////////////////////////////////////////////////////////////////
+
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "backoff_fstbuilder.h"
+
+
+
+/**
+ * Compute the conditional probability of a word given a state.
+ * This computation handles backoffs in the FST.
+ */
+real BackoffFstBuilder::computeFstWordProb(VectorFst<LogArc> &fst, int word, FstIndex state) {
+	Matcher< VectorFst<LogArc> > matcher(fst, MATCH_INPUT);
+	matcher.SetState(state);
+	LogWeight prob = LogWeight::One();
+	while (!matcher.Find(word)) {
+		ArcIterator< VectorFst<LogArc> > it(matcher.GetFst(), state);
+		
+		prob = Times(prob,it.Value().weight); //apply backoff weight
+//		printf("\t\t%i (%li/eps) --> %i = %f\t\tEPS\n", it.Value().ilabel , state, it.Value().nextstate, it.Value().weight.Value());
+		state = it.Value().nextstate;
+		matcher.SetState(state);
+	}
+	prob = Times(prob, matcher.Value().weight);
+//	printf("\t\t%i (%li/w%i) --> %i = %f\n", matcher.Value().ilabel , state, word, matcher.Value().nextstate, matcher.Value().weight.Value());
+	return prob.Value();
+}
+
+
+
+
+
+
+
+
+
+
+
+//no backoff arc (see computeAllBackoff())
+#define NO_BACKOFF ((FstIndex) -1)
+
+
+/**
+ * Same as computeFstWordProb(), the arcs of each state being searched by
+ * dichotomy (they are sorted by label) and the weights of the backoff
+ * arcs being read from bo_weight, so that the FST is only read
+ */
+static real computeBackoffWordProb(const VectorFst<LogArc> &fst, const vector<FstIndex> &bo_of, const vector<float> &bo_weight, int word, FstIndex state) {
+	LogWeight prob = LogWeight::One();
+	while (true) {
+		ArcIterator< VectorFst<LogArc> > it(fst, state);
+		size_t lo = 0;
+		size_t hi = fst.NumArcs(state);
+		while (lo < hi) {
+			size_t mid = (lo+hi)/2;
+			it.Seek(mid);
+			if (it.Value().ilabel < word) { lo = mid+1; }
+			else { hi = mid; }
+		}
+		if (lo < fst.NumArcs(state)) {
+			it.Seek(lo);
+			if (it.Value().ilabel == word) {
+				return Times(prob, it.Value().weight).Value();
+			}
+		}
+		if (bo_of[state] == NO_BACKOFF) {
+			return LogWeight::Zero().Value();
+		}
+		prob = Times(prob, LogWeight(bo_weight[state])); //apply backoff weight
+		state = bo_of[state];
+	}
+}
+
+
+/**
+ * Resolve once the probability of every word given state bo (-log, in
+ * dist[w] for the words such that stamp[w] == tag, the others being
+ * unreachable)
+ */
+static void resolveBackoffState(const VectorFst<LogArc> &fst, const vector<FstIndex> &bo_of, const vector<float> &bo_weight, FstIndex bo, vector<float> &dist, vector<size_t> &stamp, size_t tag) {
+	LogWeight prob = LogWeight::One();
+	FstIndex state = bo;
+	while (true) {
+		for (ArcIterator< VectorFst<LogArc> > it(fst, state); !it.Done(); it.Next()) {
+			const LogArc &arc = it.Value();
+			if ((arc.ilabel != EPSILON) && (stamp[arc.ilabel] != tag)) {
+				stamp[arc.ilabel] = tag;
+				dist[arc.ilabel] = Times(prob, arc.weight).Value();
+			}
+		}
+		if (bo_of[state] == NO_BACKOFF) {
+			return;
+		}
+		prob = Times(prob, LogWeight(bo_weight[state]));
+		state = bo_of[state];
+	}
+}
+
+
+/**
+ * Compute the backoff weight for each backoff edge
+ * weight = 1 - sum_{w in A} P(w|src) / 1 - sum_{w in A} P(w|bo)
+ * where A is the set of word whose edge hasn't been pruned in src.
+ * The backoff states are processed by increasing depth (length of their
+ * backoff path), so that the weights of the backoff path of bo are known
+ * when P(w|bo) is computed. The sources of a given depth are processed
+ * in parallel with n_threads threads; the distribution of bo is then
+ * resolved once for all its sources if they have more arcs than its
+ * backoff path, otherwise the arcs of the path are searched for each word.
+ */
+void BackoffFstBuilder::computeAllBackoff(VectorFst<LogArc> &fst, map< FstIndex,set<FstIndex> > &pred, int n_threads) {
+	FstIndex n_states = fst.NumStates();
+	vector<FstIndex> bo_of(n_states, NO_BACKOFF);
+	vector<float> bo_weight(n_states, LogWeight::Zero().Value());
+	vector<int> depth(n_states, -1);
+	vector<FstIndex> path;
+	int max_label = 0;
+	
+		printf("Start of BO computation\n");
+	//backoff arc (the first one) and largest label of each state
+	for (FstIndex s = 0; s < n_states; s++) {
+		size_t n_arcs = fst.NumArcs(s);
+		if (n_arcs == 0) { continue; }
+		ArcIterator< VectorFst<LogArc> > it(fst, s);
+		if (it.Value().ilabel == EPSILON) {
+			bo_of[s] = it.Value().nextstate;
+			bo_weight[s] = it.Value().weight.Value();
+		}
+		it.Seek(n_arcs-1);
+		max_label = max(max_label, (int) it.Value().ilabel);
+	}
+	
+	//depth of each state
+	for (FstIndex s = 0; s < n_states; s++) {
+		FstIndex t = s;
+		while ((depth[t] == -1) && (bo_of[t] != NO_BACKOFF)) {
+			path.push_back(t);
+			t = bo_of[t];
+		}
+		if (depth[t] == -1) { depth[t] = 0; }
+		while (!path.empty()) {
+			depth[path.back()] = depth[t]+1;
+			t = path.back();
+			path.pop_back();
+		}
+	}
+	
+	//backoff states of each depth
+	vector< vector< map< FstIndex,set<FstIndex> >::const_iterator > > levels;
+	for (map< FstIndex,set<FstIndex> >::const_iterator itm = pred.begin(); itm != pred.end(); ++itm) {
+		size_t d = (size_t) depth[itm->first];
+		if (levels.size() <= d) { levels.resize(d+1); }
+		levels[d].push_back(itm);
+	}
+	
+	for (size_t d = 0; d < levels.size(); d++) {
+		const vector< map< FstIndex,set<FstIndex> >::const_iterator > &level = levels[d];
+		atomic<size_t> next(0);
+		
+		//backoff states are handed out to the threads one at a time
+		auto work = [&]()
+		{
+			vector<float> dist(max_label+1);
+			vector<size_t> stamp(max_label+1, 0);
+			size_t i;
+			while ((i = next++) < level.size()) {
+				FstIndex bo = level[i]->first;
+				const set<FstIndex> &v = level[i]->second;
+				size_t n_src_arcs = 0;
+				size_t n_path_arcs = 0;
+				for (set<FstIndex>::const_iterator itv = v.begin(); itv != v.end(); ++itv) {
+					n_src_arcs += fst.NumArcs(*itv);
+				}
+				for (FstIndex t = bo; t != NO_BACKOFF; t = bo_of[t]) {
+					n_path_arcs += fst.NumArcs(t);
+				}
+				bool resolved = (n_src_arcs > n_path_arcs);
+				if (resolved) {
+					resolveBackoffState(fst, bo_of, bo_weight, bo, dist, stamp, i+1);
+				}
+				
+				for (set<FstIndex>::const_iterator itv = v.begin(); itv != v.end(); ++itv) {
+					real mass_normal = 0.0;
+					real mass_bo = 0.0;
+					for (ArcIterator< VectorFst<LogArc> > it(fst, *itv); !it.Done(); it.Next()) {
+						const LogArc &src_arc = it.Value();
+						if (src_arc.ilabel == EPSILON) { continue; } //skip epsilon edge
+						real p_bo = LogWeight::Zero().Value();
+						if (!resolved) {
+							p_bo = computeBackoffWordProb(fst, bo_of, bo_weight, src_arc.ilabel, bo);
+						}
+						else if (stamp[src_arc.ilabel] == i+1) {
+							p_bo = dist[src_arc.ilabel];
+						}
+						mass_normal += myexp(src_arc.weight.Value());
+						mass_bo += myexp(p_bo);
+					}
+					bo_weight[*itv] = LogWeight(mylog(1 - mass_normal) - mylog(1 - mass_bo)).Value();
+				}
+			}
+		};
+		
+		vector<thread> pool;
+		for (int t = 1; t < n_threads; t++) {
+			pool.push_back(thread(work));
+		}
+		work();
+		for (size_t t = 0; t < pool.size(); t++) {
+			pool[t].join();
+		}
+	}
+	
+	//the backoff arc is the first arc of each source
+	for (map< FstIndex,set<FstIndex> >::const_iterator itm = pred.begin(); itm != pred.end(); ++itm) {
+		for (set<FstIndex>::const_iterator itv = itm->second.begin(); itv != itm->second.end(); ++itv) {
+			MutableArcIterator<VectorFst<LogArc> > aiter(&fst, *itv);
+			aiter.SetValue(LogArc(EPSILON, EPSILON, bo_weight[*itv], itm->first));
+		}
+	}
+		printf("End of BO computation\n");
+	cout << endl;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+/**
+ * Remove a FST state ID "src" from the list of predecessors of FST state ID "dest"
+ */
+void BackoffFstBuilder::removePred(map< FstIndex,vector<FstIndex> > &pred, FstIndex dest, FstIndex src) {
+	vector<FstIndex>::iterator it;
+	for (it = pred[dest].begin(); it != pred[dest].end(); ++it) {
+		if (*it == src) {
+			it = pred[dest].erase(it);
+		}
+	}
+}
+
+
+
+
+
+
+
+
+
+void BackoffFstBuilder::removeStates(const VectorFst<LogArc> &old_fst, VectorFst<LogArc> &new_fst, vector<FstIndex> &to_be_deleted) {
+	map<StateId,StateId> new_id;
+	StateId shift = 0;
+	sort(to_be_deleted.begin(), to_be_deleted.end());
+	
+	//compute new ids
+	for (StateId i=0; i < old_fst.NumStates(); i++) {
+		if (shift == to_be_deleted.size() || i != to_be_deleted[shift]) {
+			//dprintf(1,"KEEP NODE %li\n",i);
+			new_id[i] = new_fst.AddState();
+			if (i > 1) {
+				printf("NODE %li\t\t%s\n", new_id[i], state2h[i-1]->toString().c_str());
+			}
+			else if (i == 0) {
+				printf("NODE 0\t\t%s\n", state2h[i]->toString().c_str());
+			}
+			else {
+				printf("NODE 1\t\tFINAL (SINK) NODE\n");
+			}
+			
+			if (old_fst.Start() == i) {
+				new_fst.SetStart(new_id[i]);
+			}
+		}
+		else {
+			shift++;
+		}
+	}
+	
+	
+	//copy undeleted states and replace ids on arcs
+	shift = 0;
+	for (StateIterator<VectorFst<LogArc> > siter(old_fst);
+	     !siter.Done();
+	     siter.Next())
+	{
+		StateId state = siter.Value();
+		if (shift == to_be_deleted.size() || state != to_be_deleted[shift]) {
+			for (ArcIterator<VectorFst<LogArc> > aiter(old_fst, state);
+			     !aiter.Done();
+			     aiter.Next())
+			{
+				const LogArc &arc = aiter.Value();
+				
+ 				new_fst.AddArc(new_id[state], LogArc(arc.ilabel, arc.olabel, arc.weight.Value(), new_id[arc.nextstate]));
+//				new_fst.AddArc(new_id[state], LogArc(arc.ilabel, arc.olabel, exp(-arc.weight.Value()), new_id[arc.nextstate]));
+				//dprintf(2,"NEW ARC: %li\t%i\t%f\t%li\n", new_id[state], arc.ilabel, exp(-arc.weight.Value()), new_id[arc.nextstate]);
+			}
+			
+			//duplicate final weight
+			if (old_fst.Final(state) != LogWeight::Zero()) {
+				new_fst.SetFinal(new_id[state], old_fst.Final(state).Value());
+			}
+		}
+		else {
+			shift++;
+		}
+	}
+	return;	
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/**
+ * Removes useless nodes, nodes with only a backoff output
+ * and plug their input to this single output
+ */
+vector<FstIndex> BackoffFstBuilder::compactBackoffNodes(VectorFst<LogArc> &fst, map< FstIndex,set<FstIndex> > &pred, vector<bool> &non_bo_pred) {
+	FstIndex n_states = fst.NumStates();
+	vector<FstIndex> redir(n_states);
+	vector<FstIndex> deleted;
+	
+	//Step 1: redirect the states whose only output is the backoff edge
+	//(union-find forest: redir[s] == s if s is kept)
+	for (FstIndex s = 0; s < n_states; s++) {
+		redir[s] = s;
+	}
+ 	for (map< FstIndex,set<FstIndex> >::iterator itm = pred.begin(); itm != pred.end(); ++itm) {
+		for (set<FstIndex>::iterator itv = itm->second.begin(); itv != itm->second.end(); ++itv) {
+			if ((fst.NumArcs(*itv) == 1) && (*itv != itm->first)) {
+				redir[*itv] = itm->first;
+			}
+		}
+	}
+	
+	//Step 2: final target of each redirected state, eg, target(a) = c when a->b and b->c
+	for (FstIndex s = 0; s < n_states; s++) {
+		FstIndex target = s;
+		while (redir[target] != target) {
+			target = redir[target];
+		}
+		for (FstIndex t = s; redir[t] != target; ) {
+			FstIndex next = redir[t];
+			redir[t] = target;
+			t = next;
+		}
+		if (target != s) {
+			deleted.push_back(s); //mark as "to be deleted"
+		}
+	}
+	
+	//Step 3: index of the arcs arriving in the deleted states (CSR: the arcs
+	//arriving in the i-th deleted state are in_arcs[in_start[i]..in_start[i+1]-1])
+	vector<int64_t> rank(n_states, -1);
+	vector<FstIndex> in_start(deleted.size()+1, 0);
+	vector< pair<FstIndex,size_t> > in_arcs;
+	for (size_t i = 0; i < deleted.size(); i++) {
+		rank[deleted[i]] = (int64_t) i;
+	}
+	for (FstIndex s = 0; s < n_states; s++) {
+		for (ArcIterator< VectorFst<LogArc> > aiter(fst, s); !aiter.Done(); aiter.Next()) {
+			int64_t r = rank[aiter.Value().nextstate];
+			if (r >= 0) {
+				in_start[r+1]++;
+			}
+		}
+	}
+	for (size_t i = 0; i < deleted.size(); i++) {
+		in_start[i+1] += in_start[i];
+	}
+	in_arcs.resize(in_start[deleted.size()]);
+	{
+		vector<FstIndex> fill(in_start.begin(), in_start.end()-1);
+		for (FstIndex s = 0; s < n_states; s++) {
+			size_t pos = 0;
+			for (ArcIterator< VectorFst<LogArc> > aiter(fst, s); !aiter.Done(); aiter.Next(), pos++) {
+				int64_t r = rank[aiter.Value().nextstate];
+				if (r >= 0) {
+					in_arcs[fill[r]++] = make_pair(s, pos);
+				}
+			}
+		}
+	}
+	
+	for (size_t i = 0; i < deleted.size(); i++) {
+		FstIndex source = deleted[i];
+		FstIndex target = redir[source];
+		
+		//change FST (only the arcs arriving in source)
+		for (FstIndex a = in_start[i]; a < in_start[i+1]; a++) {
+			MutableArcIterator<VectorFst<LogArc> > aiter(&fst, in_arcs[a].first);
+			aiter.Seek(in_arcs[a].second);
+			const LogArc &arc = aiter.Value();
+			aiter.SetValue(LogArc(arc.ilabel, arc.olabel, arc.weight.Value(), target));
+		}
+		if (source == INIT_STATE) {
+			fst.SetStart(target);
+		}
+		//change map of backoffs
+		map< FstIndex,set<FstIndex> >::iterator it_source = pred.find(source);
+		set<FstIndex> &target_pred = pred[target];
+		if (it_source != pred.end()) {
+			for (set<FstIndex>::iterator it = it_source->second.begin(); it != it_source->second.end(); ++it) {
+				if (redir[*it] == *it) {
+					target_pred.insert(*it);
+				}
+			}
+			pred.erase(it_source);
+		}
+		target_pred.erase(source);
+	}
+		printf("End of compaction\n");
+
+//	fst.DeleteStates(deleted);
+	return deleted;
+	
+}
+
+
+
+
+
+real BackoffFstBuilder::deltaProb(
+               real p_cond,
+               real p_cond_bo)
+{
+	p_cond = myexp(p_cond);
+	p_cond_bo = myexp(p_cond_bo);
+	//dprintf(1, "%e\t%e\t%f\n", p_cond, p_cond_bo,abs(p_cond-p_cond_bo)/p_cond);
+	return abs(p_cond-p_cond_bo)/p_cond;
+}
+
+
+
+
+real BackoffFstBuilder::computeDeltaEntropy(real log_p_post, // -log
+                     real log_p_cond, // -log
+                     real log_p_cond_bo, // -log 
+                     real sum_seen, // real
+                     real sum_seen_bo) // real
+{
+
+	sum_seen -= 1e-10;
+	sum_seen_bo -= 1e-10;
+	log_p_post = -log_p_post;
+	log_p_cond = -log_p_cond;
+	log_p_cond_bo = -log_p_cond_bo;
+	
+	
+// 	real log_old_bo = log(1.0 - sum_seen)
+//                     - log(1.0 - sum_seen_bo);
+	real log_new_bo = log(1.0 - sum_seen + exp(log_p_cond))
+                    - log(1.0 - sum_seen_bo + exp(log_p_cond_bo));
+// 	real removal = exp(log_p_cond)
+// 	             * (log_p_cond_bo +log_new_bo -log_p_cond);
+// 	real backed_off = (1.0-sum_seen)
+// 	                * (log_new_bo *log_old_bo);
+	                
+// 	//dprintf(1,"P(h):\t\t%f\n", log_p_post);
+// 	//dprintf(1,"P(w|h):\t\t%f\n", log_p_cond);
+// 	//dprintf(1,"P'(w|h):\t%f\n", log_p_cond_bo + log_new_bo);
+// 	//dprintf(1,"P(w|h'):\t%f\n", log_p_cond_bo);
+// 	//dprintf(1,"sum_seen:\t%f\n", sum_seen);
+// 	//dprintf(1,"sum'_seen:\t%f\n", sum_seen_bo);
+// 	//dprintf(1,"bo(h):\t\t%f\n", exp(log_old_bo));
+// 	//dprintf(1,"bo'(h):\t\t%f\n", exp(log_new_bo));
+// 	//dprintf(1,"removal:\t%e\n", removal);
+// 	//dprintf(1,"backed_off:\t%e\n", backed_off);
+// 	//dprintf(1,"delta H:\t%e\n",  -exp(log_p_post)
+// 	                        * (removal + backed_off));
+// 	//dprintf(1,"delta PPL:\t%e\n",  exp(-exp(log_p_post)
+// 	                        * (removal + backed_off)) -1.0);
+// 	//dprintf(1,"ratio P(w|.):\t%e\n", abs(exp(log_p_cond_bo + log_new_bo)-exp(log_p_cond))/exp(log_p_cond));
+real p = log_p_cond+log_p_post;
+real a = exp(log_p_cond_bo + log_new_bo);
+real b = exp(log_p_cond);
+real c = -p*exp(p);
+	                    
+ 	//dprintf(1,"ratio P(w|.):\t%e\n", c*abs(a-b)/b);    
+	return c*(abs(a-b)/b);
+//  	return abs(a-b)*exp(log_p_post);
+//	return abs(exp(log_p_cond_bo + log_new_bo)-exp(log_p_cond))/exp(log_p_cond);
+
+// 	return   -exp(log_p_post)
+// 	       * (removal + backed_off);
+
+}
+
+
+
+
+/**
+ * Words of a state which keep their transition, selected by the pruning
+ * policy (see PruningPolicy::selectWords()). The minimal backoff node
+ * (last_word = -1) keeps every word.
+ */
+void BackoffFstBuilder::selectKeptWords(vector<int> &kept, PruningBuffers &buffers, int last_word, real p_post, const vector<real> &all_prob, const vector<real> &all_bo_prob, const vector<bool> &skipped) {
+	if (last_word == -1) {
+		kept.resize(all_prob.size());
+		for (size_t w=0; w < kept.size(); w++) {
+			kept[w] = (int) w;
+		}
+	}
+	else {
+		pruning_policy->selectWords(kept, buffers, p_post, all_prob, all_bo_prob, skipped);
+	}
+}
+
+
+
+
+/**
+ * Same as computeEntropyAndConditionals() but, with class pruning, the
+ * word layer of a class is only computed if the pruning policy may keep
+ * one of its words (see PruningPolicy::canSkipClass()). The words of a skipped class are
+ * marked in skipped and get the probability of the class shared as in
+ * the backoff distribution, so that they back off.
+ * The state without history keeps every word and is never pruned.
+ * Return the number of skipped classes.
+ */
+int BackoffFstBuilder::computeEntropyAndConditionalsByClass(real &entropy, vector<real> &res, vector<bool> &skipped, CRnnLM &rnnlm, int last_word, real posterior, const vector<real> &bo_prob) {
+	struct neuron* output_layer = rnnlm.getOutputLayer();
+	real p = 0.0;
+	real p_joint = 0.0;
+	real p_class = 0.0;
+	real p_class_bo = 0.0;
+	bool skip = false;
+	int n_skipped = 0;
+	int w = 0;
+
+	skipped.assign(rnnlm.getVocabSize(), false);
+	if (!class_pruning || (last_word == -1)) {
+		FstBuilder::computeEntropyAndConditionals(entropy, res, rnnlm, last_word, posterior);
+		return 0;
+	}
+	if (posterior < 0.0) { posterior = -posterior; }
+
+	entropy = 0.0;
+
+	rnnlm.computeClassProbs(last_word);
+	for (int c = 0; c < rnnlm.getClassSize(); c++) {
+		p_class = output_layer[rnnlm.getVocabSize()+c].ac;
+		p_class_bo = 0.0;
+		for (int i = 0; i < rnnlm.getNumWordsInClass(c); i++) {
+			p_class_bo += exp(-bo_prob[rnnlm.getWordFromClass(i, c)]);
+		}
+		skip = pruning_policy->canSkipClass(posterior, p_class, p_class_bo);
+
+		if (!skip) {
+		 	rnnlm.computeClassWordProbs(last_word, rnnlm.getWordFromClass(0, c));
+		}
+		else {
+			n_skipped++;
+		}
+		for (int i = 0; i < rnnlm.getNumWordsInClass(c); i++) {
+			w = rnnlm.getWordFromClass(i, c);
+			if (!skip) {
+				p = log(p_class)+log(output_layer[w].ac);
+			}
+			else if (p_class_bo > 0.0) {
+				p = log(p_class)-bo_prob[w]-log(p_class_bo);
+				skipped[w] = true;
+			}
+			else {
+				p = log(p_class)-log((real) rnnlm.getNumWordsInClass(c));
+				skipped[w] = true;
+			}
+			p_joint = p-posterior;
+			entropy -= exp(p_joint)*p_joint;
+			res[w] = -p;
+		}
+	}
+	return n_skipped;
+}
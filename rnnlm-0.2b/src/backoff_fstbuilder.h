@@ -0,0 +1,91 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Pruning and backoff computations shared by the builders whose
+// backoff states are given by their discretizer (hierarchical
+// clusters, product quantization, sign projections)
+//
+///////////////////////////////////////////////////////////////////////
+
+
+
+#ifndef _BACKOFF_FSTBUILDER_H_
+#define _BACKOFF_FSTBUILDER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <fst/fstlib.h>
+#include "abstract_fstbuilder.h"
+#include "pruning_policy.h"
+
+using namespace std;
+using namespace fst;
+
+
+class BackoffFstBuilder : public FstBuilder {
+	
+	protected:
+	
+	//skip the word layer of the classes which cannot keep any word
+	bool class_pruning;
+
+	//selection of the kept words of the states (owned by the builder)
+	PruningPolicy *pruning_policy;
+
+	//number of threads expanding the states and computing the backoff weights
+	int n_threads;
+	
+	//Computation of backoff nodes
+	real computeDeltaEntropy(real log_p_post, // -log
+                     real log_p_cond, // -log
+                     real log_p_cond_bo, // -log 
+                     real sum_seen, // real
+                     real sum_seen_bo); // real
+	void selectKeptWords(vector<int> &kept, PruningBuffers &buffers, int last_word, real p_post, const vector<real> &all_prob, const vector<real> &all_bo_prob, const vector<bool> &skipped);
+	
+	//Computation of probs, once the history has been loaded in the input layer
+	int computeEntropyAndConditionalsByClass(real &entropy, vector<real> &res, vector<bool> &skipped, CRnnLM &rnnlm, int last_word, real posterior, const vector<real> &bo_prob);
+	void removePred(map< FstIndex,vector<FstIndex> > &pred, FstIndex dest, FstIndex src);
+	void removeStates(const VectorFst<LogArc> &old_fst, VectorFst<LogArc> &new_fst, vector<FstIndex> &to_be_deleted);	
+	
+	real deltaProb(real p_cond, real p_cond_bo);
+	
+	public:
+	//Computation of backoff weights (also used to merge the shards of a conversion)
+	static real computeFstWordProb(VectorFst<LogArc> &fst, int word, FstIndex state);
+	static void computeAllBackoff(VectorFst<LogArc> &fst, map< FstIndex,set<FstIndex> > &pred, int n_threads = 1);
+
+	//Removal of the states with only a backoff output (also used by the neuron builders)
+	static vector<FstIndex> compactBackoffNodes(VectorFst<LogArc> &fst, map< FstIndex,set<FstIndex> > &pred, vector<bool> &non_bo_pred);
+
+	BackoffFstBuilder(Discretizer* d, real t, int bol) : FstBuilder(d) 
+	{
+		pruning_threshold=t;
+		max_backoff_path=bol;
+		class_pruning=false;
+		pruning_policy=new EntropyPruningPolicy(t);
+		n_threads=1;
+	}
+
+	virtual ~BackoffFstBuilder() {
+		delete pruning_policy;
+	}
+
+	void setClassPruning(bool b) {
+		class_pruning = b;
+	}
+
+	void setThreads(int n) {
+		n_threads = (n < 1) ? 1 : n;
+	}
+
+	//replaces the entropy criterion (the builder takes ownership of p)
+	void setPruningPolicy(PruningPolicy *p) {
+		delete pruning_policy;
+		pruning_policy = p;
+	}
+
+};
+
+
+#endif
@@ -0,0 +1,151 @@
+/************************************************************************
+ * Vantage-point tree over the means of a ClusterDiscretizer.
+ *
+ ***********************************************************************/
+
+#include "centroid_index.h"
+#include "cluster_discretizer.h"
+#include <algorithm>
+#include <math.h>
+
+using namespace std;
+
+#define LEAF_SIZE 8	//maximum number of means in a leaf bucket
+
+CentroidIndex::CentroidIndex(const ClusterDiscretizer *d, real e, int checks)
+{
+	dzer = d;
+	eps = e;
+	max_checks = checks;
+	int n = dzer->getNumClusters();
+	ids.resize(n);
+	for (int i = 0; i < n; i++)
+	{
+		ids[i] = i;
+	}
+	vector<real> dist(n);
+	unsigned int seed = 1;
+	if (n > 0)
+	{
+		build(0, n, dist, seed);
+	}
+}
+
+
+
+/**
+ * Builds the subtree of ids[first] ... ids[last-1] and returns its node index
+ */
+int CentroidIndex::build(int first, int last, vector<real> &dist, unsigned int &seed)
+{
+	int id = nodes.size();
+	node nd;
+	nd.center = -1;
+	nd.mu = 0.0;
+	nd.inside = -1;
+	nd.outside = -1;
+	nd.first = first;
+	nd.last = last;
+	nodes.push_back(nd);
+	if (last-first <= LEAF_SIZE)
+	{
+		return id;
+	}
+
+	//random vantage point, moved to the front of the range
+	seed = seed*1103515245+12345;
+	swap(ids[first], ids[first+(seed/65536)%(last-first)]);
+	int center = ids[first];
+	const real *c = dzer->getMeans()+center*dzer->getStride();
+
+	//split the other means at the median distance
+	vector< pair<real,int> > tmp;
+	for (int i = first+1; i < last; i++)
+	{
+		tmp.push_back(make_pair((real) sqrt(dzer->sqDistance(c, ids[i])), ids[i]));
+	}
+	int mid = (first+1+last)/2;
+	nth_element(tmp.begin(), tmp.begin()+(mid-first-1), tmp.end());
+	for (int i = first+1; i < last; i++)
+	{
+		dist[i] = tmp[i-first-1].first;
+		ids[i] = tmp[i-first-1].second;
+	}
+
+	nodes[id].center = center;
+	nodes[id].mu = dist[mid];
+	int inside = (mid > first+1) ? build(first+1, mid, dist, seed) : -1;
+	int outside = (last > mid) ? build(mid, last, dist, seed) : -1;
+	nodes[id].inside = inside;
+	nodes[id].outside = outside;
+	return id;
+}
+
+
+
+void CentroidIndex::search(int n, const real * const x, real xnorm, int &best, real &best_dist, int &checks) const
+{
+	const node &nd = nodes[n];
+	real d2, lb;
+
+	if (nd.center < 0)
+	{
+		//leaf bucket: scan (with the norm bound and early termination)
+		for (int i = nd.first; i < nd.last; i++)
+		{
+			int c = ids[i];
+			lb = xnorm-dzer->getNorm(c);
+			if (lb*lb >= best_dist) { continue; }
+			if ((max_checks > 0) && (checks >= max_checks)) { return; }
+			checks++;
+			d2 = dzer->sqDistance(x, c, best_dist);
+			if (d2 < best_dist)
+			{
+				best_dist = d2;
+				best = c;
+			}
+		}
+		return;
+	}
+
+	if ((max_checks > 0) && (checks >= max_checks)) { return; }
+	checks++;
+	//the distance to the vantage point has to be exact to bound the subtrees
+	d2 = dzer->sqDistance(x, nd.center);
+	if (d2 < best_dist)
+	{
+		best_dist = d2;
+		best = nd.center;
+	}
+	real d = sqrt(d2);
+	real scale = (1.0+eps)*(1.0+eps);
+
+	//most promising side first, the other one only if it can still contain
+	//a closer mean: |x-p| >= d-mu inside, |x-p| >= mu-d outside
+	int first_child = (d < nd.mu) ? nd.inside : nd.outside;
+	int second_child = (d < nd.mu) ? nd.outside : nd.inside;
+	real second_lb = (d < nd.mu) ? nd.mu-d : d-nd.mu;
+	if (first_child >= 0)
+	{
+		search(first_child, x, xnorm, best, best_dist, checks);
+	}
+	if ((second_child >= 0) && (second_lb*second_lb*scale < best_dist))
+	{
+		search(second_child, x, xnorm, best, best_dist, checks);
+	}
+}
+
+
+
+int CentroidIndex::nearest(const real * const x, real xnorm, real *sqdist) const
+{
+	int best = 0;
+	real best_dist = 1e100;
+	int checks = 0;
+	if (!nodes.empty())
+	{
+		search(0, x, xnorm, best, best_dist, checks);
+	}
+	if (sqdist != NULL) { *sqdist = best_dist; }
+	return best;
+}
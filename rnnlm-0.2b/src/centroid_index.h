@@ -0,0 +1,66 @@
+/************************************************************************
+ * Vantage-point tree over the means of a ClusterDiscretizer, to find the
+ * closest mean of a vector without scanning all the clusters.
+ *
+ * Each node splits its means into those closer to its vantage point than
+ * the median distance mu (inside) and the others (outside). Small sets
+ * are stored as leaf buckets and scanned.
+ *
+ * Exact mode (eps = 0, no check limit) always returns the same cluster
+ * as a linear scan. With eps > 0, a subtree is skipped as soon as its
+ * lower bound times (1+eps) exceeds the best distance so far, and
+ * max_checks > 0 stops the search after that many distance computations.
+ *
+ ***********************************************************************/
+
+#ifndef _CENTROID_INDEX_H_
+#define _CENTROID_INDEX_H_
+
+#include <stdlib.h>
+#include <vector>
+#include "utils.h"
+
+using namespace std;
+
+class ClusterDiscretizer;
+
+class CentroidIndex
+{
+
+	protected:
+	struct node
+	{
+		int center;	//vantage point (-1 for a leaf bucket)
+		real mu;	//median distance to the vantage point
+		int inside;	//child node indices (-1 if empty)
+		int outside;
+		int first;	//bucket: ids[first] ... ids[last-1]
+		int last;
+	};
+
+	const ClusterDiscretizer *dzer;
+	vector<node> nodes;
+	vector<int> ids;
+	real eps;
+	int max_checks;
+
+	int build(int first, int last, vector<real> &dist, unsigned int &seed);
+	void search(int n, const real * const x, real xnorm, int &best, real &best_dist, int &checks) const;
+
+	public:
+
+	CentroidIndex(const ClusterDiscretizer *d, real e = 0.0, int checks = 0);
+
+	void setEps(real e) { eps = e; }
+	real getEps() const { return eps; }
+	void setMaxChecks(int checks) { max_checks = checks; }
+	int getMaxChecks() const { return max_checks; }
+	bool isExact() const { return (eps <= 0.0) && (max_checks <= 0); }
+
+	//returns the closest mean to a gathered vector x of norm xnorm (see
+	//ClusterDiscretizer::gather()), optionally with its squared distance
+	int nearest(const real * const x, real xnorm, real *sqdist = NULL) const;
+
+};
+
+#endif
@@ -0,0 +1,153 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Compare the clusters found through the centroid index with those of
+// a linear scan, for all the states of a hidden layer trace (as written
+// by trace-hidden-layer, with or without word ids).
+//
+///////////////////////////////////////////////////////////////////////
+
+#include "rnnlmlib.h"
+#include "hierarchical_cluster_discretizer.h"
+#include <string>
+#include <vector>
+#include <sstream>
+#include <alloca.h>
+
+using namespace std;
+
+int argPos(char *str, int argc, char **argv)
+{
+    int a;
+
+    for (a=1; a<argc; a++) if (!strcmp(str, argv[a])) return a;
+
+    return -1;
+}
+
+//number of values of the first mean of a k-means file
+int readNumDims(string fn)
+{
+	ClusterMap map;
+	if (ClusterMap::isBinary(fn))
+	{
+		return map.open(fn) ? map.getNumDims() : 0;
+	}
+	fstream in (fn.c_str());
+	string line, word;
+	while (getline(in, line))
+	{
+		istringstream strstr(line);
+		int n = 0;
+		if (!(strstr >> word) || (word[0] == '#') || (word[0] == '-')) { continue; }
+		while ((strstr >> word) && (word[0] != '#')) { n++; }
+		if (n > 0) { return n; }
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    real eps = 0.0;
+    int max_checks = 0;
+    int min_clusters = 1;
+    string disc_map_file;
+    string trace_file;
+
+    if (argc==1)
+    {
+    	fprintf(stderr,"Checks the approximate nearest cluster search against a linear scan of the means\n\n");
+    	fprintf(stderr,"Syntax:\n\tcheck-cluster-index -discretize <kmeans_file> -trace <trace_file> [-cluster-index <eps>] [-index-checks <N>] [-min-clusters <N>]\n\n");
+    	return 0;
+    }
+
+    i=argPos((char *)"-discretize", argc, argv);
+    if ((i>0) && (i+1<argc)) disc_map_file = argv[i+1];
+    i=argPos((char *)"-trace", argc, argv);
+    if ((i>0) && (i+1<argc)) trace_file = argv[i+1];
+    i=argPos((char *)"-cluster-index", argc, argv);
+    if ((i>0) && (i+1<argc)) eps = atof(argv[i+1]);
+    i=argPos((char *)"-index-checks", argc, argv);
+    if ((i>0) && (i+1<argc)) max_checks = atoi(argv[i+1]);
+    i=argPos((char *)"-min-clusters", argc, argv);
+    if ((i>0) && (i+1<argc)) min_clusters = atoi(argv[i+1]);
+
+    if (disc_map_file.empty() || trace_file.empty())
+    {
+    	fprintf(stderr,"ERROR: both -discretize and -trace have to be specified!\n");
+    	return 1;
+    }
+
+    int n_dims = readNumDims(disc_map_file);
+    if (n_dims == 0)
+    {
+    	fprintf(stderr,"ERROR: no mean found in %s\n", disc_map_file.c_str());
+    	return 1;
+    }
+    HierarchicalClusterDiscretizer dzer(n_dims, disc_map_file);
+    double t0 = PerfCounters::now();
+    dzer.setIndex(eps, max_checks, min_clusters);
+    double build_time = PerfCounters::now()-t0;
+
+    int n_levels = dzer.getNumLevels();
+    vector<long long> disagree(n_levels, 0);
+    vector<double> ratio(n_levels, 0.0);
+    vector<double> scan_time(n_levels, 0.0);
+    vector<double> index_time(n_levels, 0.0);
+    long long n_states = 0;
+
+    int stride = dzer.getLevel(0).getStride();
+    real *x = (real *) alloca(stride*sizeof(real)+16);
+    x = (real *) (((size_t) x+15) & ~((size_t) 15));
+    vector<real> fields;
+
+    //last n_dims fields of each line are the hidden layer
+    fstream in (trace_file.c_str());
+    string line;
+    while (getline(in, line))
+    {
+    	istringstream strstr(line);
+    	real v;
+    	fields.clear();
+    	while (strstr >> v) fields.push_back(v);
+    	if ((int) fields.size() < n_dims) continue;
+
+    	real xnorm = 0.0;
+    	for (i = 0; i < stride; i++)
+    	{
+    		x[i] = (i < n_dims) ? fields[fields.size()-n_dims+i] : 0.0;
+    		xnorm += x[i]*x[i];
+    	}
+    	xnorm = sqrt(xnorm);
+
+    	for (int lvl = 0; lvl < n_levels; lvl++)
+    	{
+    		const ClusterDiscretizer &level = dzer.getLevel(lvl);
+    		real d_scan, d_index;
+    		double t1 = PerfCounters::now();
+    		int c_scan = level.nearestScan(x, xnorm, &d_scan);
+    		double t2 = PerfCounters::now();
+    		int c_index = level.nearest(x, xnorm, &d_index);
+    		double t3 = PerfCounters::now();
+    		scan_time[lvl] += t2-t1;
+    		index_time[lvl] += t3-t2;
+    		if (c_scan != c_index) disagree[lvl]++;
+    		if (d_scan > 0) ratio[lvl] += sqrt(d_index/d_scan);
+    		else ratio[lvl] += 1.0;
+    	}
+    	n_states++;
+    }
+    in.close();
+
+    printf("%lld states, %d dims, eps %g, max checks %d, index built in %.3f s\n", n_states, n_dims, (double) eps, max_checks, build_time);
+    printf("level\tclusters\tindexed\tdisagreement\tdist_ratio\tscan_us\tindex_us\n");
+    for (int lvl = 0; lvl < n_levels; lvl++)
+    {
+    	double n = (n_states > 0) ? (double) n_states : 1.0;
+    	printf("%d\t%d\t%s\t%.6f\t%.6f\t%.3f\t%.3f\n", lvl, dzer.getLevelSize(lvl),
+    		dzer.getLevel(lvl).getIndex() != NULL ? "yes" : "no",
+    		disagree[lvl]/n, ratio[lvl]/n, 1e6*scan_time[lvl]/n, 1e6*index_time[lvl]/n);
+    }
+
+    return 0;
+}
@@ -11,79 +11,426 @@
 #include "cluster_fsthistory.h"
 #include <iostream>
 #include <sstream>
+#include <alloca.h>
+#include <ctype.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef USE_BLAS
+extern "C" {
+#include <cblas.h>
+}
+#endif
 
 using namespace std;
 
 #define mylog(x) -log(x)
 
+#define SIMD_BLOCK 8	//dimensions processed between two early termination tests
+#define BATCH_ROWS 64	//vectors per GEMM block in assignBatch()
+#define BATCH_CLUSTERS 256	//means per GEMM block in assignBatch()
+
 ClusterDiscretizer::ClusterDiscretizer(int dims, int cl/* , int nw*/) 
 {
-	means = new real*[cl];
-	prior = new real[cl];
-//	word_prior = new real*[cl];
-	n_dims = dims;
-	n_clusters = cl;
-//	n_words = nw;
-	for (int i=0; i < cl; i++) 
-	{
-		means[i] = new real[dims];
-//		word_prior[i] = new real[n_words];
-	}
+	allocate(dims, cl);
 }
 
 ClusterDiscretizer::ClusterDiscretizer(int dims, int cl,
 // int nw,
  string fn) {
-	means = new real*[cl];
-	prior = new real[cl];
-//	word_prior = new real*[cl];
+	allocate(dims, cl);
+	load(fn);
+}
+
+ClusterDiscretizer::ClusterDiscretizer(const ClusterDiscretizer &dzer) 
+{
+	allocate(dzer.n_dims, dzer.n_clusters);
+	memcpy(prior, dzer.prior, n_clusters*sizeof(real));
+	memcpy(norms, dzer.norms, n_clusters*sizeof(real));
+	memcpy(parents, dzer.parents, n_clusters*sizeof(int));
+	memcpy(means, dzer.means, (size_t) n_clusters*stride*sizeof(real));
+	recurrent = dzer.recurrent;
+	if (dzer.index != NULL) 
+	{
+		buildIndex(dzer.index->getEps(), dzer.index->getMaxChecks());
+	}
+}
+
+ClusterDiscretizer::~ClusterDiscretizer() 
+{
+	release();
+}
+
+ClusterDiscretizer& ClusterDiscretizer::operator=(const ClusterDiscretizer &dzer) 
+{
+	if (this != &dzer) 
+	{
+		release();
+		allocate(dzer.n_dims, dzer.n_clusters);
+		memcpy(prior, dzer.prior, n_clusters*sizeof(real));
+		memcpy(norms, dzer.norms, n_clusters*sizeof(real));
+		memcpy(parents, dzer.parents, n_clusters*sizeof(int));
+		memcpy(means, dzer.means, (size_t) n_clusters*stride*sizeof(real));
+		recurrent = dzer.recurrent;
+		if (dzer.index != NULL) 
+		{
+			buildIndex(dzer.index->getEps(), dzer.index->getMaxChecks());
+		}
+	}
+	return *this;
+}
+
+void ClusterDiscretizer::allocate(int dims, int cl) 
+{
+	void *p = NULL;
 	n_dims = dims;
 	n_clusters = cl;
 //	n_words = nw;
+	stride = ((dims+SIMD_BLOCK-1)/SIMD_BLOCK)*SIMD_BLOCK;
+	if (stride == 0) { stride = SIMD_BLOCK; }
+	//all the means in one aligned block, padding dims stay at 0 so that they
+	//do not contribute to distances
+	if (posix_memalign(&p, 16, (size_t) (cl > 0 ? cl : 1)*stride*sizeof(real)) != 0) 
+	{
+		printf("Memory allocation failed\n");
+		exit(1);
+	}
+	means = (real *) p;
+	own_means = true;
+	mapping = NULL;
+	memset(means, 0, (size_t) (cl > 0 ? cl : 1)*stride*sizeof(real));
+	norms = new real[cl];
+	prior = new real[cl];
+	parents = new int[cl];
+	index = NULL;
 	for (int i=0; i < cl; i++) 
 	{
-		means[i] = new real[dims];
-//		word_prior[i] = new real[n_words];
+		norms[i] = 0.0;
+		prior[i] = 0.0;
+		parents[i] = -1;
 	}
-	load(fn);
 }
 
-ClusterDiscretizer::ClusterDiscretizer(const ClusterDiscretizer &dzer) 
+void ClusterDiscretizer::release() 
 {
-	n_dims = dzer.n_dims;
-	n_clusters = dzer.n_clusters;
-//	n_words = dzer.n_words;
-	means = new real*[n_clusters];
-	prior = new real[n_clusters];
-//	word_prior = new real*[n_clusters];
-	
-	//for each cluster
-	for (int i=0; i < n_clusters; i++) 
-	{
-		//copy cluster prior
-		prior[i] = dzer.prior[i];
-		//copy mean
-		means[i] = new real[n_dims];
-		for (int j=0; j < dzer.n_dims; j++) {
-			means[i][j] = dzer.means[i][j];
+	dropIndex();
+	if (own_means) 
+	{
+		free(means);
+	}
+	delete[] norms;
+	delete[] prior;
+	delete[] parents;
+	delete mapping;
+	mapping = NULL;
+	recurrent.clear();
+	means = NULL;
+	norms = NULL;
+	prior = NULL;
+	parents = NULL;
+}
+
+void ClusterDiscretizer::updateNorm(int cl) 
+{
+	const real *c = means+cl*stride;
+	real n = 0.0;
+	for (int i = 0; i < n_dims; i++) 
+	{
+		n += c[i]*c[i];
+	}
+	norms[cl] = sqrt(n);
+}
+
+
+
+//squared L2 distance between two aligned vectors of stride values, stops as soon as
+//the partial sum exceeds bound (the returned value is then only a lower bound)
+static inline real sqDistanceL2(const real * const u, const real * const v, int stride, real bound) 
+{
+#ifdef __SSE2__
+	__m128d acc0 = _mm_setzero_pd();
+	__m128d acc1 = _mm_setzero_pd();
+	__m128d acc2 = _mm_setzero_pd();
+	__m128d acc3 = _mm_setzero_pd();
+	__m128d d;
+	double part[2];
+	real dist = 0.0;
+	for (int i = 0; i < stride; i += SIMD_BLOCK) 
+	{
+		d = _mm_sub_pd(_mm_load_pd(u+i), _mm_load_pd(v+i));
+		acc0 = _mm_add_pd(acc0, _mm_mul_pd(d, d));
+		d = _mm_sub_pd(_mm_load_pd(u+i+2), _mm_load_pd(v+i+2));
+		acc1 = _mm_add_pd(acc1, _mm_mul_pd(d, d));
+		d = _mm_sub_pd(_mm_load_pd(u+i+4), _mm_load_pd(v+i+4));
+		acc2 = _mm_add_pd(acc2, _mm_mul_pd(d, d));
+		d = _mm_sub_pd(_mm_load_pd(u+i+6), _mm_load_pd(v+i+6));
+		acc3 = _mm_add_pd(acc3, _mm_mul_pd(d, d));
+		_mm_storeu_pd(part, _mm_add_pd(_mm_add_pd(acc0, acc1), _mm_add_pd(acc2, acc3)));
+		dist = part[0]+part[1];
+		if (dist >= bound) { break; }
+	}
+	return dist;
+#else
+	real dist = 0.0;
+	real d;
+	for (int i = 0; i < stride; i += SIMD_BLOCK) 
+	{
+		for (int j = i; j < i+SIMD_BLOCK; j++) 
+		{
+			d = u[j]-v[j];
+			dist += d*d;
 		}
-//		//copy word priors
-//		word_prior[i] = new real[n_words];
-//		for (int j=0; j < dzer.n_words; j++) {
-//			word_prior[i][j] = dzer.word_prior[i][j];
-//		}
+		if (dist >= bound) { break; }
+	}
+	return dist;
+#endif
+}
+
+
+
+real ClusterDiscretizer::gather(real *x, const struct neuron * const layer) const 
+{
+	real n = 0.0;
+	int i = 0;
+	for (; i < n_dims; i++) 
+	{
+		x[i] = layer[i].ac;
+		n += x[i]*x[i];
 	}
+	for (; i < stride; i++) 
+	{
+		x[i] = 0.0;
+	}
+	return sqrt(n);
+}
+
+void ClusterDiscretizer::buildIndex(real eps, int max_checks) 
+{
+	dropIndex();
+	index = new CentroidIndex(this, eps, max_checks);
 }
 
+void ClusterDiscretizer::dropIndex() 
+{
+	if (index != NULL) 
+	{
+		delete index;
+		index = NULL;
+	}
+}
 
+int ClusterDiscretizer::nearest(const real * const x, real xnorm, real *sqdist) const 
+{
+	if (index != NULL) 
+	{
+		return index->nearest(x, xnorm, sqdist);
+	}
+	return nearestScan(x, xnorm, sqdist);
+}
 
-real ClusterDiscretizer::distanceL2(const real * const u, const struct neuron * const v) const {
+int ClusterDiscretizer::nearestScan(const real * const x, real xnorm, real *sqdist) const 
+{
+	int min_cl = 0;
+	real min_dist = 1e100;
 	real dist = 0.0;
-	for (int i = 0; i < n_dims; i++) {
+	real lb = 0.0;
+	for (int i = 0; i < n_clusters; i++) 
+	{
+		//triangle inequality: |x-c| >= | |x| - |c| |
+		lb = xnorm-norms[i];
+		if (lb*lb >= min_dist) { continue; }
+		dist = sqDistanceL2(x, means+i*stride, stride, min_dist);
+		if (dist < min_dist) 
+		{
+			min_dist = dist;
+			min_cl = i;
+		}
+	}
+	if (sqdist != NULL) { *sqdist = min_dist; }
+	return min_cl;
+}
+
+real ClusterDiscretizer::sqDistance(const real * const x, int cl, real bound) const 
+{
+	return sqDistanceL2(x, means+cl*stride, stride, bound);
+}
+
+
+
+//c = a.bt where a is m x k (leading dim lda), bt is k x n and c is m x n (both packed,
+//n is a multiple of 4 and bt is 16-byte aligned)
+static void gemmNN(real * const c, const real * const a, int lda, const real * const bt, int m, int n, int k) 
+{
+#ifdef USE_BLAS
+	cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k, 1.0, a, lda, bt, n, 0.0, c, n);
+#else
+	int i = 0;
+#ifdef __SSE2__
+	//4 rows x 4 columns of c are accumulated in registers
+	for (; i+4 <= m; i += 4) 
+	{
+		const real * const a0 = a+(size_t) i*lda;
+		const real * const a1 = a0+lda;
+		const real * const a2 = a1+lda;
+		const real * const a3 = a2+lda;
+		for (int j = 0; j < n; j += 4) 
+		{
+			__m128d c00 = _mm_setzero_pd(), c01 = _mm_setzero_pd();
+			__m128d c10 = _mm_setzero_pd(), c11 = _mm_setzero_pd();
+			__m128d c20 = _mm_setzero_pd(), c21 = _mm_setzero_pd();
+			__m128d c30 = _mm_setzero_pd(), c31 = _mm_setzero_pd();
+			__m128d b0, b1, v;
+			for (int l = 0; l < k; l++) 
+			{
+				b0 = _mm_load_pd(bt+(size_t) l*n+j);
+				b1 = _mm_load_pd(bt+(size_t) l*n+j+2);
+				v = _mm_set1_pd(a0[l]);
+				c00 = _mm_add_pd(c00, _mm_mul_pd(v, b0));
+				c01 = _mm_add_pd(c01, _mm_mul_pd(v, b1));
+				v = _mm_set1_pd(a1[l]);
+				c10 = _mm_add_pd(c10, _mm_mul_pd(v, b0));
+				c11 = _mm_add_pd(c11, _mm_mul_pd(v, b1));
+				v = _mm_set1_pd(a2[l]);
+				c20 = _mm_add_pd(c20, _mm_mul_pd(v, b0));
+				c21 = _mm_add_pd(c21, _mm_mul_pd(v, b1));
+				v = _mm_set1_pd(a3[l]);
+				c30 = _mm_add_pd(c30, _mm_mul_pd(v, b0));
+				c31 = _mm_add_pd(c31, _mm_mul_pd(v, b1));
+			}
+			_mm_storeu_pd(c+(size_t) i*n+j, c00);
+			_mm_storeu_pd(c+(size_t) i*n+j+2, c01);
+			_mm_storeu_pd(c+(size_t) (i+1)*n+j, c10);
+			_mm_storeu_pd(c+(size_t) (i+1)*n+j+2, c11);
+			_mm_storeu_pd(c+(size_t) (i+2)*n+j, c20);
+			_mm_storeu_pd(c+(size_t) (i+2)*n+j+2, c21);
+			_mm_storeu_pd(c+(size_t) (i+3)*n+j, c30);
+			_mm_storeu_pd(c+(size_t) (i+3)*n+j+2, c31);
+		}
+	}
+#endif
+	//remaining rows: row of c += a[i][l] * row l of bt
+	for (; i < m; i++) 
+	{
+		real * const ci = c+(size_t) i*n;
+		const real * const ai = a+(size_t) i*lda;
+		for (int j = 0; j < n; j++) 
+		{
+			ci[j] = 0.0;
+		}
+		for (int l = 0; l < k; l++) 
+		{
+			const real v = ai[l];
+			const real * const bl = bt+(size_t) l*n;
+			for (int j = 0; j < n; j++) 
+			{
+				ci[j] += v*bl[j];
+			}
+		}
+	}
+#endif
+}
+
+
 
-		dist += pow(u[i]-v[i].ac, 2);
+void ClusterDiscretizer::assignBatch(int * const ids, int ids_ld, const real * const x, int n, int ld) const 
+{
+	if (index != NULL) 
+	{
+		//the index may be approximate, so it is queried vector by vector to give
+		//the same ids as discretize()
+		real *v = (real *) alloca(stride*sizeof(real)+16);
+		v = (real *) (((size_t) v+15) & ~((size_t) 15));
+		for (int r = 0; r < n; r++) 
+		{
+			real vnorm = 0.0;
+			int i = 0;
+			for (; i < n_dims; i++) 
+			{
+				v[i] = x[(size_t) r*ld+i];
+				vnorm += v[i]*v[i];
+			}
+			for (; i < stride; i++) 
+			{
+				v[i] = 0.0;
+			}
+			ids[(size_t) r*ids_ld] = index->nearest(v, sqrt(vnorm));
+		}
+		return;
+	}
+	
+	//argmin_c |x-c|^2 = argmin_c |c|^2 - 2 x.c, the dot products of a block of
+	//vectors against a block of means are computed with one matrix product
+	real *sqnorms = new real[n_clusters];
+	void *p = NULL;
+	//read with aligned loads by gemmNN()
+	if (posix_memalign(&p, 16, (size_t) (n_dims > 0 ? n_dims : 1)*BATCH_CLUSTERS*sizeof(real)) != 0) 
+	{
+		printf("Memory allocation failed\n");
+		exit(1);
+	}
+	real *meanst = (real *) p;
+	real *dots = new real[BATCH_ROWS*BATCH_CLUSTERS];
+	real *best = new real[n > 0 ? n : 1];
+	real score;
+	
+	for (int k = 0; k < n_clusters; k++) 
+	{
+		const real *c = means+k*stride;
+		sqnorms[k] = 0.0;
+		for (int i = 0; i < n_dims; i++) 
+		{
+			sqnorms[k] += c[i]*c[i];
+		}
+	}
+	for (int r = 0; r < n; r++) 
+	{
+		best[r] = 1e100;
+		ids[(size_t) r*ids_ld] = 0;
 	}
-	return sqrt(dist);
+	
+	for (int k0 = 0; k0 < n_clusters; k0 += BATCH_CLUSTERS) 
+	{
+		int nk = (n_clusters-k0 < BATCH_CLUSTERS) ? n_clusters-k0 : BATCH_CLUSTERS;
+		int nk4 = (nk+3) & ~3;	//padded to the width of the GEMM kernel
+		//block of means transposed to dims x nk4
+		for (int i = 0; i < n_dims; i++) 
+		{
+			for (int k = 0; k < nk4; k++) 
+			{
+				meanst[(size_t) i*nk4+k] = (k < nk) ? means[(size_t) (k0+k)*stride+i] : 0.0;
+			}
+		}
+		for (int r0 = 0; r0 < n; r0 += BATCH_ROWS) 
+		{
+			int nr = (n-r0 < BATCH_ROWS) ? n-r0 : BATCH_ROWS;
+			gemmNN(dots, x+(size_t) r0*ld, ld, meanst, nr, nk4, n_dims);
+			for (int r = 0; r < nr; r++) 
+			{
+				const real *d = dots+r*nk4;
+				int min_k = -1;
+				real min_score = best[r0+r];
+				for (int k = 0; k < nk; k++) 
+				{
+					score = sqnorms[k0+k]-2*d[k];
+					if (score < min_score) 
+					{
+						min_score = score;
+						min_k = k;
+					}
+				}
+				if (min_k >= 0) 
+				{
+					best[r0+r] = min_score;
+					ids[(size_t) (r0+r)*ids_ld] = k0+min_k;
+				}
+			}
+		}
+	}
+	
+	delete[] best;
+	delete[] dots;
+	free(meanst);
+	delete[] sqnorms;
 }
 
 
@@ -93,97 +440,179 @@ real ClusterDiscretizer::distanceL2(const real * const u, const struct neuron *
 ////////////////////////////////////
 
 
-void ClusterDiscretizer::discretize(FstHistory* const fsth, const struct neuron * const layer) const 
+void ClusterDiscretizer::discretize(ClusterFstHistory &h, const struct neuron * const layer) const
+{
+	real *x = (real *) alloca(stride*sizeof(real)+16);
+	x = (real *) (((size_t) x+15) & ~((size_t) 15));
+	real xnorm = gather(x, layer);
+	h.setDiscretized(nearest(x, xnorm));
+}
+
+
+
+void ClusterDiscretizer::discretize(FstHistory* const fsth, const struct neuron * const layer) const
 {
 	ClusterFstHistory *p = dynamic_cast<ClusterFstHistory *>(fsth);
-	if (p != NULL) 
+	if (p != NULL)
 	{
-		int min_cl = 0;
-		real min_dist = 1e100;
-		real dist = 0.0;
-		for (int i = 0; i < getNumClusters(); i++) 
-		{
-			dist = distanceL2(means[i],layer);
-//			printf("DIST(%i) = %f\n", i, (float) dist);
-			if (dist < min_dist) 
-			{
-				min_dist = dist;
-				min_cl = i;
-			}
-		}
-//		printf("FINAL DIST = DIST(%i) = %f\n", min_cl, (float) min_dist);
-		p->setDiscretized(min_cl);
+		discretize(*p, layer);
 	}
 }
 
 
+void ClusterDiscretizer::cacheRecurrentInput(CRnnLM &rnnlm) 
+{
+	recurrent.clear();
+	if (rnnlm.getHiddenLayerSize() != n_dims) 
+	{
+		return;
+	}
+	recurrent.resize((size_t) n_clusters*n_dims);
+	for (int cl = 0; cl < n_clusters; cl++) 
+	{
+		rnnlm.computeRecurrentInput(&recurrent[(size_t) cl*n_dims], means+(size_t) cl*stride);
+	}
+}
+
+
+const real *ClusterDiscretizer::getRecurrentInput(const ClusterFstHistory &h) const 
+{
+	return getRecurrentInput(h.getDiscretized());
+}
+
+
+void ClusterDiscretizer::discretizeBatch(int * const ids, const real * const x, int n, int ld) const 
+{
+	assignBatch(ids, 1, x, n, ld);
+}
+
+
 	
+void ClusterDiscretizer::undiscretize(struct neuron * const layer, const ClusterFstHistory &h) const {
+	const real *c = means+h.getDiscretized()*stride;
+	for (int i = 0; i < getNumDims(); i++) {
+		layer[i].ac = c[i];
+	}
+}
+
+
+
 void ClusterDiscretizer::undiscretize(struct neuron * const layer, const FstHistory * const fsth) const {
 	const ClusterFstHistory *p = dynamic_cast<const ClusterFstHistory *>(fsth);
 	if (p != NULL) {
-		for (int i = 0; i < getNumDims(); i++) {
-			layer[i].ac = means[p->getDiscretized()][i];
-		}
+		undiscretize(layer, *p);
 	}
 }
 
 
 bool ClusterDiscretizer::load(fstream &in) 
 {
-	string word;
 	string line;
 	if ( !in )
 	  return false;
-	  
-	int cl = 0;
+	
+	//the whole level is read before being allocated
+	vector<real> p;
+	vector<real> m;
+	vector<int> par;
+	char *end;
 	while (getline(in, line)) 
 	{
-//		cout << line << endl;
-		istringstream strstr(line);
-		int i = 0;
-		real v = 0.0;
-		strstr >> word;
+		const char *s = line.c_str();
+		while (isspace(*s)) { s++; }
+		//end of the level
+		if (s[0] == '-' && s[1] == '-') { break; }
 		//if comment skip
-//		if (word == "--") { continue; }
-		if (word[0] == '-' && word[1] == '-') 
-		{ 
-			return (cl >= n_clusters); 
-		}
-		if (word[0] == '#') { continue; }		
+		if ((*s == '\0') || (*s == '#')) { continue; }
+		real pr = strtod(s, &end);
+		s = end;
 		//read mean
-		prior[cl] = mylog(atof(word.c_str()));
-//		printf("P_prior(c%i) = %f\n", cl, atof(word.c_str()));
-		while (strstr >> word) 
+		size_t row = m.size();
+		int parent = -1;
+		int i = 0;
+		m.resize(row+stride, 0.0);
+		while (true) 
 		{
-			if (word[0] == '#') { break; }
-			v = atof(word.c_str());
-			means[cl][i] = v;
-//			printf("means[%i][%i] = %f\n", cl, i, v);
+			while (isspace(*s)) { s++; }
+			if (*s == '#') 
+			{
+				if (strncmp(s, "#parent", 7) == 0) { parent = atoi(s+7); }
+				break;
+			}
+			real v = strtod(s, &end);
+			if (end == s) { break; }
+			if (i < n_dims) { m[row+i] = v; }
+			s = end;
 			i++;
 		}
-		//read word priors
-//		for (int j=0; j<n_words && getline(in,line); j++) {
-//			strstr.str (line);
-//			v = atof(line.c_str());
-//			word_prior[cl][j] = v;
-//			printf("P(w%i|c%i) = %f\n", j, cl, v);
-//		}
-		
-		cl++; //move to next cluster mean
-//		if (cl >= n_clusters) { return true; }
-	}
-// // 	//copy the last line until filling all the dims
-// // 	for (cl = cl; cl < n_clusters; cl++) {
-// // 		prior[cl] = prior[cl-1];
-// // 		for (int i=0; i < n_dims; i++) {
-// // 			means[cl][i] = means[cl-1][i];
-// // 		}
-// // 	}
-
-	return (cl >= n_clusters);
+		//a single value is a word prior
+		if (i == 0) 
+		{
+			m.resize(row);
+			continue;
+		}
+		p.push_back(mylog(pr));
+		par.push_back(parent);
+	}
+	
+	release();
+	allocate(n_dims, p.size());
+	if (n_clusters > 0) 
+	{
+		memcpy(means, &m[0], m.size()*sizeof(real));
+		memcpy(prior, &p[0], n_clusters*sizeof(real));
+		memcpy(parents, &par[0], n_clusters*sizeof(int));
+	}
+	for (int cl = 0; cl < n_clusters; cl++) 
+	{
+		updateNorm(cl);
+	}
+	return (n_clusters > 0);
+}
+
+bool ClusterDiscretizer::load(const ClusterMap &map, int lvl) 
+{
+	if ((map.getNumDims() != n_dims) || (lvl >= map.getNumLevels())) 
+	{
+		fprintf(stderr, "ERROR: no level %i of %i dims in the binary k-means file\n", lvl, n_dims);
+		return false;
+	}
+	release();
+	allocate(n_dims, map.getLevelSize(lvl));
+	if (map.getStride() == stride) 
+	{
+		free(means);
+		means = map.getMeans(lvl);
+		own_means = false;
+	}
+	else 
+	{
+		for (int cl = 0; cl < n_clusters; cl++) 
+		{
+			memcpy(means+(size_t) cl*stride, map.getMeans(lvl)+(size_t) cl*map.getStride(), n_dims*sizeof(real));
+		}
+	}
+	const int32_t *par = map.getParents(lvl);
+	for (int cl = 0; cl < n_clusters; cl++) 
+	{
+		prior[cl] = map.getPriors(lvl)[cl];
+		parents[cl] = par[cl];
+		updateNorm(cl);
+	}
+	return (n_clusters > 0);
 }
 
 bool ClusterDiscretizer::load(string fn) {
+	if (ClusterMap::isBinary(fn)) {
+		//first level of a binary file, kept mapped until release()
+		ClusterMap *map = new ClusterMap();
+		if (!map->open(fn) || !load(*map, 0)) {
+			delete map;
+			return false;
+		}
+		mapping = map;
+		return true;
+	}
 	fstream in (fn.c_str());
 	bool res = load(in);
 	in.close();
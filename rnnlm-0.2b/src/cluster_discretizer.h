@@ -15,6 +15,13 @@
  * ...
  * --
  *
+ * In a hierarchy, the mean of a cluster can be followed by "#parent <id>",
+ * the index of the enclosing cluster in the previous level (loaders which
+ * do not know about it skip it as a comment). Word prior lines are skipped.
+ *
+ * Files converted with convert-kmeans (see cluster_map.h) are mapped in
+ * memory instead of being parsed.
+ *
  *
  *
  * Author: Gwénolé Lecorvé
@@ -31,21 +38,34 @@
 #include <fstream>
 #include <vector>
 #include "abstract_discretizer.h"
+#include "centroid_index.h"
+#include "cluster_map.h"
  
 using namespace std;
  
+class ClusterFstHistory;
+
 class ClusterDiscretizer : public Discretizer 
 {
 
 	protected:
-	real **means;
+	real *means;	//n_clusters x stride matrix, 16-byte aligned rows, zero padded
+	real *norms;	//L2 norm of each mean
 	real *prior;
+	int *parents;	//cluster of the previous level in a hierarchy (-1 if unknown)
+	CentroidIndex *index;	//optional search tree over the means (NULL: linear scan)
+	bool own_means;	//false if means point into a mapped binary file
+	ClusterMap *mapping;	//binary file loaded by load(string), NULL otherwise
+	vector<real> recurrent;	//n_clusters x n_dims products of the recurrent weights and the means (empty if not cached)
 //	real **word_prior;
 	
 	int n_clusters;
+	int stride;	//n_dims rounded up to the SIMD block size
 //	int n_words;
 	
-	real distanceL2(const real * const u, const struct neuron * const v) const;
+	void allocate(int dims, int cl);
+	void release();
+	void updateNorm(int cl);
 	
 	public:
 	
@@ -54,11 +74,37 @@ class ClusterDiscretizer : public Discretizer
 	ClusterDiscretizer(int dims, int cl);
 	ClusterDiscretizer(int dims, int cl, string fn);
 	ClusterDiscretizer(const ClusterDiscretizer &dzer);
+	~ClusterDiscretizer();
+	ClusterDiscretizer& operator=(const ClusterDiscretizer &dzer);
 	
 	int getNumClusters() const { return n_clusters; }
+	int getStride() const { return stride; }
+	
+	//note: changing a mean drops the index
+	void setMean(int cl, int dim, real val) { means[cl*stride+dim] = val; updateNorm(cl); dropIndex(); }
+	real getMean(int cl, int dim) const { return means[cl*stride+dim]; }
+	const real *getMeans() const { return means; }
+	real getNorm(int cl) const { return norms[cl]; }
 	
-	void setMean(int cl, int dim, real val) { means[cl][dim] = val; }
-	real getMean(int cl, int dim) const { return means[cl][dim]; }
+	//copies the activations of a layer to a contiguous, zero padded vector of
+	//getStride() values and returns its L2 norm
+	real gather(real *x, const struct neuron * const layer) const;
+	//returns the index of the closest mean to a gathered vector x of norm xnorm
+	//(optionally with the squared distance), through the index if there is one
+	int nearest(const real * const x, real xnorm, real *sqdist = NULL) const;
+	//same as nearest() with a linear scan of all the means
+	int nearestScan(const real * const x, real xnorm, real *sqdist = NULL) const;
+	
+	//builds a search tree over the means (exact search if eps is 0 and max_checks is 0)
+	void buildIndex(real eps = 0.0, int max_checks = 0);
+	void dropIndex();
+	const CentroidIndex *getIndex() const { return index; }
+	//squared distance between a gathered vector and one mean, the computation stops
+	//as soon as it exceeds bound (only a lower bound is returned then)
+	real sqDistance(const real * const x, int cl, real bound = 1e100) const;
+	
+	void setParent(int cl, int p) { parents[cl] = p; }
+	int getParent(int cl) const { return parents[cl]; }
 	
 	
 	void setPrior(int cl, real val) { prior[cl] = val; }
@@ -68,10 +114,28 @@ class ClusterDiscretizer : public Discretizer
 //	real getWordPrior(int cl, int word) const { return word_prior[cl][word]; }
 	
 	
+	//precomputes the product of the recurrent weights of rnnlm and of each mean
+	//(to be called again if the weights or the means change)
+	void cacheRecurrentInput(CRnnLM &rnnlm);
+	const real *getRecurrentInput(int cl) const { return recurrent.empty() ? NULL : &recurrent[(size_t) cl*n_dims]; }
+	const real *getRecurrentInput(const ClusterFstHistory &h) const;
+	
+	//same as discretize()/undiscretize() without checking the type of the history
+	void discretize(ClusterFstHistory &h, const struct neuron * const layer) const;
+	void undiscretize(struct neuron * const layer, const ClusterFstHistory &h) const;
 	void discretize(FstHistory* const fsth, const struct neuron* layer) const;
+	int getCodeSize() const { return 1; }
+	void discretizeBatch(int * const ids, const real * const x, int n, int ld) const;
+	//same as discretizeBatch() but the id of the i-th vector is written to ids[i*ids_ld]
+	void assignBatch(int * const ids, int ids_ld, const real * const x, int n, int ld) const;
 	void undiscretize(struct neuron* layer, const FstHistory* fsth) const;
 	
+	//reads the next level of a text file (until "--"), the number of clusters
+	//is set to the number of means found
 	bool load(fstream &in);
+	//uses the level lvl of a binary file, whose means are not copied when the
+	//strides match (map must outlive the discretizer)
+	bool load(const ClusterMap &map, int lvl);
 	bool load(string fn);
 	
 };
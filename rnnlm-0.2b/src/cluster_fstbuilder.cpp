@@ -24,7 +24,7 @@
  * Create an FST based on an RNN
  */
 void ClusterFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
-	queue<ClusterFstHistory> q;
+	queue<FstIndex> q;
 	VectorFst<LogArc> new_fst;
 	
 	ClusterFstHistory fsth;
@@ -55,26 +55,26 @@ void ClusterFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
 	rnnlm.copyHiddenLayerToInput();
 
 	// Initial state ( 0 | hidden layer after </s>)
-	fsth.setFstHistory(rnnlm, *dzer);
+	setFstHistory(fsth, rnnlm);
 //	printNeurons(rnnlm.getHiddenLayer(),0,2);
 	fsth.setLastWord(0);
-	q.push(fsth);
-	addFstState(id, new ClusterFstHistory(fsth), fst);
+	addFstState(id, fsth, fst);
+	q.push(id);
 	fst.SetStart(INIT_STATE);
  	/*posterior.at(INIT_STATE) = MY_LOG_ONE;*/
 
 	// Final state (don't care about the associated discrete representation)
-	fst.AddState();
+	addFstFinalState(fsth, fst);
 	fst.SetFinal(FINAL_STATE, LogWeight::One());
 
 	
 	
 	//foreach state in the queue
 	while (!q.empty()) {
-		fsth = q.front();
+		id = q.front();
 		q.pop();
-		id = h2state[&fsth];
-		state2h.push_back(new ClusterFstHistory(fsth));
+		fsth = getFstHistory(id);
+		state2h.push_back(&getFstHistory(id));
 		if (id == FINAL_STATE) { continue; }
 		
 		
@@ -118,7 +118,7 @@ void ClusterFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
 
 
 		//Set a part of the new FST history
-		new_fsth.setFstHistory(rnnlm,*dzer);
+		setFstHistory(new_fsth, rnnlm);
 //		printNeurons(rnnlm.getHiddenLayer(),0,2);
 	
 		vector<real>::iterator it_p = to_be_added_prob.begin();
@@ -137,8 +137,8 @@ void ClusterFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
 	
 				//if sw not in the memory
 				//then add a new state for sw in the FST and push sw in the queue
-				if (addFstState(new_id, new ClusterFstHistory(new_fsth), fst)) {
-					q.push(new_fsth);
+				if (addFstState(new_id, new_fsth, fst)) {
+					q.push(new_id);
 				}
 				else { /* already exists */ }
 			
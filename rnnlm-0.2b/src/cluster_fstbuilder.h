@@ -14,15 +14,16 @@
 #define _CLUSTER_FSTBUILDER_H_
 
 #include "cluster_discretizer.h"
-#include "abstract_fstbuilder.h"
+#include "cluster_fsthistory.h"
+#include "typed_fstbuilder.h"
 
 typedef std::pair<real, std::pair<int,int> > dist_dim_val_triple;
 
-class ClusterFstBuilder : public FstBuilder {
+class ClusterFstBuilder : public TypedFstBuilder<ClusterFstHistory, ClusterDiscretizer> {
 	
 	public:
 	
-	ClusterFstBuilder(ClusterDiscretizer *d) : FstBuilder(d) {}
+	ClusterFstBuilder(ClusterDiscretizer *d) : TypedFstBuilder<ClusterFstHistory, ClusterDiscretizer>(d) {}
 	void convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst);
 };
 
@@ -13,17 +13,12 @@
  
 bool ClusterFstHistory::lower(const FstHistory *fsth) const {
 	const ClusterFstHistory *p = dynamic_cast<const ClusterFstHistory *>(fsth);
-	if (getLastWord() != fsth->getLastWord()) {
-		return (p != NULL) && getLastWord() < p->getLastWord();
-	}
-	else {
-		return (p != NULL) && getDiscretized() < p->getDiscretized();
-	}
+	return (p != NULL) && lower(*p);
 }
 
 bool ClusterFstHistory::sameDiscretization(const FstHistory *fsth) const {
 	const ClusterFstHistory *p = dynamic_cast<const ClusterFstHistory *>(fsth);
-	return (p != NULL) &&  getDiscretized() == p->getDiscretized();
+	return (p != NULL) && sameDiscretization(*p);
 }
 
 
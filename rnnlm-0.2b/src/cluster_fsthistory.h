@@ -15,7 +15,7 @@
  
 #include "abstract_fsthistory.h"
  
-typedef short cluster_id;
+typedef int cluster_id;
  
 class ClusterFstHistory : public FstHistory 
 {
@@ -38,6 +38,23 @@ class ClusterFstHistory : public FstHistory
 	cluster_id getDiscretized() const { return discretized; }
 	void setDiscretized(cluster_id d) { discretized = d; }
 	
+	// Comparisons with a history of the same type
+	bool lower(const ClusterFstHistory &other) const 
+	{
+		if (getLastWord() != other.getLastWord()) 
+		{
+			return getLastWord() < other.getLastWord();
+		}
+		return getDiscretized() < other.getDiscretized();
+	}
+	bool sameDiscretization(const ClusterFstHistory &other) const { return getDiscretized() == other.getDiscretized(); }
+	//key such that two histories have the same key iff neither is lower than the other
+	void packKey(vector<uint64_t> &key) const 
+	{
+		key.resize(1);
+		key[0] = ((uint64_t) (uint32_t) getLastWord() << 32) | (uint32_t) getDiscretized();
+	}
+	
 	// Interface methods
 	virtual bool lower(const FstHistory *other) const;
 	virtual bool sameDiscretization(const FstHistory *fsth) const;
@@ -0,0 +1,135 @@
+/************************************************************************
+ * Binary k-means file, read through a memory mapping.
+ *
+ ***********************************************************************/
+
+#include "cluster_map.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+#define HEADER_INTS 4	//n_levels, n_dims, stride, sizeof(real)
+
+static size_t alignUp(size_t n)
+{
+	return (n+CLUSTER_MAP_ALIGN-1) & ~((size_t) CLUSTER_MAP_ALIGN-1);
+}
+
+ClusterMap::ClusterMap()
+{
+	base = NULL;
+	size = 0;
+	n_levels = 0;
+	n_dims = 0;
+	stride = 0;
+}
+
+ClusterMap::~ClusterMap()
+{
+	close();
+}
+
+bool ClusterMap::isBinary(string fn)
+{
+	char magic[8];
+	FILE *f = fopen(fn.c_str(), "rb");
+	if (f == NULL)
+	{
+		return false;
+	}
+	bool res = (fread(magic, 1, 8, f) == 8) && (memcmp(magic, CLUSTER_MAP_MAGIC, 8) == 0);
+	fclose(f);
+	return res;
+}
+
+size_t ClusterMap::layout(const vector<int> &sizes, int stride, vector<size_t> &offs)
+{
+	size_t pos = alignUp(8+(HEADER_INTS+sizes.size())*sizeof(int32_t));
+	offs.clear();
+	for (size_t lvl = 0; lvl < sizes.size(); lvl++)
+	{
+		offs.push_back(pos);
+		pos += (size_t) sizes[lvl]*(stride+1)*sizeof(real)+(size_t) sizes[lvl]*sizeof(int32_t);
+		pos = alignUp(pos);
+	}
+	return pos;
+}
+
+bool ClusterMap::open(string fn)
+{
+	close();
+	int fd = ::open(fn.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat st;
+	if ((fstat(fd, &st) != 0) || ((size_t) st.st_size < 8+HEADER_INTS*sizeof(int32_t)))
+	{
+		::close(fd);
+		return false;
+	}
+	size = st.st_size;
+	//private writable mapping: pages are only copied if a mean is modified
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED)
+	{
+		size = 0;
+		return false;
+	}
+	base = (char *) p;
+
+	const int32_t *h = (const int32_t *) (base+8);
+	if ((memcmp(base, CLUSTER_MAP_MAGIC, 8) != 0) || (h[3] != (int32_t) sizeof(real)))
+	{
+		fprintf(stderr, "ERROR: %s is not a binary k-means file of %i-byte reals\n", fn.c_str(), (int) sizeof(real));
+		close();
+		return false;
+	}
+	n_levels = h[0];
+	n_dims = h[1];
+	stride = h[2];
+	if ((n_levels < 0) || (n_dims <= 0) || (stride < n_dims)
+	    || (8+(HEADER_INTS+(size_t) n_levels)*sizeof(int32_t) > size))
+	{
+		fprintf(stderr, "ERROR: corrupted header in %s\n", fn.c_str());
+		close();
+		return false;
+	}
+	n_clusters.assign(h+HEADER_INTS, h+HEADER_INTS+n_levels);
+	for (int lvl = 0; lvl < n_levels; lvl++)
+	{
+		if (n_clusters[lvl] < 0)
+		{
+			fprintf(stderr, "ERROR: corrupted header in %s\n", fn.c_str());
+			close();
+			return false;
+		}
+	}
+	if (layout(n_clusters, stride, offsets) > size)
+	{
+		fprintf(stderr, "ERROR: %s is truncated\n", fn.c_str());
+		close();
+		return false;
+	}
+	return true;
+}
+
+void ClusterMap::close()
+{
+	if (base != NULL)
+	{
+		munmap(base, size);
+	}
+	base = NULL;
+	size = 0;
+	n_levels = 0;
+	n_clusters.clear();
+	offsets.clear();
+}
@@ -0,0 +1,67 @@
+/************************************************************************
+ * Binary k-means file, read through a memory mapping so that the means
+ * of large sets of clusters are neither parsed nor copied at load time.
+ *
+ * Format (native byte order, as written by convert-kmeans):
+ * header: "RNNKMB01", n_levels, n_dims, stride, sizeof(real) (int32),
+ *         then the number of clusters of each level (int32)
+ * then, for each level, starting on a 64-byte boundary:
+ *   means	n_clusters x stride reals, zero padded rows
+ *   priors	n_clusters reals (-log P(cluster))
+ *   parents	n_clusters int32 (cluster of the previous level, -1 if unknown)
+ *
+ * Word priors of the text format are not stored.
+ *
+ ***********************************************************************/
+
+#ifndef _CLUSTER_MAP_H_
+#define _CLUSTER_MAP_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "utils.h"
+
+using namespace std;
+
+#define CLUSTER_MAP_MAGIC "RNNKMB01"
+#define CLUSTER_MAP_ALIGN 64
+
+class ClusterMap
+{
+
+	protected:
+	char *base;	//mapped file (NULL if not open)
+	size_t size;
+	int n_levels;
+	int n_dims;
+	int stride;
+	vector<int> n_clusters;
+	vector<size_t> offsets;	//offset of the means of each level
+
+	public:
+
+	ClusterMap();
+	~ClusterMap();
+
+	//true if fn starts with the magic string of the binary format
+	static bool isBinary(string fn);
+	//offsets of the levels of a file with the given sizes, returns the file size
+	static size_t layout(const vector<int> &sizes, int stride, vector<size_t> &offs);
+
+	bool open(string fn);
+	void close();
+
+	int getNumLevels() const { return n_levels; }
+	int getNumDims() const { return n_dims; }
+	int getStride() const { return stride; }
+	int getLevelSize(int lvl) const { return n_clusters[lvl]; }
+	//means are mapped copy-on-write: they can be modified, not written back
+	real *getMeans(int lvl) const { return (real *) (base+offsets[lvl]); }
+	const real *getPriors(int lvl) const { return getMeans(lvl)+(size_t) n_clusters[lvl]*stride; }
+	const int32_t *getParents(int lvl) const { return (const int32_t *) (getPriors(lvl)+n_clusters[lvl]); }
+
+};
+
+#endif
@@ -292,6 +292,7 @@ int main(int argc, char **argv)
     srand(1);
 	rnnlm.setRnnLMFile(rnnlm_file);
 	rnnlm.setDebugMode(debug_mode);
+	rnnlm.setInferenceOnly(1);
 	rnnlm.restoreNet();
 	
 	
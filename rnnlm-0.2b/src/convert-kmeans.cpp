@@ -0,0 +1,92 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Convert a k-means file (as written by build-cluster-hierarchy.pl) to
+// the binary format of cluster_map.h, which rnn2fst, rnnlm and
+// trace-hidden-layer map in memory instead of parsing it. Word priors
+// are dropped; clusters without a "#parent" are attached to the closest
+// mean of the previous level.
+//
+///////////////////////////////////////////////////////////////////////
+
+#include "rnnlmlib.h"
+#include "hierarchical_cluster_discretizer.h"
+#include <string>
+#include <sstream>
+
+using namespace std;
+
+int argPos(char *str, int argc, char **argv)
+{
+    int a;
+
+    for (a=1; a<argc; a++) if (!strcmp(str, argv[a])) return a;
+
+    return -1;
+}
+
+//number of values of the first mean of a k-means file
+int readNumDims(string fn)
+{
+	fstream in (fn.c_str());
+	string line, word;
+	while (getline(in, line))
+	{
+		istringstream strstr(line);
+		int n = 0;
+		if (!(strstr >> word) || (word[0] == '#') || (word[0] == '-')) { continue; }
+		while ((strstr >> word) && (word[0] != '#')) { n++; }
+		if (n > 0) { return n; }
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    int n_dims = 0;
+    string disc_map_file;
+    string out_file;
+
+    if (argc==1)
+    {
+    	fprintf(stderr,"Converts a k-means file to the binary format\n\n");
+    	fprintf(stderr,"Syntax:\n\tconvert-kmeans -discretize <kmeans_file> -binary <output_file> [-dims <N>]\n\n");
+    	fprintf(stderr,"\t-dims is the size of the hidden layer (default: number of values of the first mean)\n");
+    	return 0;
+    }
+
+    i=argPos((char *)"-discretize", argc, argv);
+    if ((i>0) && (i+1<argc)) disc_map_file = argv[i+1];
+    i=argPos((char *)"-binary", argc, argv);
+    if ((i>0) && (i+1<argc)) out_file = argv[i+1];
+    i=argPos((char *)"-dims", argc, argv);
+    if ((i>0) && (i+1<argc)) n_dims = atoi(argv[i+1]);
+
+    if (disc_map_file.empty() || out_file.empty())
+    {
+    	fprintf(stderr,"ERROR: both -discretize and -binary have to be specified!\n");
+    	return 1;
+    }
+
+    if (n_dims <= 0) n_dims = readNumDims(disc_map_file);
+    if (n_dims <= 0)
+    {
+    	fprintf(stderr,"ERROR: no mean found in %s\n", disc_map_file.c_str());
+    	return 1;
+    }
+
+    HierarchicalClusterDiscretizer dzer(n_dims);
+    if (!dzer.load(disc_map_file) || (dzer.getNumLevels() == 0))
+    {
+    	fprintf(stderr,"ERROR: cannot read %s\n", disc_map_file.c_str());
+    	return 1;
+    }
+    if (!dzer.save(out_file))
+    {
+    	fprintf(stderr,"ERROR: cannot write %s\n", out_file.c_str());
+    	return 1;
+    }
+    fprintf(stderr, "%i levels of %i dims written to %s\n", dzer.getNumLevels(), n_dims, out_file.c_str());
+
+    return 0;
+}
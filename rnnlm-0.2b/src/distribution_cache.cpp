@@ -0,0 +1,109 @@
+/************************************************************************
+ * Cache of the conditional distributions of the backoff histories.
+ *
+ ***********************************************************************/
+
+#include "distribution_cache.h"
+#include "fst_state_table.h"
+
+using namespace std;
+
+//estimated memory of the list and index nodes of an entry
+#define DIST_CACHE_ENTRY_OVERHEAD 128
+
+size_t DistributionCache::KeyHash::operator() (const vector<uint64_t> &key) const
+{
+	return (size_t) FstStateTable::hashKey(key);
+}
+
+DistributionCache::DistributionCache()
+{
+	capacity = 0;
+	dim = 0;
+	clear();
+}
+
+void DistributionCache::setSize(size_t max_bytes, int d)
+{
+	clear();
+	dim = d;
+	capacity = (d > 0) ? max_bytes/(d*sizeof(cached_real)+DIST_CACHE_ENTRY_OVERHEAD) : 0;
+}
+
+bool DistributionCache::get(const vector<uint64_t> &key, vector<real> &dist)
+{
+	lock_guard<mutex> guard(lock);
+	auto it = index.find(key);
+	if (it == index.end())
+	{
+		n_misses++;
+		return false;
+	}
+	n_hits++;
+	entries.splice(entries.begin(), entries, it->second);
+	const vector<cached_real> &cached = it->second->dist;
+	dist.resize(dim);
+	for (int i = 0; i < dim; i++)
+	{
+		dist[i] = cached[i];
+	}
+	return true;
+}
+
+void DistributionCache::put(const vector<uint64_t> &key, vector<real> &dist)
+{
+	if (capacity == 0)
+	{
+		return;
+	}
+	for (int i = 0; i < dim; i++)
+	{
+		dist[i] = (cached_real) dist[i];
+	}
+
+	lock_guard<mutex> guard(lock);
+	//another thread may have added it meanwhile
+	if (index.find(key) != index.end())
+	{
+		return;
+	}
+	if (entries.size() >= capacity)
+	{
+		//reuse the storage of the least recently used entry
+		index.erase(entries.back().key);
+		entries.splice(entries.begin(), entries, --entries.end());
+		n_evicted++;
+	}
+	else
+	{
+		entries.push_front(Entry());
+		entries.front().dist.resize(dim);
+	}
+	Entry &e = entries.front();
+	e.key = key;
+	for (int i = 0; i < dim; i++)
+	{
+		e.dist[i] = (cached_real) dist[i];
+	}
+	index[key] = entries.begin();
+}
+
+void DistributionCache::clear()
+{
+	entries.clear();
+	index.clear();
+	n_hits = 0;
+	n_misses = 0;
+	n_evicted = 0;
+}
+
+void DistributionCache::printStats(FILE *f) const
+{
+	if (capacity == 0)
+	{
+		return;
+	}
+	long n = n_hits+n_misses;
+	fprintf(f, "Distribution cache: %li lookups, %li hits (%.1f %%), %li evicted, %li kept (max %li)\n",
+	        n, n_hits, (n > 0) ? 100.0*n_hits/n : 0.0, n_evicted, (long) entries.size(), (long) capacity);
+}
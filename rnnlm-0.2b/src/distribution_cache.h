@@ -0,0 +1,85 @@
+/************************************************************************
+ * Cache of the conditional distributions (-log P(w|h) for every word) of
+ * the backoff histories, keyed by their packed key (see packKey() in the
+ * history classes). Backoff histories are coarse and shared by many
+ * states, so that their distribution would otherwise be recomputed for
+ * each of them.
+ *
+ * The cache holds at most a given number of bytes and evicts the least
+ * recently used distribution. With DIST_CACHE_FLOAT, distributions are
+ * stored in float (twice as many fit in the same memory); they are then
+ * rounded by put() so that hits and misses give the same values.
+ *
+ * get() and put() may be called concurrently.
+ *
+ ***********************************************************************/
+
+#ifndef _DISTRIBUTION_CACHE_H_
+#define _DISTRIBUTION_CACHE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "rnnlmlib.h"
+
+using namespace std;
+
+#ifdef DIST_CACHE_FLOAT
+typedef float cached_real;
+#else
+typedef real cached_real;
+#endif
+
+//default size of the cache (-dist-cache of rnn2fst, in MB)
+#define DEFAULT_DIST_CACHE_MB 256
+
+class DistributionCache
+{
+
+	protected:
+
+	struct KeyHash {
+		size_t operator() (const vector<uint64_t> &key) const;
+	};
+
+	struct Entry {
+		vector<uint64_t> key;
+		vector<cached_real> dist;
+	};
+
+	list<Entry> entries;	//most recently used first
+	unordered_map<vector<uint64_t>, list<Entry>::iterator, KeyHash> index;
+	size_t capacity;	//maximum number of distributions
+	int dim;	//size of the distributions
+
+	mutex lock;
+	long n_hits;
+	long n_misses;
+	long n_evicted;
+
+	public:
+
+	DistributionCache();
+
+	//keeps at most max_bytes of distributions of size d (0: disabled)
+	void setSize(size_t max_bytes, int d);
+
+	bool enabled() const { return capacity > 0; }
+
+	//copies the distribution of key into dist if it is cached
+	bool get(const vector<uint64_t> &key, vector<real> &dist);
+
+	//adds the distribution of key (rounded in place to the stored precision)
+	void put(const vector<uint64_t> &key, vector<real> &dist);
+
+	void clear();
+
+	//hits, misses and evictions since the last clear() (nothing if disabled)
+	void printStats(FILE *f) const;
+
+};
+
+#endif
@@ -229,7 +229,7 @@ NeuronFstHistory FlatBOFstBuilder::getBackoff(CRnnLM &rnnlm,
  * Create an FST based on an RNN
  */
 void FlatBOFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
-	queue<NeuronFstHistory> q;
+	queue<FstIndex> q;
 	VectorFst<LogArc> new_fst;
 	
 	NeuronFstHistory fsth(rnnlm.getHiddenLayerSize(),getNumBins());
@@ -280,14 +280,14 @@ void FlatBOFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
 
 	// Initial state ( 0 | hidden layer after </s>)
 	printNeurons(rnnlm.getHiddenLayer(),0,10);
-	fsth.setFstHistory(rnnlm, *dzer);
+	setFstHistory(fsth, rnnlm);
 	fsth.setLastWord(0);
-	q.push(fsth);
-	addFstState(id, new NeuronFstHistory(fsth), fst);
+	addFstState(id, fsth, fst);
+	q.push(id);
 	fst.SetStart(INIT_STATE);
 	
 	// Final state (don't care about the associated discrete representation)
-	fst.AddState();
+	addFstFinalState(fsth, fst);
 	fst.SetFinal(FINAL_STATE, LogWeight::One());
 	
  	/*posterior.at(INIT_STATE) = MY_LOG_ONE;*/
@@ -325,10 +325,10 @@ void FlatBOFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
 	
 	//foreach state in the queue
 	while (!q.empty()) {
-		fsth = q.front();
+		id = q.front();
 		q.pop();
-		id = h2state[&fsth];
-		state2h.push_back(new NeuronFstHistory(fsth));
+		fsth = getFstHistory(id);
+		state2h.push_back(&getFstHistory(id));
 		if (id == FINAL_STATE) { continue; }
 
 
@@ -390,7 +390,7 @@ void FlatBOFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
 
 
 		//Set a part of the new FST history
-		new_fsth.setFstHistory(rnnlm, *dzer);
+		setFstHistory(new_fsth, rnnlm);
 
 		//if at least one word is backing off
 		if (backoff) {
@@ -401,8 +401,8 @@ void FlatBOFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
 			}
 			
 			
-			if (addFstState(new_id, new NeuronFstHistory(bo_fsth), fst)) {
-				q.push(bo_fsth);
+			if (addFstState(new_id, bo_fsth, fst)) {
+				q.push(new_id);
 				try { non_bo_pred.at(new_id) = false; }
 				catch (exception e) {
 					non_bo_pred.resize(new_id+(int) (non_bo_pred.size()*0.5)+1);
@@ -435,8 +435,8 @@ void FlatBOFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
 	
 				//if sw not in the memory
 				//then add a new state for sw in the FST and push sw in the queue
-				if (addFstState(new_id, new NeuronFstHistory(new_fsth), fst)) {
-					q.push(new_fsth);
+				if (addFstState(new_id, new_fsth, fst)) {
+					q.push(new_id);
 					try { non_bo_pred.at(new_id) = true; }
 					catch (exception e) {
 						non_bo_pred.resize(new_id+(int) (non_bo_pred.size()*0.5)+1);
@@ -0,0 +1,339 @@
+/************************************************************************
+ * Sharded conversion: shard files, routing of the keys between the
+ * shards and merge.
+ *
+ ***********************************************************************/
+
+#include "fst_shards.h"
+#include "fst_state_table.h"
+#include "backoff_fstbuilder.h"
+#include <string.h>
+#include <sstream>
+#include <thread>
+#include <functional>
+
+using namespace std;
+
+FstShard::FstShard()
+{
+	shard = 0;
+	n_shards = 1;
+	initial = -1;
+	key_start.assign(1, 0);
+	arc_start.assign(1, 0);
+	remote_start.assign(1, 0);
+}
+
+void FstShard::addKey(vector<uint64_t> &to, vector<int64_t> &start, const vector<uint64_t> &key)
+{
+	to.insert(to.end(), key.begin(), key.end());
+	start.push_back((int64_t) to.size());
+}
+
+//arrays are written as their size followed by their elements
+template <class T>
+static bool writeArray(FILE *f, const vector<T> &v)
+{
+	int64_t n = (int64_t) v.size();
+	return (fwrite(&n, sizeof(int64_t), 1, f) == 1) && ((n == 0) || (fwrite(&v[0], sizeof(T), n, f) == (size_t) n));
+}
+
+template <class T>
+static bool readArray(FILE *f, vector<T> &v)
+{
+	int64_t n;
+	if ((fread(&n, sizeof(int64_t), 1, f) != 1) || (n < 0)) {
+		return false;
+	}
+	v.resize(n);
+	return (n == 0) || (fread(&v[0], sizeof(T), n, f) == (size_t) n);
+}
+
+bool FstShard::save(string fn) const
+{
+	FILE *f = fopen(fn.c_str(), "wb");
+	if (f == NULL) {
+		return false;
+	}
+	int32_t header[3] = { shard, n_shards, (int32_t) vocab.size() };
+	bool ok = (fwrite(FST_SHARD_MAGIC, 1, 8, f) == 8) && (fwrite(header, sizeof(int32_t), 3, f) == 3)
+	       && (fwrite(&initial, sizeof(int64_t), 1, f) == 1);
+	for (size_t i = 0; ok && (i < vocab.size()); i++) {
+		int32_t len = (int32_t) vocab[i].size();
+		ok = (fwrite(&len, sizeof(int32_t), 1, f) == 1) && (fwrite(vocab[i].c_str(), 1, len, f) == (size_t) len);
+	}
+	ok = ok && writeArray(f, key_start) && writeArray(f, keys)
+	        && writeArray(f, arc_start) && writeArray(f, arcs)
+	        && writeArray(f, remote_start) && writeArray(f, remote_keys);
+	if (fclose(f) != 0) {
+		ok = false;
+	}
+	return ok;
+}
+
+bool FstShard::load(string fn)
+{
+	FILE *f = fopen(fn.c_str(), "rb");
+	if (f == NULL) {
+		fprintf(stderr, "ERROR: cannot open %s\n", fn.c_str());
+		return false;
+	}
+	char magic[8];
+	int32_t header[3];
+	bool ok = (fread(magic, 1, 8, f) == 8) && (memcmp(magic, FST_SHARD_MAGIC, 8) == 0)
+	       && (fread(header, sizeof(int32_t), 3, f) == 3) && (fread(&initial, sizeof(int64_t), 1, f) == 1);
+	if (ok) {
+		shard = header[0];
+		n_shards = header[1];
+		vocab.resize(header[2]);
+	}
+	for (size_t i = 0; ok && (i < vocab.size()); i++) {
+		int32_t len;
+		ok = (fread(&len, sizeof(int32_t), 1, f) == 1) && (len >= 0);
+		if (ok) {
+			vector<char> w(len+1, 0);
+			ok = (fread(&w[0], 1, len, f) == (size_t) len);
+			vocab[i] = string(&w[0]);
+		}
+	}
+	ok = ok && readArray(f, key_start) && readArray(f, keys)
+	        && readArray(f, arc_start) && readArray(f, arcs)
+	        && readArray(f, remote_start) && readArray(f, remote_keys)
+	        && (key_start.size() == arc_start.size()) && !remote_start.empty();
+	fclose(f);
+	if (!ok) {
+		fprintf(stderr, "ERROR: %s is not a valid shard file\n", fn.c_str());
+	}
+	return ok;
+}
+
+int getShardOf(const vector<uint64_t> &key, int n_shards)
+{
+	//the low bits of the hash index the slots of the tables of the shards
+	uint64_t h = FstStateTable::hashKey(key)*0x9e3779b97f4a7c15ULL;
+	return (int) ((h >> 33) % (uint64_t) n_shards);
+}
+
+string getShardFileName(string fst_file, int i)
+{
+	ostringstream fn;
+	fn << fst_file << ".shard" << i;
+	return fn.str();
+}
+
+void writeShardKey(FILE *f, const uint64_t *key, int len)
+{
+	int32_t n = len;
+	if ((fwrite(&n, sizeof(int32_t), 1, f) != 1) || (fwrite(key, sizeof(uint64_t), len, f) != (size_t) len)) {
+		fprintf(stderr, "ERROR: cannot write to a shard pipe\n");
+		exit(1);
+	}
+}
+
+bool readShardKey(FILE *f, vector<uint64_t> &key)
+{
+	int32_t n;
+	if ((fread(&n, sizeof(int32_t), 1, f) != 1) || (n <= 0)) {
+		return false;
+	}
+	key.resize(n);
+	return fread(&key[0], sizeof(uint64_t), n, f) == (size_t) n;
+}
+
+//keys sent by one shard during a round, for each destination shard
+//(each key preceded by its length), and their number
+struct ShardOutbox {
+	vector< vector<uint64_t> > keys;
+	vector<int64_t> n_keys;
+};
+
+//reads the keys sent by shard i until the end of its round
+static void readShardRound(FILE *from, int i, ShardOutbox &out)
+{
+	int n = (int) out.keys.size();
+	vector<uint64_t> key;
+	int32_t dest;
+	while (true) {
+		if (fread(&dest, sizeof(int32_t), 1, from) != 1) {
+			fprintf(stderr, "ERROR: shard %i has stopped\n", i);
+			exit(1);
+		}
+		if (dest == -1) {
+			break;
+		}
+		if ((dest < 0) || (dest >= n) || !readShardKey(from, key)) {
+			fprintf(stderr, "ERROR: invalid message from shard %i\n", i);
+			exit(1);
+		}
+		out.keys[dest].push_back(key.size());
+		out.keys[dest].insert(out.keys[dest].end(), key.begin(), key.end());
+		out.n_keys[dest]++;
+	}
+}
+
+void coordinateShards(vector<FILE*> &to_shard, vector<FILE*> &from_shard)
+{
+	int n = (int) to_shard.size();
+	vector< vector<uint64_t> > inbox(n);	//keys for each shard, each one preceded by its length
+	vector<int64_t> n_keys(n, 0);
+	vector<ShardOutbox> outbox(n);	//keys sent by each shard during the round
+	int64_t routed = 0;
+	int round = 0;
+
+	do {
+		//the pipes of all the shards are drained at once (one reader per shard),
+		//so that a shard never waits for the coordinator to read another one
+		vector<thread> readers;
+		for (int i = 0; i < n; i++) {
+			outbox[i].keys.assign(n, vector<uint64_t>());
+			outbox[i].n_keys.assign(n, 0);
+			readers.push_back(thread(readShardRound, from_shard[i], i, ref(outbox[i])));
+		}
+		for (int i = 0; i < n; i++) {
+			fwrite(&n_keys[i], sizeof(int64_t), 1, to_shard[i]);
+			for (size_t k = 0; k < inbox[i].size(); k += 1+inbox[i][k]) {
+				writeShardKey(to_shard[i], &inbox[i][k+1], (int) inbox[i][k]);
+			}
+			fflush(to_shard[i]);
+			inbox[i].clear();
+			n_keys[i] = 0;
+		}
+		for (int i = 0; i < n; i++) {
+			readers[i].join();
+		}
+
+		//keys of the next round, in the order of the sending shards
+		routed = 0;
+		for (int i = 0; i < n; i++) {
+			for (int dest = 0; dest < n; dest++) {
+				inbox[dest].insert(inbox[dest].end(), outbox[i].keys[dest].begin(), outbox[i].keys[dest].end());
+				n_keys[dest] += outbox[i].n_keys[dest];
+				routed += outbox[i].n_keys[dest];
+			}
+		}
+		round++;
+		fprintf(stderr, "\rRound %i: %li states sent to other shards", round, (long) routed);
+	} while (routed > 0);
+	fprintf(stderr, "\n");
+
+	int64_t end = -1;
+	for (int i = 0; i < n; i++) {
+		fwrite(&end, sizeof(int64_t), 1, to_shard[i]);
+		fflush(to_shard[i]);
+	}
+}
+
+//equality of a key with the key of a state of a shard
+struct ShardKeyCmp {
+	const FstShard *shard;
+	const vector<uint64_t> *key;
+	bool operator() (int id) const {
+		int64_t len = shard->key_start[id+1]-shard->key_start[id];
+		return (len == (int64_t) key->size())
+		    && (memcmp(&shard->keys[shard->key_start[id]], &(*key)[0], len*sizeof(uint64_t)) == 0);
+	}
+};
+
+bool mergeFstShards(string fst_file, int n_shards, VectorFst<LogArc> &fst, int n_threads)
+{
+	vector<FstShard> shards(n_shards);
+	vector<uint64_t> key;
+	int init_shard = -1;
+
+	for (int s = 0; s < n_shards; s++) {
+		if (!shards[s].load(getShardFileName(fst_file, s))) {
+			return false;
+		}
+		if ((shards[s].shard != s) || (shards[s].n_shards != n_shards)) {
+			fprintf(stderr, "ERROR: %s is not shard %i of %i\n", getShardFileName(fst_file, s).c_str(), s, n_shards);
+			return false;
+		}
+		if (shards[s].initial >= 0) {
+			init_shard = s;
+		}
+	}
+	if (init_shard == -1) {
+		fprintf(stderr, "ERROR: no shard has the initial state\n");
+		return false;
+	}
+
+	//owner and local id of the remote keys of each shard
+	vector< vector< pair<int,int64_t> > > remote(n_shards);
+	{
+		vector<FstStateTable> index(n_shards);
+		for (int s = 0; s < n_shards; s++) {
+			for (int64_t id = 0; id < shards[s].numStates(); id++) {
+				key.assign(shards[s].keys.begin()+shards[s].key_start[id], shards[s].keys.begin()+shards[s].key_start[id+1]);
+				index[s].insert(FstStateTable::hashKey(key), (int) id);
+			}
+		}
+		for (int s = 0; s < n_shards; s++) {
+			remote[s].resize(shards[s].numRemote());
+			for (int64_t r = 0; r < shards[s].numRemote(); r++) {
+				key.assign(shards[s].remote_keys.begin()+shards[s].remote_start[r], shards[s].remote_keys.begin()+shards[s].remote_start[r+1]);
+				int owner = getShardOf(key, n_shards);
+				ShardKeyCmp same = { &shards[owner], &key };
+				int id = index[owner].find(FstStateTable::hashKey(key), same);
+				if (id == -1) {
+					fprintf(stderr, "ERROR: a state of shard %i is missing in shard %i\n", s, owner);
+					return false;
+				}
+				remote[s][r] = make_pair(owner, (int64_t) id);
+			}
+		}
+	}
+
+	//states are numbered as by a single process: initial and final states,
+	//then the targets of the arcs of each state in the order of the arcs
+	vector< vector<int64_t> > gid(n_shards);
+	for (int s = 0; s < n_shards; s++) {
+		gid[s].assign(shards[s].numStates(), -1);
+	}
+	vector< pair<int,int64_t> > order;
+	map< FstIndex,set<FstIndex> > pred;
+
+	order.push_back(make_pair(init_shard, shards[init_shard].initial));
+	gid[init_shard][shards[init_shard].initial] = INIT_STATE;
+	fst.AddState();
+	fst.SetStart(INIT_STATE);
+	order.push_back(make_pair(-1, (int64_t) -1));
+	fst.AddState();
+	fst.SetFinal(FINAL_STATE, LogWeight::One());
+
+	for (size_t g = 0; g < order.size(); g++) {
+		if (g == FINAL_STATE) { continue; }
+		const FstShard &sh = shards[order[g].first];
+		int64_t id = order[g].second;
+		for (int64_t a = sh.arc_start[id]; a < sh.arc_start[id+1]; a++) {
+			const ShardArc &arc = sh.arcs[a];
+			FstIndex target = FINAL_STATE;
+			if (arc.target != SHARD_FINAL_TARGET) {
+				pair<int,int64_t> t = (arc.target >= 0) ? make_pair(order[g].first, arc.target) : remote[order[g].first][-2-arc.target];
+				if (gid[t.first][t.second] == -1) {
+					gid[t.first][t.second] = (int64_t) order.size();
+					order.push_back(t);
+					fst.AddState();
+				}
+				target = (FstIndex) gid[t.first][t.second];
+			}
+			fst.AddArc(g, LogArc(arc.label, arc.label, arc.weight, target));
+			if (arc.label == EPSILON) {
+				pred[target].insert(g);
+			}
+		}
+	}
+	printf("Merged %li states of %i shards\n", (long) order.size(), n_shards);
+
+	BackoffFstBuilder::computeAllBackoff(fst, pred, n_threads);
+
+	//Fill the table of symbols
+	SymbolTable dic("dictionnary");
+	dic.AddSymbol("*", 0);
+	for (size_t i=0; i<shards[0].vocab.size(); i++) {
+		dic.AddSymbol(shards[0].vocab[i], i+1);
+	}
+	fst.SetInputSymbols(&dic);
+	fst.SetOutputSymbols(&dic);
+
+	return true;
+}
@@ -0,0 +1,95 @@
+/************************************************************************
+ * Sharded conversion: the states are partitioned by a hash of the packed
+ * key of their history (see packKey() in the history classes), each
+ * shard being expanded by its own process (rnn2fst -shards). A shard
+ * only stores its states and their arcs; the arcs to the states of the
+ * other shards refer to the key of the target, which is sent to its
+ * owner through the coordinator (rnn2fst itself).
+ *
+ * The merge numbers the states in the order in which a single process
+ * adds them (breadth-first, following the arcs in their order), so that
+ * the merged FST is the same as the FST of an unsharded conversion, then
+ * computes the backoff weights.
+ *
+ * Messages on the pipes:
+ *   coordinator -> shard: int64 n (-1: end of the conversion), then n keys
+ *   shard -> coordinator: (int32 shard, key)*, then int32 -1
+ * where a key is an int32 length followed by the uint64 words.
+ *
+ ***********************************************************************/
+
+#ifndef _FST_SHARDS_H_
+#define _FST_SHARDS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fst/fstlib.h>
+
+using namespace std;
+using namespace fst;
+
+#define FST_SHARD_MAGIC "RNNSHD01"
+
+//target of an arc to the final state; target -2-r is the r-th remote key
+#define SHARD_FINAL_TARGET -1
+#define SHARD_REMOTE_TARGET(r) (-2-(int64_t) (r))
+
+struct ShardArc {
+	int32_t label;
+	float weight;
+	int64_t target;	//local state, SHARD_FINAL_TARGET or SHARD_REMOTE_TARGET(r)
+};
+
+class FstShard {
+
+	public:
+
+	int shard;
+	int n_shards;
+	int64_t initial;	//local id of the initial state, -1 if it belongs to another shard
+	vector<string> vocab;	//symbols of the words (ids 1..)
+
+	//packed history and arcs of each state, indexed by local id
+	vector<uint64_t> keys;
+	vector<int64_t> key_start;	//numStates()+1 offsets in keys
+	vector<ShardArc> arcs;
+	vector<int64_t> arc_start;	//numStates()+1 offsets in arcs
+
+	//keys of the targets owned by other shards
+	vector<uint64_t> remote_keys;
+	vector<int64_t> remote_start;	//numRemote()+1 offsets in remote_keys
+
+	FstShard();
+
+	int64_t numStates() const { return (int64_t) key_start.size()-1; }
+	int64_t numRemote() const { return (int64_t) remote_start.size()-1; }
+
+	void addKey(vector<uint64_t> &to, vector<int64_t> &start, const vector<uint64_t> &key);
+
+	bool save(string fn) const;
+	bool load(string fn);
+
+};
+
+//shard of a packed history
+int getShardOf(const vector<uint64_t> &key, int n_shards);
+
+//file of shard i of the conversion written to fst_file
+string getShardFileName(string fst_file, int i);
+
+//pipes
+void writeShardKey(FILE *f, const uint64_t *key, int len);
+bool readShardKey(FILE *f, vector<uint64_t> &key);
+
+//routes the keys sent by the shards to their owners until no key is sent
+//during a whole round (the pipes of all the shards being read at once),
+//then ends the conversion of every shard
+void coordinateShards(vector<FILE*> &to_shard, vector<FILE*> &from_shard);
+
+//merges the files of the n shards of fst_file into fst (backoff weights
+//included, computed with n_threads threads)
+bool mergeFstShards(string fst_file, int n_shards, VectorFst<LogArc> &fst, int n_threads = 1);
+
+#endif
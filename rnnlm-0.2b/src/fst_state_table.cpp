@@ -0,0 +1,77 @@
+/************************************************************************
+ * Hash index of FST histories.
+ *
+ ***********************************************************************/
+
+#include "fst_state_table.h"
+
+using namespace std;
+
+#define INITIAL_SLOTS 1024
+
+FstStateTable::FstStateTable()
+{
+	clear();
+}
+
+void FstStateTable::clear()
+{
+	entry_hash.clear();
+	entry_id.clear();
+	slots.assign(INITIAL_SLOTS, -1);
+	slot_hash.assign(INITIAL_SLOTS, 0);
+	mask = INITIAL_SLOTS-1;
+}
+
+uint64_t FstStateTable::hashKey(const vector<uint64_t> &key)
+{
+	uint64_t h = 0x9e3779b97f4a7c15ULL ^ key.size();
+	for (size_t i = 0; i < key.size(); i++)
+	{
+		//mixing function of MurmurHash3 (fmix64)
+		uint64_t x = key[i]+h;
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdULL;
+		x ^= x >> 33;
+		x *= 0xc4ceb9fe1a85ec53ULL;
+		x ^= x >> 33;
+		h = x;
+	}
+	return h;
+}
+
+void FstStateTable::grow()
+{
+	size_t n_slots = 2*(mask+1);
+	slots.assign(n_slots, -1);
+	slot_hash.assign(n_slots, 0);
+	mask = n_slots-1;
+	for (int e = 0; e < (int) entry_id.size(); e++)
+	{
+		size_t s = (size_t) entry_hash[e] & mask;
+		while (slots[s] != -1)
+		{
+			s = (s+1) & mask;
+		}
+		slots[s] = e;
+		slot_hash[s] = (uint32_t) (entry_hash[e] >> 32);
+	}
+}
+
+void FstStateTable::insert(uint64_t h, int id)
+{
+	int e = (int) entry_id.size();
+	entry_hash.push_back(h);
+	entry_id.push_back(id);
+	size_t s = (size_t) h & mask;
+	while (slots[s] != -1)
+	{
+		s = (s+1) & mask;
+	}
+	slots[s] = e;
+	slot_hash[s] = (uint32_t) (h >> 32);
+	if (2*entry_id.size() > mask+1)
+	{
+		grow();
+	}
+}
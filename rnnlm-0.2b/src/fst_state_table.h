@@ -0,0 +1,63 @@
+/************************************************************************
+ * Hash index of FST histories: from the hash of the packed key of a
+ * history (see packKey() in the history classes) to its state id.
+ *
+ * Open addressing with linear probing over a power-of-2 number of slots,
+ * at most half full. Only ids and hashes are stored: the histories are
+ * kept by the caller (see history_pool.h), which gives the equality test
+ * of a lookup.
+ *
+ ***********************************************************************/
+
+#ifndef _FST_STATE_TABLE_H_
+#define _FST_STATE_TABLE_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+class FstStateTable
+{
+
+	protected:
+	vector<uint64_t> entry_hash;	//hash of each entry
+	vector<int> entry_id;	//id of each entry
+	vector<int> slots;	//entry of each slot (-1: empty)
+	vector<uint32_t> slot_hash;	//high bits of the hash of the entry of each slot
+	size_t mask;	//number of slots - 1
+
+	void grow();
+
+	public:
+
+	FstStateTable();
+
+	static uint64_t hashKey(const vector<uint64_t> &key);
+
+	//id of hash h for which same(id) is true, -1 if there is none
+	template <class Same>
+	int find(uint64_t h, Same same) const
+	{
+		uint32_t tag = (uint32_t) (h >> 32);
+		for (size_t s = (size_t) h & mask; slots[s] != -1; s = (s+1) & mask)
+		{
+			int e = slots[s];
+			if ((slot_hash[s] == tag) && same(entry_id[e]))
+			{
+				return entry_id[e];
+			}
+		}
+		return -1;
+	}
+
+	//adds an id of hash h (which must not be in the table yet)
+	void insert(uint64_t h, int id);
+
+	size_t size() const { return entry_id.size(); }
+	void clear();
+
+};
+
+#endif
@@ -12,6 +12,7 @@
 #include "hierarchical_cluster_fsthistory.h"
 #include <iostream>
 #include <sstream>
+#include <alloca.h>
 
 #define mylog(x) -log(x)
 
@@ -21,21 +22,194 @@ HierarchicalClusterDiscretizer::HierarchicalClusterDiscretizer(int dims/* , int
 {
 	n_dims = dims;
 //	n_words = nw;
+	beam = 0;
+	mapping = NULL;
 }
 
 HierarchicalClusterDiscretizer::HierarchicalClusterDiscretizer(int dims/* , int nw*/, string fn) 
 {
 	n_dims = dims;
 //	n_words = nw;
+	beam = 0;
+	mapping = NULL;
 	load(fn);
 }
 
 
+//copies own their means, the mapping is not shared
 HierarchicalClusterDiscretizer::HierarchicalClusterDiscretizer(const HierarchicalClusterDiscretizer &dzer) 
 {
 	n_dims = dzer.n_dims;
 //	n_words = dzer.n_words;
 	levels = dzer.levels;
+	mapping = NULL;
+	beam = dzer.beam;
+	child_start = dzer.child_start;
+	child_list = dzer.child_list;
+}
+
+HierarchicalClusterDiscretizer::~HierarchicalClusterDiscretizer() 
+{
+	//levels point into the mapping
+	levels.clear();
+	delete mapping;
+}
+
+HierarchicalClusterDiscretizer& HierarchicalClusterDiscretizer::operator=(const HierarchicalClusterDiscretizer &dzer) 
+{
+	if (this != &dzer) 
+	{
+		levels = dzer.levels;
+		delete mapping;
+		mapping = NULL;
+		n_dims = dzer.n_dims;
+		beam = dzer.beam;
+		child_start = dzer.child_start;
+		child_list = dzer.child_list;
+	}
+	return *this;
+}
+
+
+
+/**
+ * Link each cluster to its children in the next level. Clusters without a
+ * (valid) "#parent" in the file are attached to the closest mean of the
+ * previous level.
+ */
+void HierarchicalClusterDiscretizer::buildTree() 
+{
+	child_start.clear();
+	child_list.clear();
+	for (int lvl = 1; lvl < getNumLevels(); lvl++) 
+	{
+		const ClusterDiscretizer &up = levels[lvl-1];
+		ClusterDiscretizer &cur = levels[lvl];
+		vector<int> start(up.getNumClusters()+1, 0);
+		vector<int> list(cur.getNumClusters());
+		for (int c = 0; c < cur.getNumClusters(); c++) 
+		{
+			int p = cur.getParent(c);
+			if ((p < 0) || (p >= up.getNumClusters())) 
+			{
+				p = up.nearest(cur.getMeans()+c*cur.getStride(), cur.getNorm(c));
+				cur.setParent(c, p);
+			}
+			start[p+1]++;
+		}
+		for (int p = 0; p < up.getNumClusters(); p++) 
+		{
+			start[p+1] += start[p];
+		}
+		vector<int> pos(start.begin(), start.end()-1);
+		for (int c = 0; c < cur.getNumClusters(); c++) 
+		{
+			list[pos[cur.getParent(c)]++] = c;
+		}
+		child_start.push_back(start);
+		child_list.push_back(list);
+	}
+}
+
+
+
+void HierarchicalClusterDiscretizer::setIndex(real eps, int max_checks, int min_clusters) 
+{
+	for (int lvl = 0; lvl < getNumLevels(); lvl++) 
+	{
+		if (levels[lvl].getNumClusters() >= min_clusters) 
+		{
+			levels[lvl].buildIndex(eps, max_checks);
+		}
+		else 
+		{
+			levels[lvl].dropIndex();
+		}
+	}
+}
+
+
+
+//inserts (d, c) in the sorted list of the n best candidates (at most size)
+static inline void insertCandidate(real * const dist, int * const ids, int &n, int size, real d, int c) 
+{
+	int i = (n < size) ? n++ : size-1;
+	while ((i > 0) && (dist[i-1] > d)) 
+	{
+		dist[i] = dist[i-1];
+		ids[i] = ids[i-1];
+		i--;
+	}
+	dist[i] = d;
+	ids[i] = c;
+}
+
+/**
+ * Tree descent: at each level, only the children of the beam best clusters
+ * of the previous level are compared to x. The ids of all levels are the
+ * path from the root to the best cluster of the last level.
+ */
+void HierarchicalClusterDiscretizer::descend(int * const ids, const real * const x, real xnorm) const 
+{
+	int n_levels = getNumLevels();
+	int b = (beam > 0) ? beam : 1;
+	real *cur_dist = (real *) alloca(2*b*sizeof(real));
+	int *cur_ids = (int *) alloca(2*b*sizeof(int));
+	real *next_dist = cur_dist+b;
+	int *next_ids = cur_ids+b;
+	int n_cur = 0;
+	int n_next = 0;
+	real d, lb, bound;
+	
+	//first level: all the clusters
+	const ClusterDiscretizer &top = levels[0];
+	for (int c = 0; c < top.getNumClusters(); c++) 
+	{
+		bound = (n_cur < b) ? 1e100 : cur_dist[b-1];
+		lb = xnorm-top.getNorm(c);
+		if (lb*lb >= bound) { continue; }
+		d = top.sqDistance(x, c, bound);
+		if (d < bound) { insertCandidate(cur_dist, cur_ids, n_cur, b, d, c); }
+	}
+	
+	for (int lvl = 1; lvl < n_levels; lvl++) 
+	{
+		const ClusterDiscretizer &cur = levels[lvl];
+		const vector<int> &start = child_start[lvl-1];
+		const vector<int> &list = child_list[lvl-1];
+		n_next = 0;
+		for (int i = 0; i < n_cur; i++) 
+		{
+			for (int j = start[cur_ids[i]]; j < start[cur_ids[i]+1]; j++) 
+			{
+				int c = list[j];
+				bound = (n_next < b) ? 1e100 : next_dist[b-1];
+				lb = xnorm-cur.getNorm(c);
+				if (lb*lb >= bound) { continue; }
+				d = cur.sqDistance(x, c, bound);
+				if (d < bound) { insertCandidate(next_dist, next_ids, n_next, b, d, c); }
+			}
+		}
+		if (n_next == 0) 
+		{
+			//all the kept clusters are leaves: fall back to a flat search
+			next_ids[0] = cur.nearest(x, xnorm, &next_dist[0]);
+			n_next = 1;
+		}
+		for (int i = 0; i < n_next; i++) 
+		{
+			cur_dist[i] = next_dist[i];
+			cur_ids[i] = next_ids[i];
+		}
+		n_cur = n_next;
+	}
+	
+	//path from the best leaf up to the root
+	ids[n_levels-1] = cur_ids[0];
+	for (int lvl = n_levels-1; lvl > 0; lvl--) 
+	{
+		ids[lvl-1] = levels[lvl].getParent(ids[lvl]);
+	}
 }
 
 
@@ -46,36 +220,110 @@ HierarchicalClusterDiscretizer::HierarchicalClusterDiscretizer(const Hierarchica
 ////////////////////////////////////
 
 
-void HierarchicalClusterDiscretizer::discretize(FstHistory* const fsth, const struct neuron * const layer) const 
+void HierarchicalClusterDiscretizer::discretize(HierarchicalClusterFstHistory &h, const struct neuron * const layer) const
 {
-	HierarchicalClusterFstHistory *p = dynamic_cast<HierarchicalClusterFstHistory *>(fsth);
-	if (p != NULL) 
-	{
-		int min_cl = 0;
-		real min_dist = 1e100;
-		real dist = 0.0;
-		p->resetDiscretization();
-		ClusterFstHistory reduced_fsth;
-		reduced_fsth.setLastWord(fsth->getLastWord());
+	h.resetDiscretization();
+	if (getNumLevels() == 0) { return; }
+	//the layer is gathered once and shared by all the levels (same dims, same stride)
+	int stride = levels[0].getStride();
+	real *x = (real *) alloca(stride*sizeof(real)+16);
+	x = (real *) (((size_t) x+15) & ~((size_t) 15));
+	real xnorm = levels[0].gather(x, layer);
+	if (beam > 0) 
+	{
+		int *ids = (int *) alloca(getNumLevels()*sizeof(int));
+		descend(ids, x, xnorm);
 		for (int i = 0; i < getNumLevels(); i++) 
 		{
-			levels[i].discretize(&reduced_fsth, layer);
-			p->setDiscretized(i,reduced_fsth.getDiscretized());
+			h.setDiscretized(i,ids[i]);
 		}
+		return;
+	}
+	for (int i = 0; i < getNumLevels(); i++) 
+	{
+		h.setDiscretized(i,levels[i].nearest(x, xnorm));
 	}
 }
 
 
-	
-void HierarchicalClusterDiscretizer::undiscretize(struct neuron * const layer, const FstHistory * const fsth) const 
+
+void HierarchicalClusterDiscretizer::discretize(FstHistory* const fsth, const struct neuron * const layer) const
 {
-	const HierarchicalClusterFstHistory *p = dynamic_cast<const HierarchicalClusterFstHistory *>(fsth);
-	if (p != NULL) 
+	HierarchicalClusterFstHistory *p = dynamic_cast<HierarchicalClusterFstHistory *>(fsth);
+	if (p != NULL)
 	{
-		for (int i = 0; i < getNumDims(); i++) 
+		discretize(*p, layer);
+	}
+}
+
+
+void HierarchicalClusterDiscretizer::cacheRecurrentInput(CRnnLM &rnnlm) 
+{
+	for (int i = 0; i < getNumLevels(); i++) 
+	{
+		levels[i].cacheRecurrentInput(rnnlm);
+	}
+}
+
+
+const real *HierarchicalClusterDiscretizer::getRecurrentInput(const HierarchicalClusterFstHistory &h) const 
+{
+	//same mean as undiscretize()
+	if (h.getNumClusters() == 0) { return NULL; }
+	return levels[h.getNumClusters()-1].getRecurrentInput(h.getFinestDiscretized());
+}
+
+
+void HierarchicalClusterDiscretizer::discretizeBatch(int * const ids, const real * const x, int n, int ld) const 
+{
+	if ((beam > 0) && (getNumLevels() > 0)) 
+	{
+		//tree descent, vector by vector
+		int stride = levels[0].getStride();
+		real *v = (real *) alloca(stride*sizeof(real)+16);
+		v = (real *) (((size_t) v+15) & ~((size_t) 15));
+		for (int r = 0; r < n; r++) 
 		{
-			layer[i].ac = levels.at(p->getNumClusters()-1).getMean(p->getFinestDiscretized(),i);
+			real vnorm = 0.0;
+			int i = 0;
+			for (; i < n_dims; i++) 
+			{
+				v[i] = x[(size_t) r*ld+i];
+				vnorm += v[i]*v[i];
+			}
+			for (; i < stride; i++) 
+			{
+				v[i] = 0.0;
+			}
+			descend(ids+(size_t) r*getNumLevels(), v, sqrt(vnorm));
 		}
+		return;
+	}
+	//one GEMM-based pass per level, ids of a vector are stored level by level
+	for (int i = 0; i < getNumLevels(); i++) 
+	{
+		levels[i].assignBatch(ids+i, getNumLevels(), x, n, ld);
+	}
+}
+
+
+	
+void HierarchicalClusterDiscretizer::undiscretize(struct neuron * const layer, const HierarchicalClusterFstHistory &h) const
+{
+	for (int i = 0; i < getNumDims(); i++) 
+	{
+		layer[i].ac = levels.at(h.getNumClusters()-1).getMean(h.getFinestDiscretized(),i);
+	}
+}
+
+
+
+void HierarchicalClusterDiscretizer::undiscretize(struct neuron * const layer, const FstHistory * const fsth) const
+{
+	const HierarchicalClusterFstHistory *p = dynamic_cast<const HierarchicalClusterFstHistory *>(fsth);
+	if (p != NULL)
+	{
+		undiscretize(layer, *p);
 	}
 }
 
@@ -150,46 +398,50 @@ void HierarchicalClusterDiscretizer::undiscretize(struct neuron * const layer, c
 
 bool HierarchicalClusterDiscretizer::load(string fn) 
 {
-	fstream in (fn.c_str());
-	string word;
-	string line;
-
-	if ( !in )
-	  return false;
+	levels.clear();
+	delete mapping;
+	mapping = NULL;
 
-	int n = 0; //id of a cluster in the current clustering
-	vector<int> n_cl; //number of cluster in each clustering
-	while (getline(in, line)) 
+	if (ClusterMap::isBinary(fn)) 
 	{
-		if (line == "--") 
+		mapping = new ClusterMap();
+		if (!mapping->open(fn)) 
 		{
-			printf("%ith level : %i clusters\n", n_cl.size(), n);
-			n_cl.push_back(n);
-			n=0;
+			return false;
 		}
-		else if ((line != "") && (line.find(" ") != string::npos)) 
+		//no reallocation, levels must not be copied once they point into the mapping
+		levels.reserve(mapping->getNumLevels());
+		for (int lvl=0; lvl < mapping->getNumLevels(); lvl++) 
 		{
-			printf("new cluster in %ith level\n", n_cl.size());
-			n++;
+			levels.push_back(ClusterDiscretizer(n_dims, 0));
+			if (!levels[lvl].load(*mapping, lvl)) 
+			{
+				levels.pop_back();
+				return false;
+			}
+			fprintf(stderr, "%ith level : %i clusters\n", lvl, levels[lvl].getNumClusters());
 		}
+		buildTree();
+		return true;
 	}
-	if (n > 0) 
-	{
-		printf("%ith level : %i clusters\n", n_cl.size(), n);
-		n_cl.push_back(n);
-	}
-	in.close();
-	
-	int cl = 0; //id of a clustering
-	n=0;
-	in.open(fn.c_str());
-	for (int lvl=0; lvl < n_cl.size(); lvl++) 
+
+	fstream in (fn.c_str());
+	if ( !in )
+	  return false;
+
+	//one pass: each level is read until "--"
+	while (in) 
 	{
-//		levels.push_back(ClusterDiscretizer(n_dims, n_cl[lvl], n_words));
-		levels.push_back(ClusterDiscretizer(n_dims, n_cl[lvl]));
-		levels[lvl].load(in);
+		levels.push_back(ClusterDiscretizer(n_dims, 0));
+		if (!levels.back().load(in)) 
+		{
+			levels.pop_back();
+			break;
+		}
+		fprintf(stderr, "%ith level : %i clusters\n", (int) levels.size()-1, levels.back().getNumClusters());
 	}
 	in.close();
+	buildTree();
 // 	levels.push_back(ClusterDiscretizer(n_dims,n_cl[cl]));
 // 	while (getline(in, line)) {
 // //		cout << line << endl;
@@ -229,3 +481,56 @@ bool HierarchicalClusterDiscretizer::load(string fn)
 
 
 
+
+
+
+bool HierarchicalClusterDiscretizer::save(string fn) const 
+{
+	FILE *f = fopen(fn.c_str(), "wb");
+	if (f == NULL) 
+	{
+		return false;
+	}
+	int stride = (getNumLevels() > 0) ? levels[0].getStride() : 0;
+	vector<int> sizes;
+	vector<size_t> offs;
+	for (int lvl = 0; lvl < getNumLevels(); lvl++) 
+	{
+		sizes.push_back(levels[lvl].getNumClusters());
+	}
+	ClusterMap::layout(sizes, stride, offs);
+	
+	int32_t header[4] = { (int32_t) getNumLevels(), (int32_t) n_dims, (int32_t) stride, (int32_t) sizeof(real) };
+	bool ok = (fwrite(CLUSTER_MAP_MAGIC, 1, 8, f) == 8) && (fwrite(header, sizeof(int32_t), 4, f) == 4);
+	for (int lvl = 0; ok && (lvl < getNumLevels()); lvl++) 
+	{
+		int32_t n = sizes[lvl];
+		ok = (fwrite(&n, sizeof(int32_t), 1, f) == 1);
+	}
+	for (int lvl = 0; ok && (lvl < getNumLevels()); lvl++) 
+	{
+		const ClusterDiscretizer &level = levels[lvl];
+		int n = level.getNumClusters();
+		//zero padding up to the level
+		while (ok && ((size_t) ftell(f) < offs[lvl])) 
+		{
+			ok = (fputc(0, f) != EOF);
+		}
+		vector<real> priors(n);
+		vector<int32_t> parents(n);
+		for (int cl = 0; cl < n; cl++) 
+		{
+			priors[cl] = level.getPrior(cl);
+			parents[cl] = level.getParent(cl);
+		}
+		ok = ok && ((n == 0) || ((fwrite(level.getMeans(), sizeof(real), (size_t) n*stride, f) == (size_t) n*stride)
+		                      && (fwrite(&priors[0], sizeof(real), n, f) == (size_t) n)
+		                      && (fwrite(&parents[0], sizeof(int32_t), n, f) == (size_t) n)));
+	}
+	//the file size is that of the layout
+	while (ok && (getNumLevels() > 0) && ((size_t) ftell(f) % CLUSTER_MAP_ALIGN != 0)) 
+	{
+		ok = (fputc(0, f) != EOF);
+	}
+	return (fclose(f) == 0) && ok;
+}
@@ -20,12 +20,25 @@
  
 using namespace std;
  
+class HierarchicalClusterFstHistory;
+
 class HierarchicalClusterDiscretizer : public Discretizer {
 
 	protected:
 	vector<ClusterDiscretizer> levels;
+	ClusterMap *mapping;	//binary file whose means are used by the levels (NULL for a text file)
 	int n_words;
-	real distanceL2(const real * const u, const struct neuron * const v) const;
+	
+	//tree search: 0 means an independent search at each level, otherwise the
+	//beam best clusters of a level are kept and only their children are searched
+	int beam;
+	//children of cluster c of level l (in level l+1):
+	//child_list[l][child_start[l][c]] ... child_list[l][child_start[l][c+1]-1]
+	vector< vector<int> > child_start;
+	vector< vector<int> > child_list;
+	
+	void buildTree();
+	void descend(int * const ids, const real * const x, real xnorm) const;
 	
 	public:
 	
@@ -34,14 +47,33 @@ class HierarchicalClusterDiscretizer : public Discretizer {
 	HierarchicalClusterDiscretizer(int dims);
 	HierarchicalClusterDiscretizer(int dims, string fn);
 	HierarchicalClusterDiscretizer(const HierarchicalClusterDiscretizer &dzer);
+	~HierarchicalClusterDiscretizer();
+	HierarchicalClusterDiscretizer& operator=(const HierarchicalClusterDiscretizer &dzer);
 	
 	int getNumLevels() const { return levels.size(); }
 	int getLevelSize(int lvl) { return levels[lvl].getNumClusters(); }
 	real getPrior(int lvl, int cl) { return levels[lvl].getPrior(cl); }
+	int getParent(int lvl, int cl) const { return levels[lvl].getParent(cl); }
+	void setTreeSearch(int b) { beam = b; }
+	int getTreeSearch() const { return beam; }
+	//builds a search tree over the means of the levels with at least min_clusters clusters
+	void setIndex(real eps, int max_checks, int min_clusters = 256);
+	const ClusterDiscretizer &getLevel(int lvl) const { return levels[lvl]; }
 //	real getWordPrior(int lvl, int cl, int w) { return levels[lvl].getWordPrior(cl,w); }
+	//precomputes the product of the recurrent weights of rnnlm and of the means of all the levels
+	void cacheRecurrentInput(CRnnLM &rnnlm);
+	const real *getRecurrentInput(const HierarchicalClusterFstHistory &h) const;
+	//same as discretize()/undiscretize() without checking the type of the history
+	void discretize(HierarchicalClusterFstHistory &h, const struct neuron * const layer) const;
+	void undiscretize(struct neuron * const layer, const HierarchicalClusterFstHistory &h) const;
 	void discretize(FstHistory* const fsth, const struct neuron* layer) const;
+	int getCodeSize() const { return getNumLevels(); }
+	void discretizeBatch(int * const ids, const real * const x, int n, int ld) const;
 	void undiscretize(struct neuron* layer, const FstHistory* fsth) const;
+	//reads a text or a binary (see cluster_map.h) k-means file
 	bool load(string fn);
+	//writes the levels in the binary format
+	bool save(string fn) const;
 	
 };
  
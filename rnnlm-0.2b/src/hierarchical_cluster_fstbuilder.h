@@ -11,37 +11,39 @@
 
 
 #ifndef _HIERARCHICAL_CLUSTER_FSTBUILDER_H_
-#define _HIERARCHICAL_CLUSTER_NEURON_FSTBUILDER_H_
+#define _HIERARCHICAL_CLUSTER_FSTBUILDER_H_
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <fst/fstlib.h>
-#include "abstract_fstbuilder.h"
+#include "typed_fstbuilder.h"
+#include "backoff_fstbuilder.h"
 #include "hierarchical_cluster_discretizer.h"
 #include "hierarchical_cluster_fsthistory.h"
+#include "transition_table.h"
+#include "fst_shards.h"
 //#include "backoffstrategy.h"
+#include <vector>
 
 using namespace std;
 using namespace fst;
 
-
 typedef std::pair<real, int> dist_dim_pair;
 
-class HierarchicalClusterFstBuilder : public FstBuilder {
+class HierarchicalClusterFstBuilder : public TypedFstBuilder<HierarchicalClusterFstHistory, HierarchicalClusterDiscretizer, BackoffFstBuilder> {
 	
 	protected:
 	
 	int num_bins;
-	int max_backoff_path;
-	real pruning_threshold;
+	
+	//successors of the states (NULL: the hidden layer is discretized)
+	const TransitionTable *transitions;
 
 	//Can be overloaded using inheritance
-	virtual HierarchicalClusterFstHistory getBackoff(CRnnLM &rnnlm,
-	                              const HierarchicalClusterFstHistory &fsth,
-	                              set<HierarchicalClusterFstHistory> &min_bo,
-	                              vector<real> &cur_cond,
-	                              vector<int> &words);
+	virtual HierarchicalClusterFstHistory getBackoff(const HierarchicalClusterFstHistory &fsth, FstIndex id);
+	real getPosterior(CRnnLM &rnnlm, const HierarchicalClusterFstHistory &fsth, int total_counts) const;
+	void setSuccessorHistory(HierarchicalClusterFstHistory &new_fsth, CRnnLM &rnnlm, const HierarchicalClusterFstHistory &fsth) const;
 	                              
 // 	virtual HierarchicalClusterFstHistory getBackoff(
 //                       CRnnLM &rnnlm,
@@ -50,51 +52,25 @@ class HierarchicalClusterFstBuilder : public FstBuilder {
 //                       vector<real> &cur_cond,
 //                       vector<int> &words);
 	                              
-	void computeEntropyAndConditionalsSpecial(real &entropy, vector<real> &res, CRnnLM &rnnlm, const FstHistory & fsth, real posterior);
-
-	//Computation of backoff weights
-	real computeFstWordProb(VectorFst<LogArc> &fst, int word, FstIndex state);
-	void computeOneBackoff(VectorFst<LogArc> &fst, FstIndex src, FstIndex bo);
-	void computeAllBackoff(VectorFst<LogArc> &fst, map< FstIndex,set<FstIndex> > &pred);
-
-	//Computation of backoff nodes
-	real computeDeltaEntropy(real log_p_post, // -log
-                     real log_p_cond, // -log
-                     real log_p_cond_bo, // -log 
-                     real sum_seen, // real
-                     real sum_seen_bo); // real
-	void estimateMasses(real *mass1, //out
-                   real *mass2, //out
-                   CRnnLM & rnnlm,
-                   real threshold, //in
-                   real p_post, //in
-                   vector<real> &all_prob, //in
-                   vector<real> &all_bo_prob //in
-                   );
-	void changeTargetForNode(VectorFst<LogArc> &fst, FstIndex old_target, FstIndex new_target);
-	void removePred(map< FstIndex,vector<FstIndex> > &pred, FstIndex dest, FstIndex src);
-	void removeStates(const VectorFst<LogArc> &old_fst, VectorFst<LogArc> &new_fst, vector<FstIndex> &to_be_deleted);	
-	vector<FstIndex> compactBackoffNodes(VectorFst<LogArc> &fst, map< FstIndex,set<FstIndex> > &pred, vector<bool> &non_bo_pred);
-	
-	real deltaProb(real p_cond, real p_cond_bo);
-	
+	void computeEntropyAndConditionalsSpecial(real &entropy, vector<real> &res, CRnnLM &rnnlm, const HierarchicalClusterFstHistory & fsth, real posterior);
+
 	real computeTotalEntropy(CRnnLM &rnnlm);
 	
 	public:
-	HierarchicalClusterFstBuilder(HierarchicalClusterDiscretizer* d) : FstBuilder(d) {
-		max_backoff_path=2;
-		pruning_threshold=0.01;
-	}
+	HierarchicalClusterFstBuilder(HierarchicalClusterDiscretizer* d) : TypedFstBuilder<HierarchicalClusterFstHistory, HierarchicalClusterDiscretizer, BackoffFstBuilder>(d, 0.01, 2) { transitions = NULL; }
 	
-	HierarchicalClusterFstBuilder(HierarchicalClusterDiscretizer* d, real t, int bol) : FstBuilder(d) 
-	{
-		pruning_threshold=t;
-		max_backoff_path=bol;
-	}
+	HierarchicalClusterFstBuilder(HierarchicalClusterDiscretizer* d, real t, int bol) : TypedFstBuilder<HierarchicalClusterFstHistory, HierarchicalClusterDiscretizer, BackoffFstBuilder>(d, t, bol) { transitions = NULL; }
+
+	void setTransitions(const TransitionTable *t) { transitions = t; }
 
 	//Main method
 	virtual void convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst);
 
+	//Conversion of one shard (see fst_shards.h): the keys of the shard are read from in,
+	//the keys of the targets owned by other shards are written to out, and the states
+	//of the shard are saved in file
+	void convertShard(CRnnLM & rnnlm, int shard, int n_shards, FILE *in, FILE *out, string file);
+
 };
 
 
@@ -13,7 +13,7 @@ using namespace std;
 
 bool HierarchicalClusterFstHistory::sameDiscretization(const FstHistory *fsth) const {
 	const HierarchicalClusterFstHistory *p = dynamic_cast<const HierarchicalClusterFstHistory *>(fsth);
-	return (p != NULL) && (this->discretized == p->discretized);
+	return (p != NULL) && sameDiscretization(*p);
 } 
  
 
@@ -24,8 +24,8 @@ string HierarchicalClusterFstHistory::toString() const {
 	ostringstream str;
 	str << getLastWord() << " | ";
 	int i;
-	if (discretized.size() > 0) {
-		for (i = 0; i < (int) discretized.size()-1; i++) {
+	if (n_levels > 0) {
+		for (i = 0; i < n_levels-1; i++) {
 			str << discretized[i] << "<";
 		}
 		str << discretized[i];
@@ -42,18 +42,7 @@ string HierarchicalClusterFstHistory::toString() const {
 
 bool HierarchicalClusterFstHistory::lower(const FstHistory *fsth) const {
 	const HierarchicalClusterFstHistory *p = dynamic_cast<const HierarchicalClusterFstHistory *>(fsth);
-	if (p != NULL) {
-		if (getLastWord() !=  p->getLastWord()) {
-			return getLastWord() <  p->getLastWord();;
-		}
-		else if (getNumClusters() != p->getNumClusters()) {
-			return getNumClusters() < p->getNumClusters();
-		}
-		else {
-			return discretized < p->discretized;
-		}
-	}
-	return false;
+	return (p != NULL) && lower(*p);
 }
 
 
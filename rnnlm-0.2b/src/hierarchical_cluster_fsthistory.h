@@ -11,42 +11,115 @@
  *                     | ...
  *                     | ID of cluster in Nth clustering
  *
+ * The IDs are stored inline (at most HCLUSTER_MAX_LEVELS levels), so that
+ * histories are copied without any allocation.
+ *
  ************************************************************************/
 
 #ifndef _HIERARCHICAL_CLUSTER_FSTHISTORY_H_
 #define _HIERARCHICAL_CLUSTER_FSTHISTORY_H_
  
 #include "cluster_fsthistory.h"
+
+//maximum depth of a cluster hierarchy
+#ifndef HCLUSTER_MAX_LEVELS
+#define HCLUSTER_MAX_LEVELS 8
+#endif
  
 class HierarchicalClusterFstHistory : public FstHistory {
 	protected:
-	vector<cluster_id> discretized;
+	cluster_id discretized[HCLUSTER_MAX_LEVELS];
+	int n_levels;
 	
 	public:
 
 	
 	HierarchicalClusterFstHistory() : FstHistory() {
+		n_levels = 0;
 	}
 	
 	HierarchicalClusterFstHistory(const HierarchicalClusterFstHistory &fsth) : FstHistory(fsth) {
-		discretized = fsth.getDiscretized();
+		n_levels = fsth.n_levels;
+		memcpy(discretized, fsth.discretized, n_levels*sizeof(cluster_id));
+	}
+	
+	HierarchicalClusterFstHistory &operator=(const HierarchicalClusterFstHistory &fsth) {
+		setLastWord(fsth.getLastWord());
+		n_levels = fsth.n_levels;
+		memcpy(discretized, fsth.discretized, n_levels*sizeof(cluster_id));
+		return *this;
 	}
 	
 	//Getters / Setters
-	vector<cluster_id> getDiscretized() const { return discretized; }
-	cluster_id getFinestDiscretized() const { return discretized.back(); }
-	int getNumClusters() const { return (int) discretized.size(); }
+	//view of the getNumClusters() IDs, valid as long as the history is
+	const cluster_id *getDiscretized() const { return discretized; }
+	cluster_id getDiscretized(int lvl) const { return discretized[lvl]; }
+	cluster_id getFinestDiscretized() const { return discretized[n_levels-1]; }
+	int getNumClusters() const { return n_levels; }
 	
 	void setDiscretized(int lvl, cluster_id d) { 
-		if (discretized.size() <= lvl) {
-			for (int i=discretized.size(); i <= lvl; i++) {
-				discretized.push_back(0);
+		if (lvl >= n_levels) {
+			if (lvl >= HCLUSTER_MAX_LEVELS) {
+				fprintf(stderr, "ERROR: more than %i levels of clusters (see HCLUSTER_MAX_LEVELS)\n", HCLUSTER_MAX_LEVELS);
+				exit(1);
 			}
+			for (int i=n_levels; i < lvl; i++) {
+				discretized[i] = 0;
+			}
+			n_levels = lvl+1;
 		}
 		discretized[lvl] = d;
 	}
-	void reduceDiscretization() { discretized.pop_back(); }
-	void resetDiscretization() { discretized.clear(); }
+	void reduceDiscretization() { n_levels--; }
+	void resetDiscretization() { n_levels = 0; }
+	
+	// Comparisons with a history of the same type
+	bool lower(const HierarchicalClusterFstHistory &other) const {
+		if (getLastWord() != other.getLastWord()) {
+			return getLastWord() < other.getLastWord();
+		}
+		else if (n_levels != other.n_levels) {
+			return n_levels < other.n_levels;
+		}
+		for (int i = 0; i < n_levels; i++) {
+			if (discretized[i] != other.discretized[i]) {
+				return discretized[i] < other.discretized[i];
+			}
+		}
+		return false;
+	}
+	bool sameDiscretization(const HierarchicalClusterFstHistory &other) const {
+		if (n_levels != other.n_levels) {
+			return false;
+		}
+		for (int i = 0; i < n_levels; i++) {
+			if (discretized[i] != other.discretized[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+	//last word and number of clusters, then two cluster ids per word
+	void packKey(vector<uint64_t> &key) const {
+		int n = getNumClusters();
+		key.resize(1+(n+1)/2);
+		key[0] = ((uint64_t) (uint32_t) getLastWord() << 32) | (uint32_t) n;
+		for (int i = 0; i < n; i += 2) {
+			uint64_t hi = (uint32_t) discretized[i];
+			uint64_t lo = (i+1 < n) ? (uint32_t) discretized[i+1] : 0;
+			key[1+i/2] = (hi << 32) | lo;
+		}
+	}
+	//inverse of packKey()
+	void unpackKey(const vector<uint64_t> &key) {
+		int n = (int) (uint32_t) key[0];
+		setLastWord((int) (uint32_t) (key[0] >> 32));
+		resetDiscretization();
+		for (int i = 0; i < n; i++) {
+			uint64_t k = key[1+i/2];
+			setDiscretized(i, (cluster_id) (uint32_t) ((i%2 == 0) ? (k >> 32) : k));
+		}
+	}
 	
 	// Interface methods
 	virtual bool lower(const FstHistory *other) const;
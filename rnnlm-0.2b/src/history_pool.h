@@ -0,0 +1,128 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Histories of the states of an FST under construction, indexed by
+// state id. They are copied once into chunks of POOL_CHUNK histories
+// (their addresses never change) and looked up through a hash index of
+// their packed keys; the conversion queue and the state dump only hold
+// ids or pointers into the pool. Everything is freed at once by clear().
+//
+// H must provide packKey(vector<uint64_t>&), getLastWord() and
+// sameDiscretization(const H&).
+//
+///////////////////////////////////////////////////////////////////////
+
+
+
+#ifndef _HISTORY_POOL_H_
+#define _HISTORY_POOL_H_
+
+#include <new>
+#include <vector>
+#include "fst_state_table.h"
+
+using namespace std;
+
+#define POOL_CHUNK 4096
+
+
+template <class H>
+class HistoryPool {
+
+	protected:
+
+	vector<H*> chunks;	//raw storage of POOL_CHUNK histories each
+	int n;
+	FstStateTable index;
+	vector<uint64_t> probe;	//key of the last history inserted (insert() only)
+
+	//hash of h, whose key is packed into the buffer key
+	static uint64_t hash(const H &h, vector<uint64_t> &key) {
+		h.packKey(key);
+		return FstStateTable::hashKey(key);
+	}
+
+	struct Same {
+		const HistoryPool<H> *pool;
+		const H *h;
+		bool operator() (int id) const {
+			const H &other = (*pool)[id];
+			return (other.getLastWord() == h->getLastWord()) && other.sameDiscretization(*h);
+		}
+	};
+
+	//copies h at the end of the pool and returns its id
+	int push(const H &h) {
+		if (n == (int) chunks.size()*POOL_CHUNK) {
+			chunks.push_back((H*) ::operator new(POOL_CHUNK*sizeof(H)));
+		}
+		new (chunks[n/POOL_CHUNK]+n%POOL_CHUNK) H(h);
+		return n++;
+	}
+
+	public:
+
+	HistoryPool() {
+		n = 0;
+	}
+
+	~HistoryPool() {
+		clear();
+	}
+
+	int size() const { return n; }
+
+	const H &operator[](int id) const {
+		return chunks[id/POOL_CHUNK][id%POOL_CHUNK];
+	}
+
+	/**
+	 * Id of a history, -1 if it is not in the pool. The key is packed
+	 * into a buffer of the calling thread, so that several threads may
+	 * look up histories at once (as long as none is inserted meanwhile).
+	 */
+	int find(const H &h) const {
+		static thread_local vector<uint64_t> key;
+		Same same = { this, &h };
+		return index.find(hash(h, key), same);
+	}
+
+	/**
+	 * Id of a history, which is added (with id size()) if it is not in
+	 * the pool yet
+	 */
+	int insert(const H &h, bool &added) {
+		Same same = { this, &h };
+		uint64_t key_hash = hash(h, probe);
+		int id = index.find(key_hash, same);
+		added = (id == -1);
+		if (added) {
+			id = push(h);
+			index.insert(key_hash, id);
+		}
+		return id;
+	}
+
+	/**
+	 * Adds a history which cannot be found (e.g. placeholder of a state
+	 * without history) and returns its id
+	 */
+	int append(const H &h) {
+		return push(h);
+	}
+
+	void clear() {
+		for (int i = 0; i < n; i++) {
+			chunks[i/POOL_CHUNK][i%POOL_CHUNK].~H();
+		}
+		for (size_t c = 0; c < chunks.size(); c++) {
+			::operator delete(chunks[c]);
+		}
+		chunks.clear();
+		n = 0;
+		index.clear();
+	}
+
+};
+
+
+#endif
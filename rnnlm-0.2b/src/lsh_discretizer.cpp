@@ -0,0 +1,313 @@
+/************************************************************************
+ * Associate a RNN state to the signs of projections of the hidden layer
+ * and, vice-versa, restore a RNN state from the known bits of a state.
+ *
+ ***********************************************************************/
+
+#include "lsh_discretizer.h"
+#include <iostream>
+#include <sstream>
+#include <alloca.h>
+#include <algorithm>
+
+#define mylog(x) -log(x)
+
+using namespace std;
+
+/**
+ * In-place inversion of the n x n symmetric positive definite matrix a
+ * (Gauss-Jordan with partial pivoting)
+ */
+static void invert(vector<real> &a, int n)
+{
+	vector<real> inv(n*n, 0.0);
+	for (int i = 0; i < n; i++) inv[i*n+i] = 1.0;
+	for (int c = 0; c < n; c++)
+	{
+		int piv = c;
+		for (int r = c+1; r < n; r++)
+		{
+			if (fabs(a[r*n+c]) > fabs(a[piv*n+c])) piv = r;
+		}
+		for (int j = 0; j < n; j++)
+		{
+			swap(a[c*n+j], a[piv*n+j]);
+			swap(inv[c*n+j], inv[piv*n+j]);
+		}
+		real d = a[c*n+c];
+		for (int j = 0; j < n; j++)
+		{
+			a[c*n+j] /= d;
+			inv[c*n+j] /= d;
+		}
+		for (int r = 0; r < n; r++)
+		{
+			if (r == c) continue;
+			real f = a[r*n+c];
+			for (int j = 0; j < n; j++)
+			{
+				a[r*n+j] -= f*a[c*n+j];
+				inv[r*n+j] -= f*inv[c*n+j];
+			}
+		}
+	}
+	a = inv;
+}
+
+
+
+LSHDiscretizer::LSHDiscretizer(int dims)
+{
+	n_dims = dims;
+	n_bits = 0;
+}
+
+LSHDiscretizer::LSHDiscretizer(int dims, string fn)
+{
+	n_dims = dims;
+	n_bits = 0;
+	if (!load(fn))
+	{
+		fprintf(stderr, "ERROR: cannot load projections from %s\n", fn.c_str());
+		exit(1);
+	}
+}
+
+
+
+/**
+ * Computes the projections of the mean and the ridge pseudo-inverse of
+ * the projections used to restore states
+ */
+void LSHDiscretizer::prepare()
+{
+	int b, c, i;
+	mean_proj.assign(n_bits, 0.0);
+	for (b = 0; b < n_bits; b++)
+	{
+		for (i = 0; i < n_dims; i++) mean_proj[b] += proj[b*n_dims+i]*mean[i];
+	}
+
+	//pinv(P) = P' (P P' + l I)^-1 if there are less bits than neurons, (P' P + l I)^-1 P' otherwise
+	recon.assign(n_bits*n_dims, 0.0);
+	bool by_bits = (n_bits <= n_dims);
+	int n = by_bits ? n_bits : n_dims;
+	vector<real> g(n*n, 0.0);
+	real tr = 0.0;
+	for (b = 0; b < n; b++)
+	{
+		for (c = 0; c < n; c++)
+		{
+			real s = 0.0;
+			if (by_bits) { for (i = 0; i < n_dims; i++) s += proj[b*n_dims+i]*proj[c*n_dims+i]; }
+			else { for (i = 0; i < n_bits; i++) s += proj[i*n_dims+b]*proj[i*n_dims+c]; }
+			g[b*n+c] = s;
+		}
+		tr += g[b*n+b];
+	}
+	for (b = 0; b < n; b++) g[b*n+b] += 1e-6*tr/n+1e-12;
+	invert(g, n);
+	for (b = 0; b < n_bits; b++)
+	{
+		for (i = 0; i < n_dims; i++)
+		{
+			real s = 0.0;
+			if (by_bits) { for (c = 0; c < n_bits; c++) s += proj[c*n_dims+i]*g[c*n+b]; }
+			else { for (c = 0; c < n_dims; c++) s += g[i*n+c]*proj[b*n_dims+c]; }
+			recon[b*n_dims+i] = s;
+		}
+	}
+}
+
+
+
+real LSHDiscretizer::getPrior(lsh_bits bits, lsh_bits mask) const
+{
+	real p = 0.0;
+	for (int b = 0; b < n_bits; b++)
+	{
+		if ((mask >> b) & 1)
+		{
+			p += ((bits >> b) & 1) ? prior1[b] : prior0[b];
+		}
+	}
+	return p;
+}
+
+
+
+lsh_bits LSHDiscretizer::hash(const real * const x, lsh_bits *weak) const
+{
+	lsh_bits bits = 0;
+	lsh_bits w = 0;
+	const real *p = &proj[0];
+	for (int b = 0; b < n_bits; b++, p += n_dims)
+	{
+		real y = -threshold[b];
+		for (int i = 0; i < n_dims; i++)
+		{
+			y += p[i]*x[i];
+		}
+		if (y > 0) bits |= (lsh_bits) 1 << b;
+		if (fabs(y) < weak_margin[b]) w |= (lsh_bits) 1 << b;
+	}
+	if (weak != NULL) *weak = w;
+	return bits;
+}
+
+
+
+void LSHDiscretizer::discretize(LSHFstHistory &h, const struct neuron * const layer) const
+{
+	real *x = (real *) alloca(n_dims*sizeof(real));
+	for (int i = 0; i < n_dims; i++)
+	{
+		x[i] = layer[i].ac;
+	}
+	lsh_bits weak;
+	lsh_bits bits = hash(x, &weak);
+	h.setDiscretized(bits, getFullMask(), weak);
+}
+
+
+
+void LSHDiscretizer::discretize(FstHistory* const fsth, const struct neuron * const layer) const
+{
+	LSHFstHistory *p = dynamic_cast<LSHFstHistory *>(fsth);
+	if (p != NULL)
+	{
+		discretize(*p, layer);
+	}
+}
+
+
+
+void LSHDiscretizer::discretizeBatch(int * const ids, const real * const x, int n, int ld) const
+{
+	for (int r = 0; r < n; r++)
+	{
+		lsh_bits bits = hash(x+(size_t) r*ld);
+		for (int b = 0; b < n_bits; b++)
+		{
+			ids[(size_t) r*n_bits+b] = (bits >> b) & 1;
+		}
+	}
+}
+
+
+
+void LSHDiscretizer::discretizeBatch(lsh_key * const keys, const real * const x, int n, int ld) const
+{
+	LSHFstHistory h;
+	for (int r = 0; r < n; r++)
+	{
+		h.setDiscretized(hash(x+(size_t) r*ld), getFullMask());
+		keys[r] = h.getDiscretized();
+	}
+}
+
+
+
+void LSHDiscretizer::undiscretize(struct neuron * const layer, const LSHFstHistory &h) const
+{
+	int i;
+	for (i = 0; i < n_dims; i++)
+	{
+		layer[i].ac = mean[i];
+	}
+	for (int b = 0; b < n_bits; b++)
+	{
+		if (!((h.getMask() >> b) & 1)) continue;
+		real z = (((h.getBits() >> b) & 1) ? value1[b] : value0[b])-mean_proj[b];
+		const real *r = &recon[b*n_dims];
+		for (i = 0; i < n_dims; i++)
+		{
+			layer[i].ac += r[i]*z;
+		}
+	}
+}
+
+
+
+void LSHDiscretizer::undiscretize(struct neuron * const layer, const FstHistory * const fsth) const
+{
+	const LSHFstHistory *p = dynamic_cast<const LSHFstHistory *>(fsth);
+	if (p != NULL)
+	{
+		undiscretize(layer, *p);
+	}
+}
+
+
+
+bool LSHDiscretizer::load(string fn)
+{
+	fstream in (fn.c_str());
+	string word;
+	string line;
+
+	if ( !in )
+	  return false;
+
+	n_bits = 0;
+	proj.clear();
+	threshold.clear();
+	weak_margin.clear();
+	prior0.clear();
+	prior1.clear();
+	value0.clear();
+	value1.clear();
+	mean.assign(n_dims, 0.0);
+
+	bool in_mean = false;
+	while (getline(in, line))
+	{
+		istringstream strstr(line);
+		vector<real> v;
+		if (!(strstr >> word) || (word[0] == '#')) { continue; }
+		if (word == "--")
+		{
+			in_mean = true;
+			continue;
+		}
+		do
+		{
+			if (word[0] == '#') break;
+			v.push_back(atof(word.c_str()));
+		} while (strstr >> word);
+
+		if (in_mean)
+		{
+			if ((int) v.size() != n_dims)
+			{
+				fprintf(stderr, "ERROR: the mean has %i values instead of %i\n", (int) v.size(), n_dims);
+				return false;
+			}
+			mean = v;
+			break;
+		}
+		if ((int) v.size() != n_dims+5)
+		{
+			fprintf(stderr, "ERROR: projection %i has %i values instead of %i\n", n_bits, (int) v.size(), n_dims+5);
+			return false;
+		}
+		if (n_bits >= LSH_MAX_BITS)
+		{
+			fprintf(stderr, "ERROR: more than %i projections\n", LSH_MAX_BITS);
+			return false;
+		}
+		threshold.push_back(v[0]);
+		weak_margin.push_back(v[1]);
+		prior1.push_back(mylog(v[2]));
+		prior0.push_back(mylog(1.0-v[2]));
+		value0.push_back(v[3]);
+		value1.push_back(v[4]);
+		proj.insert(proj.end(), v.begin()+5, v.end());
+		n_bits++;
+	}
+	in.close();
+
+	prepare();
+	fprintf(stderr, "%i projections\n", n_bits);
+	return (n_bits > 0);
+}
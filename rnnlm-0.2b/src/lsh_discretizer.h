@@ -0,0 +1,82 @@
+/************************************************************************
+ * Associate a RNN state to the signs of B projections of the hidden
+ * layer (locality-sensitive hashing) and, vice-versa, restore a RNN state
+ * from the known bits of a state.
+ *
+ * Discretizing costs one B x N product and comparing two states a single
+ * integer comparison. A state is restored by a least-squares inversion of
+ * the projections: each known bit is replaced by the mean projection of
+ * the trace vectors which have this bit, each cleared bit by the mean of
+ * the trace.
+ *
+ * Format of a projection file (as written by train-lsh): one line per bit,
+ * the most reliable bits first, then the mean of the trace
+ * <threshold> <weak_margin> <P(bit=1)> <mean_proj_0> <mean_proj_1> <dim1> ... <dimN>
+ * ...
+ * --
+ * <mean1> ... <meanN>
+ *
+ * A bit is weak when the projection is closer to the threshold than
+ * weak_margin.
+ *
+ ***********************************************************************/
+
+#ifndef _LSH_DISCRETIZER_H_
+#define _LSH_DISCRETIZER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <vector>
+#include "abstract_discretizer.h"
+#include "lsh_fsthistory.h"
+
+using namespace std;
+
+class LSHDiscretizer : public Discretizer
+{
+
+	protected:
+	int n_bits;
+	vector<real> proj;	//n_bits x n_dims, one projection per row
+	vector<real> threshold;
+	vector<real> weak_margin;
+	vector<real> prior0;	//-log P(bit=0)
+	vector<real> prior1;	//-log P(bit=1)
+	vector<real> value0;	//mean projection of the trace vectors whose bit is 0
+	vector<real> value1;	//mean projection of the trace vectors whose bit is 1
+	vector<real> mean;	//mean of the trace
+	vector<real> mean_proj;	//projections of the mean
+	vector<real> recon;	//n_bits x n_dims, transposed pseudo-inverse of proj
+
+	void prepare();
+
+	public:
+
+	LSHDiscretizer(int dims);
+	LSHDiscretizer(int dims, string fn);
+
+	int getNumBits() const { return n_bits; }
+	lsh_bits getFullMask() const { return (n_bits >= LSH_MAX_BITS) ? ~((lsh_bits) 0) : (((lsh_bits) 1 << n_bits)-1); }
+	//-log prior of the known bits of a state (bits are assumed independent)
+	real getPrior(lsh_bits bits, lsh_bits mask) const;
+
+	//bits of a vector, and optionally its weak bits
+	lsh_bits hash(const real * const x, lsh_bits *weak = NULL) const;
+
+	//same as discretize()/undiscretize() without checking the type of the history
+	void discretize(LSHFstHistory &h, const struct neuron * const layer) const;
+	void undiscretize(struct neuron * const layer, const LSHFstHistory &h) const;
+	void discretize(FstHistory* const fsth, const struct neuron* layer) const;
+	//one id (0 or 1) per bit, the bits of a state do not fit an int
+	int getCodeSize() const { return n_bits; }
+	void discretizeBatch(int * const ids, const real * const x, int n, int ld) const;
+	//keys of n vectors (row-major n x ld matrix), as LSHFstHistory::getDiscretized() after discretize()
+	void discretizeBatch(lsh_key * const keys, const real * const x, int n, int ld) const;
+	void undiscretize(struct neuron* layer, const FstHistory* fsth) const;
+	bool load(string fn);
+
+};
+
+#endif
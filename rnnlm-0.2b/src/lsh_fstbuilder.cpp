@@ -0,0 +1,77 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Specialization of FstBuilder for sign-projection (LSH) codes.
+//
+///////////////////////////////////////////////////////////////////////
+
+
+#include "lsh_fstbuilder.h"
+
+
+
+/**
+ * Return the backoff FST state for the FST state id: an existing state
+ * with a flipped weak bit (only states created before id to avoid cycles),
+ * or the state without the weak bits, or without its last bo_step bits,
+ * and finally without the last word
+ */
+LSHFstHistory LSHFstBuilder::getBackoff(const LSHFstHistory &fsth, FstIndex id)
+{
+	LSHFstHistory bo(fsth);
+	lsh_bits mask = fsth.getMask();
+	lsh_bits weak = fsth.getWeakBits() & mask;
+	if (mask == 0) {
+		bo.setLastWord(-1);
+		return bo;
+	}
+	if (weak != 0) {
+		//least reliable bits first
+		for (int b = typed_dzer->getNumBits()-1; flip && b >= 0; b--) {
+			if (!((weak >> b) & 1)) { continue; }
+			bo.flipBits((lsh_bits) 1 << b);
+			int state = findFstState(bo);
+			if ((state != -1) && ((FstIndex) state < id)) {
+				return bo;
+			}
+			bo = fsth;
+		}
+		bo.clearBits(weak);
+		return bo;
+	}
+	for (int b = typed_dzer->getNumBits()-1, n = 0; b >= 0 && n < bo_step; b--) {
+		if ((mask >> b) & 1) {
+			bo.clearBits((lsh_bits) 1 << b);
+			n++;
+		}
+	}
+	return bo;
+}
+
+
+
+/**
+ * -log P(h,w) of a state, bits and last word being assumed independent
+ */
+real LSHFstBuilder::getPosterior(CRnnLM &rnnlm, const LSHFstHistory &fsth, int total_counts) const
+{
+	if (fsth.getLastWord() == -1) {
+		return 0.0;
+	}
+	return typed_dzer->getPrior(fsth.getBits(), fsth.getMask())
+	     + mylog((float) rnnlm.getWordCount(fsth.getLastWord())/total_counts);
+}
+
+
+
+/**
+ * Create an FST based on an RNN
+ */
+void LSHFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
+	//at most max_backoff_path backoff edges from a full code to the state without any history
+	//(weak bits and flips apart)
+	int n_bits = typed_dzer->getNumBits();
+	bo_step = (max_backoff_path > 1) ? (n_bits+max_backoff_path-2)/(max_backoff_path-1) : n_bits;
+	if (bo_step < 1) { bo_step = 1; }
+
+	convertWithBackoff(rnnlm, fst);
+}
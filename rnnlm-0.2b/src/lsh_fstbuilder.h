@@ -0,0 +1,44 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Specialization of FstBuilder for sign-projection (LSH) codes.
+// A state backs off by clearing its weak bits, or by flipping one of them
+// when the resulting state already exists, then by clearing its last bits
+// and finally its last word. Backoff targets are thus found from the bits
+// alone, without comparing conditional distributions. The pruning
+// criterion and the backoff weights are the same as for hierarchical
+// clusters.
+//
+///////////////////////////////////////////////////////////////////////
+
+#ifndef _LSH_FSTBUILDER_H_
+#define _LSH_FSTBUILDER_H_
+
+#include "typed_fstbuilder.h"
+#include "backoff_fstbuilder.h"
+#include "lsh_discretizer.h"
+#include "lsh_fsthistory.h"
+
+class LSHFstBuilder : public TypedFstBuilder<LSHFstHistory, LSHDiscretizer, BackoffFstBuilder> {
+
+	protected:
+
+	int bo_step;	//number of bits cleared by a backoff edge (weak bits apart)
+	bool flip;	//backoff to an existing state with a flipped weak bit if possible
+
+	virtual LSHFstHistory getBackoff(const LSHFstHistory &fsth, FstIndex id);
+	real getPosterior(CRnnLM &rnnlm, const LSHFstHistory &fsth, int total_counts) const;
+
+	public:
+
+	LSHFstBuilder(LSHDiscretizer* d, real t, int bol, bool f = false) : TypedFstBuilder<LSHFstHistory, LSHDiscretizer, BackoffFstBuilder>(d, t, bol)
+	{
+		bo_step = 1;
+		flip = f;
+	}
+
+	//Main method
+	virtual void convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst);
+
+};
+
+#endif
@@ -0,0 +1,39 @@
+/************************************************************************
+ * Model a discretized state in the RNN by the signs of projections.
+ *
+ ************************************************************************/
+
+#include "lsh_fsthistory.h"
+
+using namespace std;
+
+bool LSHFstHistory::lower(const FstHistory *fsth) const {
+	const LSHFstHistory *p = dynamic_cast<const LSHFstHistory *>(fsth);
+	return (p != NULL) && lower(*p);
+}
+
+bool LSHFstHistory::sameDiscretization(const FstHistory *fsth) const {
+	const LSHFstHistory *p = dynamic_cast<const LSHFstHistory *>(fsth);
+	return (p != NULL) && sameDiscretization(*p);
+}
+
+
+
+//Display: known bits as 0/1, cleared bits as '.', weak bits in upper case (bit 0 first)
+
+string LSHFstHistory::toString() const {
+	ostringstream str;
+	str << getLastWord() << " | ";
+	for (int b = 0; b < LSH_MAX_BITS && (getMask() >> b) != 0; b++) {
+		if (!((getMask() >> b) & 1)) {
+			str << '.';
+		}
+		else if ((weak >> b) & 1) {
+			str << (((getBits() >> b) & 1) ? 'I' : 'O');
+		}
+		else {
+			str << (((getBits() >> b) & 1) ? '1' : '0');
+		}
+	}
+	return str.str();
+}
@@ -0,0 +1,85 @@
+/************************************************************************
+ * Model a discretized state in the RNN by the signs of B random (or
+ * learned) projections of the hidden layer, B <= 32.
+ *
+ *  N neurons  <----->  bit 1 | bit 2 | ... | bit B
+ *
+ * A state is a single 64-bit word: the mask of the known bits in the high
+ * half and their values in the low half. Backoff states clear bits. The
+ * bits which were close to their threshold when the state was discretized
+ * are kept as a hint for the backoff (they do not identify the state).
+ *
+ ************************************************************************/
+
+#ifndef _LSH_FSTHISTORY_H_
+#define _LSH_FSTHISTORY_H_
+
+#include <stdint.h>
+#include "abstract_fsthistory.h"
+
+typedef uint64_t lsh_key;
+typedef uint32_t lsh_bits;
+
+#define LSH_MAX_BITS 32
+
+class LSHFstHistory : public FstHistory
+{
+	protected:
+	lsh_key discretized;
+	lsh_bits weak;
+
+	public:
+
+	LSHFstHistory() : FstHistory()
+	{
+		discretized = 0;
+		weak = 0;
+	}
+
+	LSHFstHistory(const LSHFstHistory &fsth) : FstHistory(fsth)
+	{
+		discretized = fsth.getDiscretized();
+		weak = fsth.getWeakBits();
+	}
+
+	//Getters / Setters
+	lsh_key getDiscretized() const { return discretized; }
+	lsh_bits getBits() const { return (lsh_bits) discretized; }
+	lsh_bits getMask() const { return (lsh_bits) (discretized >> 32); }
+	lsh_bits getWeakBits() const { return weak; }
+	void setDiscretized(lsh_bits bits, lsh_bits mask, lsh_bits w = 0)
+	{
+		discretized = ((lsh_key) mask << 32) | (bits & mask);
+		weak = w & mask;
+	}
+	//clears the bits of m
+	void clearBits(lsh_bits m) { setDiscretized(getBits() & ~m, getMask() & ~m, weak & ~m); }
+	//flips the known bits of m
+	void flipBits(lsh_bits m) { setDiscretized(getBits() ^ m, getMask(), weak & ~m); }
+
+	// Comparisons with a history of the same type (the weak bits are only a hint)
+	bool lower(const LSHFstHistory &other) const
+	{
+		if (getLastWord() != other.getLastWord())
+		{
+			return getLastWord() < other.getLastWord();
+		}
+		return getDiscretized() < other.getDiscretized();
+	}
+	bool sameDiscretization(const LSHFstHistory &other) const { return getDiscretized() == other.getDiscretized(); }
+	//last word, then mask and bits (the weak bits are not part of the state)
+	void packKey(vector<uint64_t> &key) const
+	{
+		key.resize(2);
+		key[0] = (uint64_t) (uint32_t) getLastWord();
+		key[1] = getDiscretized();
+	}
+
+	// Interface methods
+	virtual bool lower(const FstHistory *other) const;
+	virtual bool sameDiscretization(const FstHistory *fsth) const;
+	string toString() const;
+
+};
+
+#endif
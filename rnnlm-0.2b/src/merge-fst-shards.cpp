@@ -0,0 +1,128 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Merges the shard files written by rnn2fst -shards <N> -no-merge into
+// a single FST, identical to the FST of an unsharded conversion
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include "fst_shards.h"
+
+using namespace std;
+using namespace fst;
+
+
+#define MAX_STRING 200
+
+
+
+
+
+
+/****************************************************************************
+                                 MAIN
+*****************************************************************************/
+
+
+int argPos(char *str, int argc, char **argv)
+{
+    int a;
+
+    for (a=1; a<argc; a++) if (!strcmp(str, argv[a])) return a;
+
+    return -1;
+}
+
+int main(int argc, char **argv)
+{
+
+    int i;
+
+    int fst_file_set=0;
+    int n_shards=0;
+    int n_threads=1;
+    bool keep_shards=false;
+    char fst_file[MAX_STRING];
+
+
+    if (argc==1) {
+    	printf("Merges the shards of a conversion run with rnn2fst -shards <N> -no-merge\n\n");
+
+    	printf("Syntax:\n");
+		printf("\tmerge-fst-shards -fst <fst_output> -shards <N>\n");
+    	printf("\t            Reads <fst_output>.shard0..N-1 and writes <fst_output>.\n");
+		printf("\t        [-threads <N>]\n");
+    	printf("\t            Compute the backoff weights with N threads.\n");
+		printf("\t        [-keep-shards]\n");
+    	printf("\t            Do not remove the shard files once merged.\n");
+
+    	return 0;	//***
+    }
+
+
+    i=argPos((char *)"-fst", argc, argv);
+    if (i>0) {
+        if (i+1==argc) {
+            printf("ERROR: FST file not specified!\n");
+            return 0;
+        }
+
+        strcpy(fst_file, argv[i+1]);
+        fst_file_set=1;
+    }
+
+    i=argPos((char *)"-shards", argc, argv);
+    if (i>0) {
+        if (i+1==argc) {
+            printf("ERROR: number of shards not specified!\n");
+            return 0;
+        }
+
+        n_shards=atoi(argv[i+1]);
+    }
+
+    i=argPos((char *)"-threads", argc, argv);
+    if (i>0) {
+        if (i+1==argc) {
+            printf("ERROR: number of threads not specified!\n");
+            return 0;
+        }
+
+        n_threads=atoi(argv[i+1]);
+    }
+
+    i=argPos((char *)"-keep-shards", argc, argv);
+    if (i>0) {
+    keep_shards = true;
+    }
+
+    if (!fst_file_set) {
+        printf("ERROR: FST file not specified!\n");
+        return 0;
+    }
+    if (n_shards<1) {
+        printf("ERROR: invalid number of shards!\n");
+        return 0;
+    }
+
+
+	VectorFst<LogArc> fst;
+	fst.SetProperties(kILabelSorted, true);
+	if (!mergeFstShards(string(fst_file), n_shards, fst, n_threads))
+    {
+		return 1;
+	}
+	fst.Write(fst_file);
+	if (!keep_shards)
+    {
+		for (i=0; i<n_shards; i++)
+        {
+			remove(getShardFileName(string(fst_file), i).c_str());
+		}
+	}
+
+	return 0;
+}
@@ -11,47 +11,44 @@
 #include "neuron_fsthistory.h"
 #include <iostream>
 #include <sstream>
+#include <limits>
 
 using namespace std;
 
-NeuronDiscretizer::NeuronDiscretizer(int dims, int bins_per_dim) {
-	values = new real*[dims];
-	bounds = new real*[dims];
+void NeuronDiscretizer::allocate(int dims, int bins_per_dim) {
 	n_dims = dims;
 	n_bins = bins_per_dim;
+	bound_stride = 1;
+	while (bound_stride < n_bins) {
+		bound_stride <<= 1;
+	}
+	values = new real*[dims];
+	bounds = new real[(size_t) dims*bound_stride];
 	for (int i=0; i < dims; i++) {
 		values[i] = new real[bins_per_dim];
-		bounds[i] = new real[bins_per_dim-1];
+	}
+	for (size_t j=0; j < (size_t) dims*bound_stride; j++) {
+		bounds[j] = numeric_limits<real>::max();
 	}
 }
 
+NeuronDiscretizer::NeuronDiscretizer(int dims, int bins_per_dim) {
+	allocate(dims, bins_per_dim);
+}
+
 NeuronDiscretizer::NeuronDiscretizer(int dims, int bins_per_dim, string fn) {
-	values = new real*[dims];
-	bounds = new real*[dims];
-	n_dims = dims;
-	n_bins = bins_per_dim;
-	for (int i=0; i < dims; i++) {
-		values[i] = new real[bins_per_dim];
-		bounds[i] = new real[bins_per_dim-1];
-	}
+	allocate(dims, bins_per_dim);
 	load(fn);
 }
 
 NeuronDiscretizer::NeuronDiscretizer(const NeuronDiscretizer &dzer) {
-	n_dims = dzer.n_dims;
-	n_bins = dzer.n_bins;
-	values = new real*[n_dims];
-	bounds = new real*[n_dims];
-	for (int i=0; i < dzer.n_dims; i++) {
-		values[i] = new real[n_bins];
-		bounds[i] = new real[n_bins-1];
-		for (int j=0; i < dzer.n_bins; j++) {
+	allocate(dzer.n_dims, dzer.n_bins);
+	for (int i=0; i < n_dims; i++) {
+		for (int j=0; j < n_bins; j++) {
 			values[i][j] = dzer.values[i][j];
 		}
-		for (int j=0; i < dzer.n_bins-1; j++) {
-			bounds[i][j] = dzer.bounds[i][j];
-		}
 	}
+	memcpy(bounds, dzer.bounds, (size_t) n_dims*bound_stride*sizeof(real));
 }
 
 // NeuronDiscretizer::~Discretizer() {
@@ -62,30 +59,47 @@ NeuronDiscretizer::NeuronDiscretizer(const NeuronDiscretizer &dzer) {
 
 // Implement virtual pure methods
 
-void NeuronDiscretizer::discretize(FstHistory* const fsth, const struct neuron* layer) const {
+void NeuronDiscretizer::discretize(NeuronFstHistory &h, const struct neuron * const layer) const {
+	for (int i = 0; i < h.getNumDims(); i++) {
+		h.setDim(i,getBin(i,layer[i].ac));
+	}
+}
+
+
+
+void NeuronDiscretizer::discretize(FstHistory* const fsth, const struct neuron * const layer) const {
 	NeuronFstHistory *p = dynamic_cast<NeuronFstHistory *>(fsth);
 	if (p != NULL) {
-		for (int i = 0; i < p->getNumDims(); i++) {
-			int bin = 0;
-			for (bin = 0; bin < n_bins-1; bin++) {
-				if (layer[i].ac < bounds[i][bin]) {
-					break;
-				}
-			}
-			p->setDim(i,bin);
-		}
+		discretize(*p, layer);
 	}
 }
 
 
 
+void NeuronDiscretizer::discretizeBatch(int * const ids, const real * const x, int n, int ld) const {
+	for (int r = 0; r < n; r++) {
+		const real *v = x+(size_t) r*ld;
+		int *code = ids+(size_t) r*n_dims;
+		for (int i = 0; i < n_dims; i++) {
+			code[i] = getBin(i,v[i]);
+		}
+	}
+}
+
+
 	
-void NeuronDiscretizer::undiscretize(struct neuron * const layer, const FstHistory *  const fsth) const {
+void NeuronDiscretizer::undiscretize(struct neuron * const layer, const NeuronFstHistory &h) const {
+	for (int i = 0; i < h.getNumDims(); i++) {
+		layer[i].ac = values[i][h.getDim(i)];
+	}
+}
+
+
+
+void NeuronDiscretizer::undiscretize(struct neuron * const layer, const FstHistory * const fsth) const {
 	const NeuronFstHistory *p = dynamic_cast<const NeuronFstHistory *>(fsth);
 	if (p != NULL) {
-		for (int i = 0; i < p->getNumDims(); i++) {
-			layer[i].ac = values[i][p->getDim(i)];
-		}
+		undiscretize(layer, *p);
 	}
 }
 
@@ -121,7 +135,7 @@ bool NeuronDiscretizer::load(string fn) {
 			else if (step == 1) { v = atof(word.c_str()); step = 2; }
 			else if (step == 2) { b = atof(word.c_str()); step = 1;
 				values[dim][i] = v;
-				bounds[dim][i] = b;
+				bounds[(size_t) dim*bound_stride+i] = b;
 				i++;
 			}
 		}
@@ -134,7 +148,7 @@ bool NeuronDiscretizer::load(string fn) {
 			values[dim][i] = values[dim-1][i];
 		}
 		for (int i=0; i < n_bins-1; i++) {
-			bounds[dim][i] = bounds[dim-1][i];
+			bounds[(size_t) dim*bound_stride+i] = bounds[(size_t) (dim-1)*bound_stride+i];
 		}
 	}
 
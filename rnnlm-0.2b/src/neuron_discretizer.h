@@ -19,12 +19,27 @@
  
 using namespace std;
  
+class NeuronFstHistory;
+
 class NeuronDiscretizer : public Discretizer {
 
 	protected:
 	real **values;
-	real **bounds;
+	real *bounds;	//n_dims x bound_stride, padded with the largest value
 	int n_bins;
+	int bound_stride;	//smallest power of 2 >= n_bins
+	
+	void allocate(int dims, int bins_per_dim);
+	
+	//Number of bounds lower or equal to v (branch-free binary search)
+	int getBin(int i, real v) const {
+		const real *b = bounds+(size_t) i*bound_stride;
+		int bin = 0;
+		for (int step = bound_stride >> 1; step > 0; step >>= 1) {
+			bin += (v >= b[bin+step-1]) ? step : 0;
+		}
+		return bin;
+	}
 	
 	public:
 	
@@ -33,7 +48,12 @@ class NeuronDiscretizer : public Discretizer {
 	NeuronDiscretizer(const NeuronDiscretizer &dzer);
 	
 	int getNumBins() { return n_bins; }
+	//same as discretize()/undiscretize() without checking the type of the history
+	void discretize(NeuronFstHistory &h, const struct neuron * const layer) const;
+	void undiscretize(struct neuron * const layer, const NeuronFstHistory &h) const;
 	void discretize(FstHistory* const fsth, const struct neuron * const layer) const;
+	int getCodeSize() const { return n_dims; }
+	void discretizeBatch(int * const ids, const real * const x, int n, int ld) const;
 	void undiscretize(struct neuron * const layer, const FstHistory * const fsth) const;
 	bool load(string fn);
 	
@@ -75,7 +75,7 @@ NeuronFstHistory NeuronFstBuilder::getBackoff(CRnnLM &rnnlm,
 				cand.setDim(i,x);
 		
 				//Compute L2 distance between the 2 conditional distributions
-				bo_cond = computeSomeConditionals(rnnlm, cand, words);
+				bo_cond = computeBackoffSomeConditionals(rnnlm, cand, words);
 				
 	//			dist = distanceL2(tronc_cur_cond, bo_cond);
 				dist = distanceKL(tronc_cur_cond, bo_cond);
@@ -227,33 +227,6 @@ void NeuronFstBuilder::computeAllBackoff(VectorFst<LogArc> &fst, map< FstIndex,s
 
 
 
-/**
- * Change destination of every edge arriving in "old_target" and replace with "new_target"
- */
-void NeuronFstBuilder::changeTargetForNode(VectorFst<LogArc> &fst,
-                         FstIndex old_target,
-                         FstIndex new_target) {
-	for (StateIterator<VectorFst<LogArc> > siter(fst); !siter.Done(); siter.Next()) {
-		StateId state = siter.Value();
-		for (MutableArcIterator<VectorFst<LogArc> > aiter(&fst, state); !aiter.Done(); aiter.Next()) {
-			const LogArc &arc = aiter.Value();
-			if (arc.nextstate == old_target) {
-				dprintf(2,"\tMove %li --[%i / %f ]--> %li \tto\t%lu\n", state, arc.ilabel, arc.weight.Value(), old_target, new_target);
-				 aiter.SetValue(LogArc(arc.ilabel, arc.olabel, arc.weight.Value(), new_target));
-			}
-		}
-	}
-}
-
-
-
-
-
-
-
-
-
-
 /**
  * Remove a FST state ID "src" from the list of predecessors of FST state ID "dest"
  */
@@ -351,77 +324,10 @@ void NeuronFstBuilder::removeStates(const VectorFst<LogArc> &old_fst, VectorFst<
 /**
  * Removes useless nodes, nodes with only a backoff output
  * and plug their input to this single output
+ * (see BackoffFstBuilder::compactBackoffNodes())
  */
 vector<FstIndex> NeuronFstBuilder::compactBackoffNodes(VectorFst<LogArc> &fst, map< FstIndex,set<FstIndex> > &pred, vector<bool> &non_bo_pred) {
-	set<FstIndex>::iterator itv;
-	set<FstIndex> v;
-	map<FstIndex,FstIndex> redir;
-	vector<FstIndex> deleted;
- 	map< FstIndex,set<FstIndex> >::iterator itm;
- 	for(itm = pred.begin(); itm != pred.end(); ++itm) {
-		MutableArcIterator<VectorFst<LogArc> > bo_node(&fst, itm->first);
-		v = itm->second;
-		for (itv = v.begin(); itv != v.end(); ++itv) {
-		//if only one output (the backoff edge)
-			if (fst.NumArcs(*itv) == 1) {
-				//cout << "REDIR " << *itv << " TO " << itm->first << endl;
-				if (*itv != itm->first) {
-					redir[*itv] = itm->first;
-				}
-				dprintf(2,"DIRECT REDIR %li TO %li\n", *itv, itm->first);
-			}
-		}
-	}
-	
-
-	FstIndex source;
-	FstIndex target;
-	map<FstIndex,FstIndex>::iterator transitivity;	
-	for (map<FstIndex,FstIndex>::iterator it_redir = redir.begin(); it_redir != redir.end(); ++it_redir) {
-		source = it_redir->first;
-		//try to find the final target, eg, target(a) = c whem a->b and b->c
-		target = it_redir->second;
-		transitivity = redir.find(target);
-		while (transitivity != redir.end()) {
-			target = transitivity->second;
-			transitivity = redir.find(target);
-		}
-		if (target == source) { continue; }
-		
-		dprintf(1,"REDIR %li TO %li\n", source, target);
-		
-		//change FST
-		changeTargetForNode(fst, source, target);
-		deleted.push_back(source); //mark as "to be deleted"
-		if (source == INIT_STATE) {
-			fst.SetStart(target);
-		}
-		//change map of backoffs
-		for (set<FstIndex>::iterator it = pred[source].begin();
-		     it != pred[source].end();
-		     ++it) {
-		    map<FstIndex,FstIndex>::iterator it_find = redir.find(*it);
-		    if (it_find == redir.end()) {
-		    	dprintf(2,"\tAdd %li to bo list of %li\n", *it, target);
-				pred[target].insert(*it);
-			}
-		}
-		for (set<FstIndex>::iterator it = pred[target].begin();
-		     it != pred[target].end();
-		     ++it) {
-		    if (*it == source) {
-		    	dprintf(2,"\tRemove %li from bo list of %li\n", source, target);
-				pred[target].erase(it);
-			}
-		}
-		pred.erase(source);
-		
-	}
-		printf("End of compaction\n");
-
-//	fst.DeleteStates(deleted);
-	return deleted;
-	
+	return BackoffFstBuilder::compactBackoffNodes(fst, pred, non_bo_pred);
 }
 
 
@@ -448,7 +354,7 @@ vector<FstIndex> NeuronFstBuilder::compactBackoffNodes(VectorFst<LogArc> &fst, m
  * Create an FST based on an RNN
  */
 void NeuronFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
-	queue<NeuronFstHistory> q;
+	queue<FstIndex> q;
 	VectorFst<LogArc> new_fst;
 	
 	NeuronFstHistory fsth(rnnlm.getHiddenLayerSize(),getNumBins());
@@ -488,16 +394,17 @@ void NeuronFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
 	int v = rnnlm.getVocabSize();
 	int w = 0;
 
+	initDistributionCache(rnnlm);
 
 	// Initialize
 	rnnlm.copyHiddenLayerToInput();
 //	printNeurons(rnnlm.getInputLayer(),0,10);
 
 	// Initial state ( 0 | hidden layer after </s>)
-	fsth.setFstHistory(rnnlm, *dzer);
+	setFstHistory(fsth, rnnlm);
 	fsth.setLastWord(0);
-	q.push(fsth);
-	addFstState(id, new NeuronFstHistory(fsth), fst);
+	addFstState(id, fsth, fst);
+	q.push(id);
 	fst.SetStart(INIT_STATE);
  	/*posterior.at(INIT_STATE) = MY_LOG_ONE;*/
 
@@ -514,7 +421,7 @@ void NeuronFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
 	
 
 	// Final state (don't care about the associated discrete representation)
-	fst.AddState();
+	addFstFinalState(fsth, fst);
 	fst.SetFinal(FINAL_STATE, LogWeight::One());
 
 	
@@ -541,10 +448,10 @@ void NeuronFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
 	
 	//foreach state in the queue
 	while (!q.empty()) {
-		fsth = q.front();
+		id = q.front();
 		q.pop();
-		id = h2state[&fsth];
-		state2h.push_back(new NeuronFstHistory(fsth));
+		fsth = getFstHistory(id);
+		state2h.push_back(&getFstHistory(id));
 		if (id == FINAL_STATE) { continue; }
 		
 		
@@ -600,7 +507,7 @@ void NeuronFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
 
 
 		//Set a part of the new FST history
-		new_fsth.setFstHistory(rnnlm,*dzer);
+		setFstHistory(new_fsth, rnnlm);
 
 		//if at least one word is backing off
 		if (backoff) {
@@ -617,13 +524,13 @@ void NeuronFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
 			
 			if (bo_fsth == fsth) {
 				printf("YEAH THE SAME %i\n", (int) set_min_backoff.size());
-				q.push(fsth);
+				q.push(id);
 				continue;
 			}
 			else { printf("DIFFERENT\n"); }
 			
-			if (addFstState(new_id, new NeuronFstHistory(bo_fsth), fst)) {
-				q.push(bo_fsth);
+			if (addFstState(new_id, bo_fsth, fst)) {
+				q.push(new_id);
 				try { non_bo_pred.at(new_id) = false; }
 				catch (exception e) {
 					non_bo_pred.resize(new_id+(int) (non_bo_pred.size()*0.5)+1);
@@ -656,8 +563,8 @@ void NeuronFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
 	
 				//if sw not in the memory
 				//then add a new state for sw in the FST and push sw in the queue
-				if (addFstState(new_id, new NeuronFstHistory(new_fsth), fst)) {
-					q.push(new_fsth);
+				if (addFstState(new_id, new_fsth, fst)) {
+					q.push(new_id);
 					try { non_bo_pred.at(new_id) = true; }
 					catch (exception e) {
 						non_bo_pred.resize(new_id+(int) (non_bo_pred.size()*0.5)+1);
@@ -694,6 +601,7 @@ void NeuronFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
 	}
 
 	cout << endl;
+	dist_cache.printStats(stdout);
 	
 	//compute backoff weights
 	deleted = compactBackoffNodes(fst, pred, non_bo_pred);
@@ -17,7 +17,8 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <fst/fstlib.h>
-#include "abstract_fstbuilder.h"
+#include "typed_fstbuilder.h"
+#include "backoff_fstbuilder.h"
 #include "neuron_discretizer.h"
 #include "neuron_fsthistory.h"
 //#include "backoffstrategy.h"
@@ -28,13 +29,11 @@ using namespace fst;
 
 typedef std::pair<real, int> dist_dim_pair;
 
-class NeuronFstBuilder : public FstBuilder {
+class NeuronFstBuilder : public TypedFstBuilder<NeuronFstHistory, NeuronDiscretizer> {
 	
 	protected:
 	
 	int num_bins;
-	int max_backoff_path;
-	real pruning_threshold;
 
 	//Can be overloaded using inheritance
 	virtual NeuronFstHistory getBackoff(CRnnLM &rnnlm,
@@ -49,19 +48,18 @@ class NeuronFstBuilder : public FstBuilder {
 	void computeAllBackoff(VectorFst<LogArc> &fst, map< FstIndex,set<FstIndex> > &pred);
 
 	//Computation of backoff nodes
-	void changeTargetForNode(VectorFst<LogArc> &fst, FstIndex old_target, FstIndex new_target);
 	void removePred(map< FstIndex,vector<FstIndex> > &pred, FstIndex dest, FstIndex src);
 	void removeStates(const VectorFst<LogArc> &old_fst, VectorFst<LogArc> &new_fst, vector<FstIndex> &to_be_deleted);	
 	vector<FstIndex> compactBackoffNodes(VectorFst<LogArc> &fst, map< FstIndex,set<FstIndex> > &pred, vector<bool> &non_bo_pred);
 	
 	public:
-	NeuronFstBuilder(NeuronDiscretizer* d) : FstBuilder(d) {
+	NeuronFstBuilder(NeuronDiscretizer* d) : TypedFstBuilder<NeuronFstHistory, NeuronDiscretizer>(d) {
 		num_bins = d->getNumBins();
 		max_backoff_path=2;
 		pruning_threshold=0.01;
 	}
 	
-	NeuronFstBuilder(NeuronDiscretizer* d, real t, int bol) : FstBuilder(d) {
+	NeuronFstBuilder(NeuronDiscretizer* d, real t, int bol) : TypedFstBuilder<NeuronFstHistory, NeuronDiscretizer>(d) {
 		num_bins = d->getNumBins();
 		pruning_threshold=t;
 		max_backoff_path=bol;
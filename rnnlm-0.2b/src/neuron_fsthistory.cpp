@@ -21,8 +21,19 @@ using namespace std;
 
 bool NeuronFstHistory::sameDiscretization(const FstHistory *fsth) const {
 	const NeuronFstHistory *p = dynamic_cast<const NeuronFstHistory *>(fsth);
-	return (p != NULL) && (this->discretized == p->discretized);
-} 
+	return (p != NULL) && sameDiscretization(*p);
+}
+
+
+
+size_t NeuronFstHistory::hash() const {
+	uint64_t h = (uint64_t) (unsigned int) getLastWord() * 0x9e3779b97f4a7c15ULL;
+	for (int w = 0; w < n_words; w++) {
+		h = (h ^ discretized[w]) * 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+	return (size_t) h;
+}
  
 
 
@@ -43,21 +54,5 @@ string NeuronFstHistory::toString() const {
 
 bool NeuronFstHistory::lower(const FstHistory *fsth) const {
 	const NeuronFstHistory *p = dynamic_cast<const NeuronFstHistory *>(fsth);
-	if (p != NULL) {
-		if (getNumDims() != p->getNumDims()) {
-			return getNumDims() < p->getNumDims();
-		}
-		if (getNumBins() !=  p->getNumBins()) {
-			return getNumBins() <  p->getNumBins();;
-		}
-		if (getLastWord() !=  p->getLastWord()) {
-			return getLastWord() <  p->getLastWord();;
-		}
-		for (int i = 0 ; i < getNumDims(); i++) {
-			if (getDim(i) !=  p->getDim(i)) {
-				return getDim(i) <  p->getDim(i);
-			}
-		}
-	}
-	return false;
+	return (p != NULL) && lower(*p);
 }
@@ -13,6 +13,11 @@
  * <-2bits->
  *    => each dim in [0,2^n_bits-1]
  *
+ * Dims are packed in 64-bit words, the first dim in the most significant
+ * bits of the first word (a dim never straddles two words), so that
+ * comparing the words as unsigned integers orders histories as comparing
+ * their dims one by one.
+ *
  ************************************************************************/
 
 #ifndef _NEURON_FSTHISTORY_H_
@@ -20,7 +25,7 @@
  
  
 #include "abstract_fsthistory.h"
-#include <boost/dynamic_bitset.hpp>
+#include <stdint.h>
 
 
 //Maximum is 1 dim = 2^8 bins (1 byte)
@@ -28,6 +33,11 @@
 #define VALUE_A 0.1
 #define VALUE_OTHER 0.6
 
+//Maximum number of 64-bit words of a discretized state
+#ifndef NEURON_MAX_WORDS
+#define NEURON_MAX_WORDS 16
+#endif
+
 
 using namespace std;
 
@@ -35,10 +45,13 @@ using namespace std;
 class NeuronFstHistory : public FstHistory {
 
 	protected:
-	boost::dynamic_bitset<> discretized;
+	uint64_t discretized[NEURON_MAX_WORDS];
 	int n_dims;
 	int n_bins;
 	int bits_per_dim;
+	int dims_per_word;
+	int n_words;
+	uint64_t dim_mask;
 	
 	public:
 
@@ -46,16 +59,27 @@ class NeuronFstHistory : public FstHistory {
 	NeuronFstHistory(int dims, int bins_per_dim) : FstHistory() {
  		n_dims = dims;
  		n_bins = bins_per_dim;
- 		bits_per_dim = (int) (log2(bins_per_dim)+0.5);
- 		discretized = boost::dynamic_bitset<>(n_dims*bits_per_dim);
+ 		bits_per_dim = 1;
+ 		while ((1 << bits_per_dim) < n_bins) { bits_per_dim++; }
+ 		dims_per_word = 64 / bits_per_dim;
+ 		n_words = (n_dims + dims_per_word - 1) / dims_per_word;
+ 		dim_mask = ((uint64_t) 1 << bits_per_dim) - 1;
+ 		if (n_words > NEURON_MAX_WORDS) {
+ 			fprintf(stderr, "ERROR: %i dims of %i bins need %i words (at most %i, see NEURON_MAX_WORDS)\n", n_dims, n_bins, n_words, NEURON_MAX_WORDS);
+ 			exit(1);
+ 		}
+ 		memset(discretized, 0, sizeof(discretized));
 	}
 	
 	// Copy constructor
 	NeuronFstHistory(const NeuronFstHistory &fsth) : FstHistory(fsth) {
- 		n_dims = fsth.getNumDims();
- 		n_bins = fsth.getNumBins();
- 		bits_per_dim = fsth.getDimSize();
- 		discretized = boost::dynamic_bitset<>(fsth.discretized);
+ 		n_dims = fsth.n_dims;
+ 		n_bins = fsth.n_bins;
+ 		bits_per_dim = fsth.bits_per_dim;
+ 		dims_per_word = fsth.dims_per_word;
+ 		n_words = fsth.n_words;
+ 		dim_mask = fsth.dim_mask;
+ 		memcpy(discretized, fsth.discretized, n_words*sizeof(uint64_t));
 	}
 	
 	
@@ -63,17 +87,15 @@ class NeuronFstHistory : public FstHistory {
 	int getNumDims() const { return n_dims; }
 	int getNumBins() const { return n_bins; }
 	int getDimSize() const { return bits_per_dim; }
+	int getNumWords() const { return n_words; }
+	uint64_t getWord(int w) const { return discretized[w]; }
 
 	
 	// First dim is 0
 	int getDim(int i) const {
-		int dimi = 0;
-		int index = i*bits_per_dim;
-		for (int b = index; b < index+bits_per_dim; b++) {
-			dimi |= discretized[b];
-			if (b+1 < index+bits_per_dim) { dimi = dimi << 1; } //shift left
-		}
-		return dimi;
+		int w = i / dims_per_word;
+		int shift = 64 - (i - w*dims_per_word + 1)*bits_per_dim;
+		return (int) ((discretized[w] >> shift) & dim_mask);
 	}
 	
 	
@@ -87,19 +109,57 @@ class NeuronFstHistory : public FstHistory {
 	}
 	
 	
+	// Comparisons with a history of the same type
+	bool sameDiscretization(const NeuronFstHistory &other) const {
+		if ((n_dims != other.n_dims) || (n_bins != other.n_bins)) {
+			return false;
+		}
+		for (int w = 0; w < n_words; w++) {
+			if (discretized[w] != other.discretized[w]) {
+				return false;
+			}
+		}
+		return true;
+	}
+	bool lower(const NeuronFstHistory &other) const {
+		if (n_dims != other.n_dims) {
+			return n_dims < other.n_dims;
+		}
+		if (n_bins != other.n_bins) {
+			return n_bins < other.n_bins;
+		}
+		if (getLastWord() != other.getLastWord()) {
+			return getLastWord() < other.getLastWord();
+		}
+		for (int w = 0; w < n_words; w++) {
+			if (discretized[w] != other.discretized[w]) {
+				return discretized[w] < other.discretized[w];
+			}
+		}
+		return false;
+	}
+	
+	//last word and number of dims, number of bins, then the packed bins
+	void packKey(vector<uint64_t> &key) const {
+		key.resize(2+n_words);
+		key[0] = ((uint64_t) (uint32_t) getLastWord() << 32) | (uint32_t) n_dims;
+		key[1] = (uint64_t) n_bins;
+		for (int w = 0; w < n_words; w++) {
+			key[2+w] = discretized[w];
+		}
+	}
+	
 	bool sameDiscretization(const FstHistory *fsth) const;
 	bool lower(const FstHistory *fsth) const;
+	//Hash of the last word and the discretized dims
+	size_t hash() const;
 	
 	//Setters
 	// First dim is 0
 	void setDim(int i, int v) {
-		int index = i*bits_per_dim;
-		int bit = 0;
-		for (int b = index+bits_per_dim-1; b >= index; b--) {
-			bit = v & 1; //get the 1st (right most) bit
-			discretized[b] = bit; //store
-			v = v >> 1; //shift right
-		}
+		int w = i / dims_per_word;
+		int shift = 64 - (i - w*dims_per_word + 1)*bits_per_dim;
+		discretized[w] = (discretized[w] & ~(dim_mask << shift)) | (((uint64_t) v & dim_mask) << shift);
 	}
 	
 	string toString() const;
@@ -107,5 +167,4 @@ class NeuronFstHistory : public FstHistory {
 };
 
 
-
 #endif
@@ -0,0 +1,106 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Wall-clock counters for the main phases of the RNN LM
+//
+///////////////////////////////////////////////////////////////////////
+
+#include "perf_counters.h"
+
+static const char *PERF_WORD_SET_NAMES[PERF_NUM_WORD_SETS]={"train", "valid", "test", "other"};
+static const char *PERF_PHASE_NAMES[PERF_NUM_PHASES]={"tokenize", "hidden", "class_softmax", "word_softmax", "maxent", "backprop", "bptt", "checkpoint_io"};
+
+PerfCounters::PerfCounters()
+{
+    mode=PERF_OFF;
+    reset();
+}
+
+void PerfCounters::reset()
+{
+    int a;
+
+    for (a=0; a<PERF_NUM_PHASES; a++)
+    {
+        total[a]=0;
+        calls[a]=0;
+    }
+    for (a=0; a<PERF_NUM_WORD_SETS; a++)
+    {
+        words[a]=0;
+        word_time[a]=0;
+    }
+    start_time=now();
+    word_set=PERF_WORDS_OTHER;
+    word_set_start=start_time;
+}
+
+void PerfCounters::setWordSet(int set)
+{
+    double t=now();
+
+    word_time[word_set]+=t-word_set_start;
+    word_set=set;
+    word_set_start=t;
+}
+
+double PerfCounters::getWordTime(int set) const
+{
+    return getWordTime(set, now());
+}
+
+double PerfCounters::getWordTime(int set, double t) const
+{
+    if (set==word_set) return word_time[set]+t-word_set_start;
+    return word_time[set];
+}
+
+const char *PerfCounters::getPhaseName(int phase)
+{
+    return PERF_PHASE_NAMES[phase];
+}
+
+void PerfCounters::print(FILE *fo, const char *label) const
+{
+    int a;
+    int n;
+    double t_now=now();
+    double elapsed=t_now-start_time;
+    double t, wps;
+
+    if (mode==PERF_OFF) return;
+
+    if (mode==PERF_JSON)
+    {
+        fprintf(fo, "{\"label\": \"%s\", \"seconds\": %.6f, \"words\": {", label, elapsed);
+        for (a=0, n=0; a<PERF_NUM_WORD_SETS; a++)
+        {
+            if ((a==PERF_WORDS_OTHER) || (words[a]==0)) continue;
+            t=getWordTime(a, t_now);
+            wps=(t>0) ? words[a]/t : 0;
+            fprintf(fo, "%s\"%s\": {\"count\": %lld, \"seconds\": %.6f, \"words_per_sec\": %.1f}", n++>0 ? ", " : "", PERF_WORD_SET_NAMES[a], words[a], t, wps);
+        }
+        fprintf(fo, "}, \"phases\": {");
+        for (a=0; a<PERF_NUM_PHASES; a++)
+        {
+            fprintf(fo, "%s\"%s\": {\"seconds\": %.6f, \"calls\": %lld}", a>0 ? ", " : "", PERF_PHASE_NAMES[a], total[a], calls[a]);
+        }
+        fprintf(fo, "}}\n");
+    }
+    else
+    {
+        fprintf(fo, "Performance counters (%s): %.3f s\n", label, elapsed);
+        for (a=0; a<PERF_NUM_WORD_SETS; a++)
+        {
+            if ((a==PERF_WORDS_OTHER) || (words[a]==0)) continue;
+            t=getWordTime(a, t_now);
+            wps=(t>0) ? words[a]/t : 0;
+            fprintf(fo, "  %-14s %10lld words in %.3f s, %.1f words/sec\n", PERF_WORD_SET_NAMES[a], words[a], t, wps);
+        }
+        for (a=0; a<PERF_NUM_PHASES; a++)
+        {
+            if (calls[a]==0) continue;
+            fprintf(fo, "  %-14s %10.3f s  %5.1f%%  %12lld calls  %9.3f us/call\n", PERF_PHASE_NAMES[a], total[a], elapsed>0 ? 100*total[a]/elapsed : 0.0, calls[a], 1e6*total[a]/calls[a]);
+        }
+    }
+    fflush(fo);
+}
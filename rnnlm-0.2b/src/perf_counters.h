@@ -0,0 +1,111 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Wall-clock counters for the main phases of the RNN LM
+// (tokenization, forward pass, learning, checkpoint I/O)
+//
+///////////////////////////////////////////////////////////////////////
+
+#ifndef _PERF_COUNTERS_H_
+#define _PERF_COUNTERS_H_
+
+#include <stdio.h>
+#include <time.h>
+
+//phases which are timed separately
+enum PerfPhase
+{
+    PERF_TOKENIZE,      //reading words and vocabulary lookup
+    PERF_HIDDEN,        //input->hidden propagation (+ compression layer)
+    PERF_CLASS,         //hidden->class propagation and class softmax
+    PERF_WORD,          //hidden->word propagation and in-class softmax
+    PERF_MAXENT,        //direct connections (forward and update)
+    PERF_BACKPROP,      //output layer errors and weight updates
+    PERF_BPTT,          //error propagation to the input / through time
+    PERF_IO,            //saveNet / restoreNet
+    PERF_NUM_PHASES
+};
+
+//sets of words whose speed is reported separately
+enum PerfWordSet
+{
+    PERF_WORDS_TRAIN,
+    PERF_WORDS_VALID,
+    PERF_WORDS_TEST,
+    PERF_WORDS_OTHER,   //time outside of the word loops (never reported)
+    PERF_NUM_WORD_SETS
+};
+
+//output of the summary: nothing, human readable text, or one JSON object per line
+enum PerfMode {PERF_OFF, PERF_TEXT, PERF_JSON};
+
+class PerfCounters
+{
+protected:
+    int mode;
+    double total[PERF_NUM_PHASES];
+    long long calls[PERF_NUM_PHASES];
+    long long words[PERF_NUM_WORD_SETS];
+    double word_time[PERF_NUM_WORD_SETS];   //time spent on each set, except the current one
+    int word_set;                           //set of the words being processed
+    double word_set_start;
+    double start_time;
+
+public:
+    PerfCounters();
+
+    //monotonic wall-clock time in seconds
+    static double now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec+ts.tv_nsec*1e-9;
+    }
+
+    void setMode(int newMode) {mode=newMode;}
+    int getMode() const {return mode;}
+    bool enabled() const {return mode!=PERF_OFF;}
+
+    //clears all counters and restarts the wall clock (outside of any word set)
+    void reset();
+
+    //usage: double t=perf.start(); ... t=perf.stop(PERF_xxx, t); ...
+    //stop() counts one call of the phase and returns the current time, so that
+    //consecutive phases can be chained; lap() does the same without counting a call
+    //(for phases which are interrupted by another one)
+    double start() const
+    {
+        if (mode==PERF_OFF) return 0;
+        return now();
+    }
+    double lap(int phase, double t)
+    {
+        double t2;
+
+        if (mode==PERF_OFF) return 0;
+        t2=now();
+        total[phase]+=t2-t;
+        return t2;
+    }
+    double stop(int phase, double t)
+    {
+        if (mode==PERF_OFF) return 0;
+        calls[phase]++;
+        return lap(phase, t);
+    }
+
+    //the following words (and the time until the next call) belong to the given set
+    void setWordSet(int set);
+    void addWords(long long n) {words[word_set]+=n;}
+    long long getWords(int set) const {return words[set];}
+    double getWordTime(int set) const;
+    double getWordTime(int set, double t) const;   //at time t
+    double getTime(int phase) const {return total[phase];}
+    double getElapsed() const {return now()-start_time;}
+
+    static const char *getPhaseName(int phase);
+
+    //prints the summary (text or JSON, depending on the mode)
+    void print(FILE *fo, const char *label) const;
+};
+
+#endif
@@ -0,0 +1,254 @@
+/************************************************************************
+ * Associate a RNN state to a product quantization code and, vice-versa,
+ * restore a RNN state by concatenating the codewords of a code.
+ *
+ ***********************************************************************/
+
+#include "pq_discretizer.h"
+#include <iostream>
+#include <sstream>
+#include <alloca.h>
+
+#define mylog(x) -log(x)
+
+using namespace std;
+
+PQDiscretizer::PQDiscretizer(int dims)
+{
+	n_dims = dims;
+	n_sub = 0;
+}
+
+PQDiscretizer::PQDiscretizer(int dims, string fn)
+{
+	n_dims = dims;
+	n_sub = 0;
+	if (!load(fn))
+	{
+		fprintf(stderr, "ERROR: cannot load codebooks from %s\n", fn.c_str());
+		exit(1);
+	}
+}
+
+
+
+/**
+ * Computes the bit positions of the codes in a key and the means used
+ * for the sub-spaces which are backed off
+ */
+void PQDiscretizer::layout()
+{
+	shift.assign(n_sub+1, 0);
+	for (int m = 0; m < n_sub; m++)
+	{
+		int width = 0;
+		while (((pq_key) 1 << width) < (pq_key) n_codes[m])
+		{
+			width++;
+		}
+		if ((shift[m] >= 64) || (shift[m]+width > 64))
+		{
+			fprintf(stderr, "ERROR: the codes of %i sub-spaces do not fit in 64 bits\n", n_sub);
+			exit(1);
+		}
+		shift[m+1] = shift[m]+width;
+	}
+
+	//prior-weighted mean of the codewords of each sub-space
+	sub_mean.assign(n_dims, 0.0);
+	for (int m = 0; m < n_sub; m++)
+	{
+		real sum = 0.0;
+		for (int k = 0; k < n_codes[m]; k++)
+		{
+			real p = exp(-getPrior(m, k));
+			const real *c = getCodeword(m, k);
+			for (int i = 0; i < getSubspaceDims(m); i++)
+			{
+				sub_mean[sub_start[m]+i] += p*c[i];
+			}
+			sum += p;
+		}
+		for (int i = sub_start[m]; (sum > 0) && (i < sub_start[m+1]); i++)
+		{
+			sub_mean[i] /= sum;
+		}
+	}
+}
+
+
+
+real PQDiscretizer::getPrior(pq_key key, int n) const
+{
+	real p = 0.0;
+	for (int m = 0; m < n; m++)
+	{
+		p += getPrior(m, getCode(key, m));
+	}
+	return p;
+}
+
+
+
+int PQDiscretizer::encode(const real * const x, int m) const
+{
+	int d = getSubspaceDims(m);
+	const real *c = &codebooks[book_start[m]];
+	int best = 0;
+	real best_dist = 1e100;
+	for (int k = 0; k < n_codes[m]; k++, c += d)
+	{
+		real dist = 0.0;
+		for (int i = 0; i < d; i++)
+		{
+			real diff = x[i]-c[i];
+			dist += diff*diff;
+		}
+		if (dist < best_dist)
+		{
+			best_dist = dist;
+			best = k;
+		}
+	}
+	return best;
+}
+
+
+
+void PQDiscretizer::discretize(PQFstHistory &h, const struct neuron * const layer) const
+{
+	real *x = (real *) alloca(n_dims*sizeof(real));
+	for (int i = 0; i < n_dims; i++)
+	{
+		x[i] = layer[i].ac;
+	}
+	pq_key key = 0;
+	for (int m = 0; m < n_sub; m++)
+	{
+		key = setCode(key, m, encode(x+sub_start[m], m));
+	}
+	h.setDiscretized(key, n_sub);
+}
+
+
+
+void PQDiscretizer::discretize(FstHistory* const fsth, const struct neuron * const layer) const
+{
+	PQFstHistory *p = dynamic_cast<PQFstHistory *>(fsth);
+	if (p != NULL)
+	{
+		discretize(*p, layer);
+	}
+}
+
+
+
+void PQDiscretizer::discretizeBatch(int * const ids, const real * const x, int n, int ld) const
+{
+	for (int r = 0; r < n; r++)
+	{
+		for (int m = 0; m < n_sub; m++)
+		{
+			ids[(size_t) r*n_sub+m] = encode(x+(size_t) r*ld+sub_start[m], m);
+		}
+	}
+}
+
+
+
+void PQDiscretizer::undiscretize(struct neuron * const layer, const PQFstHistory &h) const
+{
+	for (int m = 0; m < n_sub; m++)
+	{
+		const real *c = (m < h.getNumActive()) ? getCodeword(m, getCode(h.getDiscretized(), m)) : &sub_mean[sub_start[m]];
+		for (int i = 0; i < getSubspaceDims(m); i++)
+		{
+			layer[sub_start[m]+i].ac = c[i];
+		}
+	}
+}
+
+
+
+void PQDiscretizer::undiscretize(struct neuron * const layer, const FstHistory * const fsth) const
+{
+	const PQFstHistory *p = dynamic_cast<const PQFstHistory *>(fsth);
+	if (p != NULL)
+	{
+		undiscretize(layer, *p);
+	}
+}
+
+
+
+bool PQDiscretizer::load(string fn)
+{
+	fstream in (fn.c_str());
+	string word;
+	string line;
+
+	if ( !in )
+	  return false;
+
+	n_sub = 0;
+	sub_start.assign(1, 0);
+	n_codes.clear();
+	code_start.clear();
+	book_start.clear();
+	codebooks.clear();
+	prior.clear();
+
+	int n = 0; //number of codewords in the current sub-space
+	int d = 0; //size of the current sub-space
+	while (getline(in, line))
+	{
+		istringstream strstr(line);
+		if (!(strstr >> word)) { continue; }
+		if ((word == "--") || (word[0] == '#'))
+		{
+			if ((word == "--") && (n > 0))
+			{
+				sub_start.push_back(sub_start.back()+d);
+				n_codes.push_back(n);
+				n_sub++;
+				n = 0;
+			}
+			continue;
+		}
+		if (n == 0)
+		{
+			code_start.push_back(prior.size());
+			book_start.push_back(codebooks.size());
+		}
+		prior.push_back(mylog(atof(word.c_str())));
+		int i = 0;
+		while ((strstr >> word) && (word[0] != '#'))
+		{
+			codebooks.push_back(atof(word.c_str()));
+			i++;
+		}
+		if ((n > 0) && (i != d))
+		{
+			fprintf(stderr, "ERROR: codeword %i of sub-space %i has %i values instead of %i\n", n, n_sub, i, d);
+			return false;
+		}
+		d = i;
+		n++;
+	}
+	if (n > 0)
+	{
+		sub_start.push_back(sub_start.back()+d);
+		n_codes.push_back(n);
+		n_sub++;
+	}
+	in.close();
+
+	if (sub_start.back() != n_dims)
+	{
+		fprintf(stderr, "ERROR: the sub-spaces cover %i neurons instead of %i\n", sub_start.back(), n_dims);
+		return false;
+	}
+	layout();
+	fprintf(stderr, "%i sub-spaces, %i bits per key\n", n_sub, shift[n_sub]);
+	return true;
+}
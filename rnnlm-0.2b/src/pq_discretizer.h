@@ -0,0 +1,84 @@
+/************************************************************************
+ * Associate a RNN state to a product quantization code and, vice-versa,
+ * restore a RNN state by concatenating the codewords of a code.
+ *
+ * The hidden layer is split into M sub-spaces of consecutive neurons,
+ * each with its own codebook of K_m codewords. There are K_1 x ... x K_M
+ * possible states, while encoding and decoding only cost
+ * (K_1 + ... + K_M) x N / M operations.
+ *
+ * Format of a codebook file (as written by train-pq): the codebooks of
+ * the sub-spaces, in order, separated by "--"
+ * <prior1> <dim11> <dim12> ... <dim1D>
+ * ...
+ * <priorK> <dimK1> <dimK2> ... <dimKD>
+ * --
+ * ...
+ * The number of values of the codewords gives the size D of a sub-space.
+ * Codes are packed into a 64-bit key, ceil(log2(K_m)) bits per sub-space.
+ *
+ ***********************************************************************/
+
+#ifndef _PQ_DISCRETIZER_H_
+#define _PQ_DISCRETIZER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <vector>
+#include "abstract_discretizer.h"
+#include "pq_fsthistory.h"
+
+using namespace std;
+
+class PQDiscretizer : public Discretizer
+{
+
+	protected:
+	int n_sub;
+	vector<int> sub_start;	//first neuron of each sub-space (n_sub+1 values)
+	vector<int> n_codes;	//codebook size of each sub-space
+	vector<int> code_start;	//index of the first codeword of each sub-space
+	vector<size_t> book_start;	//index of the codebook of each sub-space in codebooks
+	vector<real> codebooks;	//codewords of all the sub-spaces, one after the other
+	vector<real> prior;	//-log prior of each codeword
+	vector<real> sub_mean;	//mean of the data, used for the backed off sub-spaces
+	vector<int> shift;	//position of the code of each sub-space in a key (n_sub+1 values)
+
+	void layout();
+
+	public:
+
+	PQDiscretizer(int dims);
+	PQDiscretizer(int dims, string fn);
+
+	int getNumSubspaces() const { return n_sub; }
+	int getSubspaceStart(int m) const { return sub_start[m]; }
+	int getSubspaceDims(int m) const { return sub_start[m+1]-sub_start[m]; }
+	int getNumCodes(int m) const { return n_codes[m]; }
+	const real *getCodeword(int m, int k) const { return &codebooks[book_start[m]+(size_t) k*getSubspaceDims(m)]; }
+	real getPrior(int m, int k) const { return prior[code_start[m]+k]; }
+	//-log prior of the first n sub-spaces of a key (sub-spaces are assumed independent)
+	real getPrior(pq_key key, int n) const;
+
+	int getCode(pq_key key, int m) const { return (int) ((key >> shift[m]) & (((pq_key) 1 << (shift[m+1]-shift[m]))-1)); }
+	pq_key setCode(pq_key key, int m, int k) const { return key | ((pq_key) k << shift[m]); }
+	//clears the codes of the sub-spaces n, n+1, ...
+	pq_key truncate(pq_key key, int n) const { return (shift[n] >= 64) ? key : key & (((pq_key) 1 << shift[n])-1); }
+
+	//closest codeword of sub-space m to the vector x (x[0] being the first neuron of the sub-space)
+	int encode(const real * const x, int m) const;
+
+	//same as discretize()/undiscretize() without checking the type of the history
+	void discretize(PQFstHistory &h, const struct neuron * const layer) const;
+	void undiscretize(struct neuron * const layer, const PQFstHistory &h) const;
+	void discretize(FstHistory* const fsth, const struct neuron* layer) const;
+	int getCodeSize() const { return n_sub; }
+	void discretizeBatch(int * const ids, const real * const x, int n, int ld) const;
+	void undiscretize(struct neuron* layer, const FstHistory* fsth) const;
+	bool load(string fn);
+
+};
+
+#endif
@@ -0,0 +1,56 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Specialization of FstBuilder for product quantization codes.
+//
+///////////////////////////////////////////////////////////////////////
+
+
+#include "pq_fstbuilder.h"
+
+
+
+/**
+ * Return the backoff FST state for a given FST state: the last bo_step
+ * sub-spaces are dropped, and the last word once no sub-space is left
+ */
+PQFstHistory PQFstBuilder::getBackoff(const PQFstHistory &fsth, FstIndex id)
+{
+	PQFstHistory bo(fsth);
+	int n = fsth.getNumActive();
+	if (n == 0) {
+		bo.setLastWord(-1);
+	}
+	else {
+		n = (n > bo_step) ? n-bo_step : 0;
+		bo.setDiscretized(typed_dzer->truncate(fsth.getDiscretized(), n), n);
+	}
+	return bo;
+}
+
+
+
+/**
+ * -log P(h,w) of a state, sub-spaces and last word being assumed independent
+ */
+real PQFstBuilder::getPosterior(CRnnLM &rnnlm, const PQFstHistory &fsth, int total_counts) const
+{
+	if (fsth.getLastWord() == -1) {
+		return 0.0;
+	}
+	return typed_dzer->getPrior(fsth.getDiscretized(), fsth.getNumActive())
+	     + mylog((float) rnnlm.getWordCount(fsth.getLastWord())/total_counts);
+}
+
+
+
+/**
+ * Create an FST based on an RNN
+ */
+void PQFstBuilder::convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst) {
+	//at most max_backoff_path backoff edges from a full code to the state without any history
+	int n_sub = typed_dzer->getNumSubspaces();
+	bo_step = (max_backoff_path > 1) ? (n_sub+max_backoff_path-2)/(max_backoff_path-1) : n_sub;
+	if (bo_step < 1) { bo_step = 1; }
+
+	convertWithBackoff(rnnlm, fst);
+}
@@ -0,0 +1,39 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Specialization of FstBuilder for product quantization codes.
+// A state backs off by dropping its last sub-spaces (replaced by the
+// mean of the sub-space), then its last word. The pruning criterion
+// and the backoff weights are the same as for hierarchical clusters.
+//
+///////////////////////////////////////////////////////////////////////
+
+#ifndef _PQ_FSTBUILDER_H_
+#define _PQ_FSTBUILDER_H_
+
+#include "typed_fstbuilder.h"
+#include "backoff_fstbuilder.h"
+#include "pq_discretizer.h"
+#include "pq_fsthistory.h"
+
+class PQFstBuilder : public TypedFstBuilder<PQFstHistory, PQDiscretizer, BackoffFstBuilder> {
+
+	protected:
+
+	int bo_step;	//number of sub-spaces dropped by a backoff edge
+
+	virtual PQFstHistory getBackoff(const PQFstHistory &fsth, FstIndex id);
+	real getPosterior(CRnnLM &rnnlm, const PQFstHistory &fsth, int total_counts) const;
+
+	public:
+
+	PQFstBuilder(PQDiscretizer* d, real t, int bol) : TypedFstBuilder<PQFstHistory, PQDiscretizer, BackoffFstBuilder>(d, t, bol)
+	{
+		bo_step = 1;
+	}
+
+	//Main method
+	virtual void convertRNN(CRnnLM & rnnlm, VectorFst<LogArc> &fst);
+
+};
+
+#endif
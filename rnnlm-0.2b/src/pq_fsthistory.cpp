@@ -0,0 +1,28 @@
+/************************************************************************
+ * Model a discretized state in the RNN by product quantization.
+ *
+ ************************************************************************/
+
+#include "pq_fsthistory.h"
+
+using namespace std;
+
+bool PQFstHistory::lower(const FstHistory *fsth) const {
+	const PQFstHistory *p = dynamic_cast<const PQFstHistory *>(fsth);
+	return (p != NULL) && lower(*p);
+}
+
+bool PQFstHistory::sameDiscretization(const FstHistory *fsth) const {
+	const PQFstHistory *p = dynamic_cast<const PQFstHistory *>(fsth);
+	return (p != NULL) && sameDiscretization(*p);
+}
+
+
+
+//Display
+
+string PQFstHistory::toString() const {
+	ostringstream str;
+	str << getLastWord() << " | " << hex << getDiscretized() << dec << " / " << getNumActive();
+	return str.str();
+}
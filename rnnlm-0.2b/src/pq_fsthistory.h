@@ -0,0 +1,83 @@
+/************************************************************************
+ * Model a discretized state in the RNN by product quantization: the
+ * hidden layer is split into M sub-spaces and each of them is replaced
+ * by the closest codeword of its own codebook.
+ *
+ *  N neurons  <----->  code in 1st sub-space | ... | code in Mth sub-space
+ *
+ * The codes are packed into a single 64-bit key (see PQDiscretizer). Only
+ * the first n_active sub-spaces are set, the other ones are backed off to
+ * the mean of their sub-space.
+ *
+ ************************************************************************/
+
+#ifndef _PQ_FSTHISTORY_H_
+#define _PQ_FSTHISTORY_H_
+
+#include <stdint.h>
+#include "abstract_fsthistory.h"
+
+typedef uint64_t pq_key;
+
+class PQFstHistory : public FstHistory
+{
+	protected:
+	pq_key discretized;
+	int n_active;
+
+	public:
+
+	PQFstHistory() : FstHistory()
+	{
+		discretized = 0;
+		n_active = 0;
+	}
+
+	PQFstHistory(const PQFstHistory &fsth) : FstHistory(fsth)
+	{
+		discretized = fsth.getDiscretized();
+		n_active = fsth.getNumActive();
+	}
+
+	//Getters / Setters
+	pq_key getDiscretized() const { return discretized; }
+	int getNumActive() const { return n_active; }
+	void setDiscretized(pq_key d, int n)
+	{
+		discretized = d;
+		n_active = n;
+	}
+
+	// Comparisons with a history of the same type
+	bool lower(const PQFstHistory &other) const
+	{
+		if (getLastWord() != other.getLastWord())
+		{
+			return getLastWord() < other.getLastWord();
+		}
+		else if (getNumActive() != other.getNumActive())
+		{
+			return getNumActive() < other.getNumActive();
+		}
+		return getDiscretized() < other.getDiscretized();
+	}
+	bool sameDiscretization(const PQFstHistory &other) const
+	{
+		return (getNumActive() == other.getNumActive()) && (getDiscretized() == other.getDiscretized());
+	}
+	//last word and number of active sub-spaces, then the codes
+	void packKey(vector<uint64_t> &key) const
+	{
+		key.resize(2);
+		key[0] = ((uint64_t) (uint32_t) getLastWord() << 32) | (uint32_t) getNumActive();
+		key[1] = getDiscretized();
+	}
+
+	// Interface methods
+	virtual bool lower(const FstHistory *other) const;
+	virtual bool sameDiscretization(const FstHistory *fsth) const;
+	string toString() const;
+
+};
+
+#endif
@@ -0,0 +1,220 @@
+/************************************************************************
+ * Policies deciding which words of a state keep their transition.
+ *
+ ***********************************************************************/
+
+#include <algorithm>
+#include "pruning_policy.h"
+
+using namespace std;
+
+//first number of words sorted by the mass policy (doubled until the mass is reached)
+#define MASS_POLICY_FIRST_SORT 64
+
+
+/**
+ * Order of the words by decreasing probability (increasing -log), the
+ * smallest id first for equal probabilities so that the selection does
+ * not depend on the sort
+ */
+struct MoreProbable {
+	const vector<real> &all_prob;
+	MoreProbable(const vector<real> &p) : all_prob(p) {}
+	bool operator() (int a, int b) const {
+		return (all_prob[a] < all_prob[b]) || ((all_prob[a] == all_prob[b]) && (a < b));
+	}
+};
+
+
+//candidate words of a state (the words which have not been skipped)
+static void initOrder(vector<int> &order, const vector<bool> &skipped)
+{
+	order.clear();
+	for (int w = 0; w < (int) skipped.size(); w++)
+	{
+		if (!skipped[w])
+		{
+			order.push_back(w);
+		}
+	}
+}
+
+
+
+
+real EntropyPruningPolicy::computeClassDelta(real log_p_post, real p_class, real p_class_bo)
+{
+	real p = log(p_class)-log_p_post;
+	real c = -p*exp(p);
+	return c*(fabs(p_class_bo-p_class)/p_class);
+}
+
+
+/**
+ * Compute the terms of the criterion of every word which do not depend
+ * on the masses (P(w|h), P(w|h') and the entropy weight), once per state,
+ * so that the passes of estimateMasses() and of the pruning are free of
+ * exp and log
+ */
+void EntropyPruningPolicy::initTerms(PruningBuffers &buffers, real p_post, const vector<real> &all_prob, const vector<real> &all_bo_prob, const vector<bool> &skipped) const
+{
+	int v = (int) all_prob.size();
+	buffers.p_cond.resize(v);
+	buffers.p_cond_bo.resize(v);
+	buffers.weight.resize(v);
+	for (int w = 0; w < v; w++)
+	{
+		real p = -all_prob[w]-p_post;
+		buffers.p_cond[w] = exp(-all_prob[w]);
+		buffers.p_cond_bo[w] = exp(-all_bo_prob[w]);
+		buffers.weight[w] = skipped[w] ? 0.0 : -p*exp(p)/buffers.p_cond[w];
+	}
+}
+
+
+void EntropyPruningPolicy::estimateMasses(real *mass1, real *mass2, const PruningBuffers &buffers) const
+{
+	int v = (int) buffers.p_cond.size();
+	const real *p_cond = &buffers.p_cond[0];
+	const real *p_cond_bo = &buffers.p_cond_bo[0];
+	const real *weight = &buffers.weight[0];
+	real log_threshold = log1p(threshold);
+	*mass1 = 0.5;
+	*mass2 = 0.5;
+	for (int i = 0; i < 4; i++)
+	{
+		real new_mass1 = 1.0;
+		real new_mass2 = 1.0;
+		real m1 = *mass1;
+		real m2 = *mass2;
+		//fused pass: no branch nor call, so that it can be vectorized
+		for (int w = 0; w < v; w++)
+		{
+			real pruned = (computePruningDelta(p_cond[w], p_cond_bo[w], weight[w], m1, m2) <= log_threshold) ? 1.0 : 0.0;
+			new_mass1 -= pruned*p_cond[w];
+			new_mass2 -= pruned*p_cond_bo[w];
+		}
+		bool converged = (fabs(*mass1-new_mass1) < 0.1);
+		*mass1 = (new_mass1+*mass1)/2.0;
+		*mass2 = (new_mass2+*mass2)/2.0;
+		if (converged)
+		{
+			break;
+		}
+	}
+}
+
+
+void EntropyPruningPolicy::selectWords(vector<int> &kept, PruningBuffers &buffers, real p_post, const vector<real> &all_prob, const vector<real> &all_bo_prob, const vector<bool> &skipped) const
+{
+	real mass1 = 1.0;
+	real mass2 = 1.0;
+	real log_threshold = log1p(threshold);
+
+	initTerms(buffers, p_post, all_prob, all_bo_prob, skipped);
+	estimateMasses(&mass1, &mass2, buffers);
+	kept.clear();
+	for (int w = 0; w < (int) all_prob.size(); w++)
+	{
+		if (computePruningDelta(buffers.p_cond[w], buffers.p_cond_bo[w], buffers.weight[w], mass1, mass2) > log_threshold)
+		{
+			kept.push_back(w);
+		}
+	}
+}
+
+
+//approximation (see computeClassDelta()): a skipped class may hold words which would have been kept
+bool EntropyPruningPolicy::canSkipClass(real p_post, real p_class, real p_class_bo) const
+{
+	real delta = exp(computeClassDelta(p_post, p_class, p_class_bo)) -1.0;
+	return !(delta > threshold);
+}
+
+
+
+
+void TopKPruningPolicy::selectWords(vector<int> &kept, PruningBuffers &buffers, real p_post, const vector<real> &all_prob, const vector<real> &all_bo_prob, const vector<bool> &skipped) const
+{
+	initOrder(buffers.order, skipped);
+	if ((int) buffers.order.size() > k)
+	{
+		nth_element(buffers.order.begin(), buffers.order.begin()+k, buffers.order.end(), MoreProbable(all_prob));
+		buffers.order.resize(k);
+	}
+	kept = buffers.order;
+	sort(kept.begin(), kept.end());
+}
+
+
+
+
+void MassPruningPolicy::selectWords(vector<int> &kept, PruningBuffers &buffers, real p_post, const vector<real> &all_prob, const vector<real> &all_bo_prob, const vector<bool> &skipped) const
+{
+	vector<int> &order = buffers.order;
+	size_t n_sorted = 0;
+	size_t n_kept = 0;
+	real cumul = 0.0;
+
+	initOrder(order, skipped);
+	//sort the most probable words by blocks of increasing size, until they reach the mass
+	while ((n_kept < order.size()) && (cumul < mass))
+	{
+		if (n_kept == n_sorted)
+		{
+			size_t n = min(order.size(), max((size_t) MASS_POLICY_FIRST_SORT, 2*n_sorted));
+			partial_sort(order.begin()+n_sorted, order.begin()+n, order.end(), MoreProbable(all_prob));
+			n_sorted = n;
+		}
+		cumul += exp(-all_prob[order[n_kept]]);
+		n_kept++;
+	}
+	kept.assign(order.begin(), order.begin()+n_kept);
+	sort(kept.begin(), kept.end());
+}
+
+
+
+
+void FloorPruningPolicy::selectWords(vector<int> &kept, PruningBuffers &buffers, real p_post, const vector<real> &all_prob, const vector<real> &all_bo_prob, const vector<bool> &skipped) const
+{
+	kept.clear();
+	for (int w = 0; w < (int) all_prob.size(); w++)
+	{
+		if (!skipped[w] && (all_prob[w] <= log_floor))
+		{
+			kept.push_back(w);
+		}
+	}
+}
+
+
+//P(w|h) <= P(c|h) for every word of the class
+bool FloorPruningPolicy::canSkipClass(real p_post, real p_class, real p_class_bo) const
+{
+	return (-log(p_class) > log_floor);
+}
+
+
+
+
+PruningPolicy *createPruningPolicy(const string &name, real param)
+{
+	if (name == "entropy")
+	{
+		return new EntropyPruningPolicy(param);
+	}
+	if (name == "top-k")
+	{
+		return (param >= 1) ? new TopKPruningPolicy((int) param) : NULL;
+	}
+	if (name == "mass")
+	{
+		return ((param > 0.0) && (param <= 1.0)) ? new MassPruningPolicy(param) : NULL;
+	}
+	if (name == "floor")
+	{
+		return ((param > 0.0) && (param <= 1.0)) ? new FloorPruningPolicy(param) : NULL;
+	}
+	return NULL;
+}
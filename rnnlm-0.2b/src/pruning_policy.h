@@ -0,0 +1,175 @@
+/************************************************************************
+ * Policies deciding which words of a state keep their transition, the
+ * other words backing off. They are shared by the builders with backoff
+ * (see BackoffFstBuilder) and selected by -prune-policy in rnn2fst,
+ * the parameter of the policy being the value of -prune:
+ *
+ *  - entropy: relative entropy delta of each word, with an iterative
+ *    estimation of the masses of the kept words (default);
+ *  - top-k: the -prune most probable words;
+ *  - mass: the most probable words until their cumulative probability
+ *    reaches -prune;
+ *  - floor: the words whose probability is at least -prune.
+ *
+ * The last three only need one pass or a partial sort of the
+ * distribution of the state.
+ *
+ * Policies are not modified by the selection, so that one policy may be
+ * used by several threads, each with its own buffers.
+ *
+ ***********************************************************************/
+
+#ifndef _PRUNING_POLICY_H_
+#define _PRUNING_POLICY_H_
+
+#include <math.h>
+#include <string>
+#include <vector>
+#include "rnnlmlib.h"
+
+using namespace std;
+
+
+//work arrays of a policy for the words of a state (one per thread)
+struct PruningBuffers {
+	vector<real> p_cond;	//P(w|h)
+	vector<real> p_cond_bo;	//P(w|h')
+	vector<real> weight;	//-P(w,h) log P(w,h) / P(w|h), 0 for the skipped words
+	vector<int> order;	//candidate words, sorted by probability
+};
+
+
+class PruningPolicy {
+
+	public:
+
+	virtual ~PruningPolicy() {}
+
+	/**
+	 * Put in kept, in increasing order, the words of a state of
+	 * history h which keep their transition, given
+	 * p_post = -log P(h), all_prob = -log P(w|h), all_bo_prob = -log P(w|h')
+	 * with h' the backoff history. The skipped words (see
+	 * BackoffFstBuilder::computeEntropyAndConditionalsByClass()) are never kept.
+	 */
+	virtual void selectWords(vector<int> &kept, //out
+	                 PruningBuffers &buffers, //work
+	                 real p_post, //in
+	                 const vector<real> &all_prob, //in
+	                 const vector<real> &all_bo_prob, //in
+	                 const vector<bool> &skipped //in
+	                 ) const = 0;
+
+	/**
+	 * True if the word layer of a class is skipped (its words back off),
+	 * given p_post = -log P(h) (positive) and the probabilities of the
+	 * class knowing h and h' (class pruning; the default is to never skip
+	 * a class). It is exact when no word of such a class could be kept
+	 * (floor), an approximation otherwise (entropy).
+	 */
+	virtual bool canSkipClass(real p_post, real p_class, real p_class_bo) const {
+		return false;
+	}
+
+};
+
+
+class EntropyPruningPolicy : public PruningPolicy {
+
+	protected:
+
+	real threshold;
+
+	void initTerms(PruningBuffers &buffers, real p_post, const vector<real> &all_prob, const vector<real> &all_bo_prob, const vector<bool> &skipped) const;
+	void estimateMasses(real *mass1, real *mass2, const PruningBuffers &buffers) const;
+
+	public:
+
+	EntropyPruningPolicy(real t) {
+		threshold = t;
+	}
+
+	/**
+	 * Pruning criterion of word w (see
+	 * BackoffFstBuilder::computeDeltaEntropy()) given the masses, as
+	 * log(1+delta): the word is pruned if it is lower than log(1+threshold)
+	 */
+	static inline real computePruningDelta(real p_cond, real p_cond_bo, real weight, real mass1, real mass2) {
+		real p_bo = p_cond_bo*(1.0-mass1+1e-10+p_cond)/(1.0-mass2+1e-10+p_cond_bo);
+		return weight*fabs(p_bo-p_cond);
+	}
+
+	/**
+	 * Same criterion for a whole class, as if it were a single word whose
+	 * backoff probability is not renormalized (the masses are not known yet).
+	 * It is not an upper bound of the criterion of the words of the class:
+	 * that one grows without bound when P(w|h) tends to 0 while P(w|h')
+	 * does not, so no bound can be derived from the class probabilities.
+	 */
+	static real computeClassDelta(real log_p_post, real p_class, real p_class_bo);
+
+	virtual void selectWords(vector<int> &kept, PruningBuffers &buffers, real p_post, const vector<real> &all_prob, const vector<real> &all_bo_prob, const vector<bool> &skipped) const;
+	virtual bool canSkipClass(real p_post, real p_class, real p_class_bo) const;
+
+};
+
+
+class TopKPruningPolicy : public PruningPolicy {
+
+	protected:
+
+	int k;
+
+	public:
+
+	TopKPruningPolicy(int n) {
+		k = n;
+	}
+
+	virtual void selectWords(vector<int> &kept, PruningBuffers &buffers, real p_post, const vector<real> &all_prob, const vector<real> &all_bo_prob, const vector<bool> &skipped) const;
+
+};
+
+
+class MassPruningPolicy : public PruningPolicy {
+
+	protected:
+
+	real mass;
+
+	public:
+
+	MassPruningPolicy(real m) {
+		mass = m;
+	}
+
+	virtual void selectWords(vector<int> &kept, PruningBuffers &buffers, real p_post, const vector<real> &all_prob, const vector<real> &all_bo_prob, const vector<bool> &skipped) const;
+
+};
+
+
+class FloorPruningPolicy : public PruningPolicy {
+
+	protected:
+
+	real log_floor;	//-log of the minimum probability
+
+	public:
+
+	FloorPruningPolicy(real floor) {
+		log_floor = -log(floor);
+	}
+
+	virtual void selectWords(vector<int> &kept, PruningBuffers &buffers, real p_post, const vector<real> &all_prob, const vector<real> &all_bo_prob, const vector<bool> &skipped) const;
+	virtual bool canSkipClass(real p_post, real p_class, real p_class_bo) const;
+
+};
+
+
+/**
+ * Policy of a given name (entropy, top-k, mass or floor) and parameter,
+ * NULL if the name or the parameter is not valid
+ */
+PruningPolicy *createPruningPolicy(const string &name, real param);
+
+#endif
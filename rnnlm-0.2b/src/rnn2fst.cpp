@@ -11,12 +11,17 @@
 #include <stdio.h>
 #include <string.h>
 #include <iostream>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "rnnlmlib.h"
 #include "abstract_fstbuilder.h"
 #include "neuron_fstbuilder.h"
 #include "flat_bo_fstbuilder.h"
 #include "cluster_fstbuilder.h"
 #include "hierarchical_cluster_fstbuilder.h"
+#include "pq_fstbuilder.h"
+#include "lsh_fstbuilder.h"
+#include "fst_shards.h"
 
 using namespace std;
 using namespace fst;
@@ -57,17 +62,33 @@ int main(int argc, char **argv)
     int rnnlm_exist=0;
     int n_bins = 2;
     int bo_len=2;
+    int tree_beam=0;
+    float index_eps=-1;
+    int index_checks=0;
+    int n_threads=1;
+    int n_shards=1;
+    int dist_cache_mb=DEFAULT_DIST_CACHE_MB;
+    bool shard_merge = true;
+    bool class_prune = false;
+    char prune_policy[MAX_STRING];
+    int prune_policy_set=0;
     float threshold=0.01;
     
     bool cluster = false;
     bool h_cluster = false;
+    bool pq = false;
+    bool lsh = false;
+    bool lsh_flip = false;
     bool neuron_flat = false;
     bool neuron = false;
     
     
     char rnnlm_file[MAX_STRING];
     char fst_file[MAX_STRING];
-    char disc_ma p_file[MAX_STRING];
+    char disc_map_file[MAX_STRING];
+    char transition_file[MAX_STRING];
+    int transition_file_set=0;
+    int transition_max_mb=DEFAULT_TRANSITION_TABLE_MB;
     
     FILE *f;
     
@@ -81,11 +102,45 @@ int main(int argc, char **argv)
     	printf("Converts a recurrent neural network into a finite state transducer in order to integrate long-span information within the decoding process\n\n");
     	
     	printf("Syntax:\n");
-		printf("\trnn2fst [-cluster|-hcluster|-neuron|-flat-neuron] -rnnlm <rnn_model> -fst <fst_output>\n");
+		printf("\trnn2fst [-cluster|-hcluster|-pq|-lsh|-neuron|-flat-neuron] -rnnlm <rnn_model> -fst <fst_output>\n");
     	printf("\t        [-prune <prob_threshold>]\n");
     	printf("\t            Threshold to backoff a word transition.\n");
 		printf("\t        [-backoff <N>]\n");
     	printf("\t            Maximum length of a backoff path.\n");
+    	printf("\t        [-discretize <file>]\n");
+    	printf("\t            Clusters (-cluster, -hcluster), product quantization codebooks written by train-pq (-pq)\n");
+    	printf("\t            or projections written by train-lsh (-lsh).\n");
+		printf("\t        [-lsh-flip]\n");
+    	printf("\t            With -lsh, back off to an existing state with a flipped weak bit when possible.\n");
+		printf("\t        [-tree-search <beam>]\n");
+    	printf("\t            With -hcluster, assign states by descending the cluster tree, keeping the <beam> best clusters at each level.\n");
+		printf("\t        [-cluster-index <eps> [-index-checks <N>]]\n");
+    	printf("\t            Search large sets of clusters through a vantage-point tree (eps = 0: exact search,\n");
+    	printf("\t            eps > 0 or N > 0: approximate search).\n");
+		printf("\t        [-transitions <file>]\n");
+    	printf("\t            With -hcluster, read the successor of each (cluster, word) pair from <file> instead of\n");
+    	printf("\t            discretizing the hidden layer; the table is built and written to <file>\n");
+    	printf("\t            if it does not exist or was built for another model or other clusters.\n");
+		printf("\t        [-transitions-max-mb <MB>]\n");
+    	printf("\t            Memory limit of the transition table (default: %i); above it, the successors are discretized.\n", DEFAULT_TRANSITION_TABLE_MB);
+		printf("\t        [-threads <N>]\n");
+    	printf("\t            With -hcluster, -pq or -lsh, expand the states and compute the backoff weights with N threads\n");
+    	printf("\t            (and build the transition table of -hcluster).\n");
+		printf("\t        [-prune-policy entropy|top-k|mass|floor]\n");
+    	printf("\t            With -hcluster, -pq or -lsh, keep the words whose relative entropy delta is above the threshold\n");
+    	printf("\t            (entropy, default), the <prob_threshold> most probable words (top-k), the most probable words\n");
+    	printf("\t            up to a cumulative probability of <prob_threshold> (mass) or the words whose probability is at\n");
+    	printf("\t            least <prob_threshold> (floor).\n");
+		printf("\t        [-class-prune]\n");
+    	printf("\t            With -hcluster, -pq or -lsh, skip the word layer of the classes whose whole probability\n");
+    	printf("\t            does not pass the pruning threshold; their words back off. Exact with -prune-policy floor\n");
+    	printf("\t            (no word of a skipped class could be kept), approximate with entropy (a skipped class may\n");
+    	printf("\t            hold words which would have been kept); top-k and mass never skip a class.\n");
+		printf("\t        [-dist-cache <MB>]\n");
+    	printf("\t            Memory of the cache of the distributions of the backoff states (default: %i, 0: no cache).\n", DEFAULT_DIST_CACHE_MB);
+		printf("\t        [-shards <N> [-no-merge]]\n");
+    	printf("\t            With -hcluster, split the states among N processes, which write <fst_output>.shard0..N-1;\n");
+    	printf("\t            the shards are then merged into <fst_output> (see merge-fst-shards) unless -no-merge is given.\n");
 
     	return 0;	//***
     }
@@ -130,6 +185,24 @@ int main(int argc, char **argv)
 	if (debug_mode>0) printf("FST builder: hierarchical cluster\n");
     }
     
+    i=argPos((char *)"-pq", argc, argv);
+    if (i>0) {
+    pq = true;
+	if (debug_mode>0) printf("FST builder: product quantization\n");
+    }
+    
+    i=argPos((char *)"-lsh", argc, argv);
+    if (i>0) {
+    lsh = true;
+	if (debug_mode>0) printf("FST builder: sign projections\n");
+    }
+    
+    i=argPos((char *)"-lsh-flip", argc, argv);
+    if (i>0) {
+    lsh_flip = true;
+	if (debug_mode>0) printf("Backoff by flipping weak bits\n");
+    }
+    
     //set pruning threshold
     i=argPos((char *)"-prune", argc, argv);
     if (i>0) {
@@ -158,6 +231,149 @@ int main(int argc, char **argv)
         printf("Maximum backoff path length: %i\n", bo_len);
     }
         
+    //set beam of the cluster tree descent
+    i=argPos((char *)"-tree-search", argc, argv);
+    if (i>0) {
+        if (i+1==argc) {
+            printf("ERROR: tree search beam not specified!\n");
+            return 0;
+        }
+
+        tree_beam=atoi(argv[i+1]);
+
+        if (debug_mode>0)
+        printf("Tree search beam: %i\n", tree_beam);
+    }
+        
+    //set centroid index
+    i=argPos((char *)"-cluster-index", argc, argv);
+    if (i>0) {
+        if (i+1==argc) {
+            printf("ERROR: cluster index approximation factor not specified!\n");
+            return 0;
+        }
+
+        index_eps=atof(argv[i+1]);
+
+        if (debug_mode>0)
+        printf("Cluster index approximation factor: %f\n", index_eps);
+    }
+        
+    i=argPos((char *)"-index-checks", argc, argv);
+    if (i>0) {
+        if (i+1==argc) {
+            printf("ERROR: maximum number of index checks not specified!\n");
+            return 0;
+        }
+
+        index_checks=atoi(argv[i+1]);
+
+        if (debug_mode>0)
+        printf("Maximum number of index checks: %i\n", index_checks);
+    }
+        
+        
+    //set transition table
+    i=argPos((char *)"-transitions", argc, argv);
+    if (i>0) {
+        if (i+1==argc) {
+            printf("ERROR: transition table file not specified!\n");
+            return 0;
+        }
+
+        strcpy(transition_file, argv[i+1]);
+        transition_file_set=1;
+
+        if (debug_mode>0)
+        printf("Transition table: %s\n", transition_file);
+    }
+        
+    i=argPos((char *)"-transitions-max-mb", argc, argv);
+    if (i>0) {
+        if (i+1==argc) {
+            printf("ERROR: memory limit of the transition table not specified!\n");
+            return 0;
+        }
+
+        transition_max_mb=atoi(argv[i+1]);
+
+        if (debug_mode>0)
+        printf("Transition table limit: %i MB\n", transition_max_mb);
+    }
+        
+    i=argPos((char *)"-threads", argc, argv);
+    if (i>0) {
+        if (i+1==argc) {
+            printf("ERROR: number of threads not specified!\n");
+            return 0;
+        }
+
+        n_threads=atoi(argv[i+1]);
+
+        if (debug_mode>0)
+        printf("Threads: %i\n", n_threads);
+    }
+        
+    i=argPos((char *)"-prune-policy", argc, argv);
+    if (i>0) {
+        if (i+1==argc) {
+            printf("ERROR: pruning policy not specified!\n");
+            return 0;
+        }
+
+        strcpy(prune_policy, argv[i+1]);
+        prune_policy_set=1;
+
+        if (debug_mode>0)
+        printf("Pruning policy: %s\n", prune_policy);
+    }
+        
+    i=argPos((char *)"-class-prune", argc, argv);
+    if (i>0) {
+    class_prune = true;
+	if (debug_mode>0) printf("Class pruning\n");
+    }
+        
+    i=argPos((char *)"-dist-cache", argc, argv);
+    if (i>0) {
+        if (i+1==argc) {
+            printf("ERROR: size of the distribution cache not specified!\n");
+            return 0;
+        }
+
+        dist_cache_mb=atoi(argv[i+1]);
+        if (dist_cache_mb<0) {
+            printf("ERROR: invalid size of the distribution cache!\n");
+            return 0;
+        }
+
+        if (debug_mode>0)
+        printf("Distribution cache: %i MB\n", dist_cache_mb);
+    }
+        
+    i=argPos((char *)"-shards", argc, argv);
+    if (i>0) {
+        if (i+1==argc) {
+            printf("ERROR: number of shards not specified!\n");
+            return 0;
+        }
+
+        n_shards=atoi(argv[i+1]);
+        if (n_shards<1) {
+            printf("ERROR: invalid number of shards!\n");
+            return 0;
+        }
+
+        if (debug_mode>0)
+        printf("Shards: %i\n", n_shards);
+    }
+        
+    i=argPos((char *)"-no-merge", argc, argv);
+    if (i>0) {
+    shard_merge = false;
+	if (debug_mode>0) printf("The shards are not merged\n");
+    }
+        
         
     //set maximum backoff path length
     i=argPos((char *)"-bins", argc, argv);
@@ -241,10 +457,14 @@ int main(int argc, char **argv)
     srand(1);
 	rnnlm.setRnnLMFile(rnnlm_file);
 	rnnlm.setDebugMode(debug_mode);
+	rnnlm.setInferenceOnly(1);
 	rnnlm.restoreNet();
 	
 	//Declare FST builder
 	FstBuilder *builder;
+	HierarchicalClusterFstBuilder *hb = NULL;
+	BackoffFstBuilder *bb = NULL;
+	TransitionTable transitions;
 	   
 	//Load discretizer
 	if (neuron || neuron_flat) 
@@ -264,22 +484,171 @@ int main(int argc, char **argv)
     {
 //		ClusterDiscretizer *d = new ClusterDiscretizer(rnnlm.getHiddenLayerSize(), n_bins, rnnlm.getVocabSize(), string(disc_map_file));
 		ClusterDiscretizer *d = new ClusterDiscretizer(rnnlm.getHiddenLayerSize(), n_bins, string(disc_map_file));
+		if (index_eps >= 0) 
+        {
+			d->buildIndex(index_eps, index_checks);
+		}
+		d->cacheRecurrentInput(rnnlm);
 		builder = (ClusterFstBuilder *) new ClusterFstBuilder(d);
 	}
 	else if (h_cluster) 
     {
 //		HierarchicalClusterDiscretizer *d = new HierarchicalClusterDiscretizer(rnnlm.getHiddenLayerSize(), rnnlm.getVocabSize(), string(disc_map_file));	
 		HierarchicalClusterDiscretizer *d = new HierarchicalClusterDiscretizer(rnnlm.getHiddenLayerSize(), string(disc_map_file));	
-		builder = (HierarchicalClusterFstBuilder *) new HierarchicalClusterFstBuilder(d, threshold, bo_len);
+		d->setTreeSearch(tree_beam);
+		if (index_eps >= 0) 
+        {
+			d->setIndex(index_eps, index_checks);
+		}
+		d->cacheRecurrentInput(rnnlm);
+		hb = new HierarchicalClusterFstBuilder(d, threshold, bo_len);
+		if (transition_file_set) 
+        {
+			transitions.setMaxBytes((size_t) transition_max_mb << 20);
+			if (!transitions.load(string(transition_file), rnnlm, *d) && transitions.build(rnnlm, *d, n_threads)) 
+            {
+				if (!transitions.save(string(transition_file))) 
+                {
+					fprintf(stderr, "WARNING: cannot write %s\n", transition_file);
+				}
+			}
+			if (debug_mode>0)
+			printf("Transition table: %li entries\n", (long) transitions.getNumEntries());
+			hb->setTransitions(&transitions);
+		}
+		bb = hb;
+		builder = hb;
+	}
+	else if (pq) 
+    {
+		PQDiscretizer *d = new PQDiscretizer(rnnlm.getHiddenLayerSize(), string(disc_map_file));
+		bb = new PQFstBuilder(d, threshold, bo_len);
+		builder = bb;
+	}
+	else if (lsh) 
+    {
+		LSHDiscretizer *d = new LSHDiscretizer(rnnlm.getHiddenLayerSize(), string(disc_map_file));
+		bb = new LSHFstBuilder(d, threshold, bo_len, lsh_flip);
+		builder = bb;
 	}
 	
 	builder->setDebugMode(debug_mode);
+	builder->setDistributionCacheSize((size_t) dist_cache_mb << 20);
+	if (bb != NULL) 
+    {
+		bb->setClassPruning(class_prune);
+		bb->setThreads(n_threads);
+		if (prune_policy_set) 
+        {
+			PruningPolicy *policy = createPruningPolicy(string(prune_policy), threshold);
+			if (policy == NULL) 
+            {
+				printf("ERROR: unknown pruning policy %s or invalid threshold %f\n", prune_policy, threshold);
+				return 1;
+			}
+			bb->setPruningPolicy(policy);
+		}
+	}
+	else if (class_prune) 
+    {
+		printf("ERROR: -class-prune is only available with -hcluster, -pq and -lsh\n");
+		return 1;
+	}
+	else if (prune_policy_set) 
+    {
+		printf("ERROR: -prune-policy is only available with -hcluster, -pq and -lsh\n");
+		return 1;
+	}
 	
 	//Create, fill and save FST
 	VectorFst<LogArc> fst;
 	fst.SetProperties(kILabelSorted, true);
-	builder->convertRNN(rnnlm, fst);
-	fst.Write(fst_file);
+	if (n_shards > 1) 
+    {
+		if (hb == NULL) 
+        {
+			printf("ERROR: -shards is only available with -hcluster\n");
+			return 1;
+		}
+		
+		//one process per shard, connected to this one by two pipes
+		vector<FILE*> to_shard, from_shard;
+		vector<pid_t> pids;
+		fflush(stdout);
+		for (i=0; i<n_shards; i++) 
+        {
+			int down[2], up[2];
+			if ((pipe(down) != 0) || (pipe(up) != 0)) 
+            {
+				printf("ERROR: cannot create the pipes of shard %i\n", i);
+				return 1;
+			}
+			pid_t pid = fork();
+			if (pid == -1) 
+            {
+				printf("ERROR: cannot start shard %i\n", i);
+				return 1;
+			}
+			if (pid == 0) 
+            {
+				for (size_t j=0; j<to_shard.size(); j++) 
+                {
+					fclose(to_shard[j]);
+					fclose(from_shard[j]);
+				}
+				close(down[1]);
+				close(up[0]);
+				FILE *in = fdopen(down[0], "rb");
+				FILE *out = fdopen(up[1], "wb");
+				hb->convertShard(rnnlm, i, n_shards, in, out, getShardFileName(string(fst_file), i));
+				fclose(out);
+				fclose(in);
+				_exit(0);
+			}
+			close(down[0]);
+			close(up[1]);
+			to_shard.push_back(fdopen(down[1], "wb"));
+			from_shard.push_back(fdopen(up[0], "rb"));
+			pids.push_back(pid);
+		}
+		
+		coordinateShards(to_shard, from_shard);
+		
+		int failed = 0;
+		for (i=0; i<n_shards; i++) 
+        {
+			int status;
+			fclose(to_shard[i]);
+			fclose(from_shard[i]);
+			if ((waitpid(pids[i], &status, 0) == -1) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) 
+            {
+				printf("ERROR: shard %i has failed\n", i);
+				failed = 1;
+			}
+		}
+		if (failed) 
+        {
+			return 1;
+		}
+		
+		if (shard_merge) 
+        {
+			if (!mergeFstShards(string(fst_file), n_shards, fst, n_threads)) 
+            {
+				return 1;
+			}
+			fst.Write(fst_file);
+			for (i=0; i<n_shards; i++) 
+            {
+				remove(getShardFileName(string(fst_file), i).c_str());
+			}
+		}
+	}
+	else 
+    {
+		builder->convertRNN(rnnlm, fst);
+		fst.Write(fst_file);
+	}
 	
 	delete builder;
 	
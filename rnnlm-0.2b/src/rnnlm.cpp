@@ -15,6 +15,7 @@
 #include <iostream>
 #include "rnnlmlib.h"
 #include "hierarchical_cluster_discretizer.h"
+#include "transition_table.h"
 
 using namespace std;
 
@@ -70,6 +71,13 @@ int main(int argc, char **argv)
     int nbest=0;
     int one_iter=0;
     int anti_k=0;
+    int perf_mode=PERF_OFF;
+    int tree_beam=0;
+    real index_eps=-1;
+    int index_checks=0;
+    int n_threads=1;
+    int transition_file_set=0;
+    int transition_max_mb=DEFAULT_TRANSITION_TABLE_MB;
     
     char train_file[MAX_STRING];
     char valid_file[MAX_STRING];
@@ -77,6 +85,7 @@ int main(int argc, char **argv)
     char rnnlm_file[MAX_STRING];
     char lmprob_file[MAX_STRING];
     char disc_map_file[MAX_STRING];
+    char transition_file[MAX_STRING];
     
     HierarchicalClusterDiscretizer *d;
     
@@ -176,6 +185,33 @@ int main(int argc, char **argv)
         printf("\t-independent\n");
         printf("\t\tWill erase history at end of each sentence (if used for training, this switch should be used also for testing & rescoring)\n");
 
+        printf("\t-perf-stats\n");
+        printf("\t\tPrint wall-clock time spent in each phase (tokenization, hidden layer, softmax, maxent, BPTT, I/O) to stderr, after each training iteration and after testing\n");
+
+        printf("\t-perf-json\n");
+        printf("\t\tSame as -perf-stats, but each summary is printed as one JSON object per line\n");
+
+        printf("\t-discretize <file>\n");
+        printf("\t\tDuring testing, replace the hidden layer by the mean of its closest cluster in the hierarchy <file> (k-means format)\n");
+
+        printf("\t-tree-search <int>\n");
+        printf("\t\tWith -discretize, find the clusters by descending the hierarchy and keeping the given number of best clusters per level; default is 0 (independent search at each level)\n");
+
+        printf("\t-cluster-index <float>\n");
+        printf("\t\tWith -discretize, search the levels of at least 256 clusters through a vantage-point tree; the value is the approximation factor (0 for an exact search)\n");
+
+        printf("\t-index-checks <int>\n");
+        printf("\t\tWith -cluster-index, maximum number of distances computed per search; default is 0 (no limit)\n");
+
+        printf("\t-transitions <file>\n");
+        printf("\t\tWith -discretize (static model, no nbest), read the clusters of the next state from the transition table <file>; the table is built and written to <file> if it does not exist or does not match the model\n");
+
+        printf("\t-transitions-max-mb <int>\n");
+        printf("\t\tMemory limit of the transition table, above which the next states are discretized; default is %d\n", DEFAULT_TRANSITION_TABLE_MB);
+
+        printf("\t-threads <int>\n");
+        printf("\t\tNumber of threads used to build the transition table; default is 1\n");
+
     	printf("\nExamples:\n");
     	printf("rnnlm -train train -rnnlm model -valid valid -hidden 50\n");
     	printf("rnnlm -rnnlm model -test test\n");
@@ -249,6 +285,100 @@ int main(int argc, char **argv)
 
     }
     
+    //set beam of the cluster tree descent
+    i=argPos((char *)"-tree-search", argc, argv);
+    if (i>0) 
+    {
+        if (i+1==argc) 
+        {
+            printf("ERROR: tree search beam not specified!\n");
+            return 0;
+        }
+
+        tree_beam=atoi(argv[i+1]);
+
+        if (debug_mode>0)
+        printf("tree search beam: %d\n", tree_beam);
+    }
+    
+    //set centroid index
+    i=argPos((char *)"-cluster-index", argc, argv);
+    if (i>0) 
+    {
+        if (i+1==argc) 
+        {
+            printf("ERROR: cluster index approximation factor not specified!\n");
+            return 0;
+        }
+
+        index_eps=atof(argv[i+1]);
+
+        if (debug_mode>0)
+        printf("cluster index approximation factor: %f\n", index_eps);
+    }
+    
+    i=argPos((char *)"-index-checks", argc, argv);
+    if (i>0) 
+    {
+        if (i+1==argc) 
+        {
+            printf("ERROR: maximum number of index checks not specified!\n");
+            return 0;
+        }
+
+        index_checks=atoi(argv[i+1]);
+
+        if (debug_mode>0)
+        printf("maximum number of index checks: %d\n", index_checks);
+    }
+    
+    //set transition table
+    i=argPos((char *)"-transitions", argc, argv);
+    if (i>0) 
+    {
+        if (i+1==argc) 
+        {
+            printf("ERROR: transition table file not specified!\n");
+            return 0;
+        }
+
+        strcpy(transition_file, argv[i+1]);
+        transition_file_set=1;
+
+        if (debug_mode>0)
+        printf("transition table: %s\n", transition_file);
+    }
+    
+    i=argPos((char *)"-transitions-max-mb", argc, argv);
+    if (i>0) 
+    {
+        if (i+1==argc) 
+        {
+            printf("ERROR: memory limit of the transition table not specified!\n");
+            return 0;
+        }
+
+        transition_max_mb=atoi(argv[i+1]);
+
+        if (debug_mode>0)
+        printf("transition table limit: %d MB\n", transition_max_mb);
+    }
+    
+    i=argPos((char *)"-threads", argc, argv);
+    if (i>0) 
+    {
+        if (i+1==argc) 
+        {
+            printf("ERROR: number of threads not specified!\n");
+            return 0;
+        }
+
+        n_threads=atoi(argv[i+1]);
+
+        if (debug_mode>0)
+        printf("threads: %d\n", n_threads);
+    }
+    
     
     //set one-iter
     i=argPos((char *)"-one-iter", argc, argv);
@@ -438,6 +568,13 @@ int main(int argc, char **argv)
       }
     
     
+    //set performance counters
+    i=argPos((char *)"-perf-stats", argc, argv);
+    if (i>0) perf_mode=PERF_TEXT;
+    i=argPos((char *)"-perf-json", argc, argv);
+    if (i>0) perf_mode=PERF_JSON;
+    
+    
     //set learning rate
     i=argPos((char *)"-alpha", argc, argv);
     if (i>0) {
@@ -715,6 +852,7 @@ int main(int argc, char **argv)
     	model1.setDebugMode(debug_mode);
     	model1.setAntiKasparek(anti_k);
 	    model1.setIndependent(independent);
+    	model1.setPerfMode(perf_mode);
     	
     	model1.alpha_set=alpha_set;
     	model1.train_file_set=train_file_set;
@@ -725,6 +863,7 @@ int main(int argc, char **argv)
     if (test_data_set && rnnlm_file_set) 
     {
         CRnnLM model1;
+        TransitionTable transitions;
         
 
 
@@ -737,13 +876,31 @@ int main(int argc, char **argv)
         model1.useLMProb(use_lmprob);
         if (use_lmprob) model1.setLMProbFile(lmprob_file);
         model1.setDebugMode(debug_mode);
+        model1.setPerfMode(perf_mode);
+        if (dynamic==0) 
+            model1.setInferenceOnly(1);		//no training backups are needed
 
         if (disc_map_file_set == 1) 
         {
         	model1.restoreNet();
 //        	d = new HierarchicalClusterDiscretizer(model1.getHiddenLayerSize(), model1.getVocabSize(), string(disc_map_file));
         	d = new HierarchicalClusterDiscretizer(model1.getHiddenLayerSize(), string(disc_map_file));
+        	d->setTreeSearch(tree_beam);
+        	if (index_eps>=0) 
+        	    d->setIndex(index_eps, index_checks);
+        	if (dynamic==0) 
+        	    d->cacheRecurrentInput(model1);	//weights are not updated during the test
         	model1.setDiscretizer(d);
+        	if (transition_file_set && (dynamic==0) && (nbest==0)) 
+        	{
+        	    transitions.setMaxBytes((size_t) transition_max_mb << 20);
+        	    if (!transitions.load(string(transition_file), model1, *d) && transitions.build(model1, *d, n_threads)) 
+        	    {
+        	        if (!transitions.save(string(transition_file))) 
+        	            printf("WARNING: cannot write %s\n", transition_file);
+        	    }
+        	    model1.setTransitionTable(&transitions);
+        	}
         }
 
         if (nbest==0) 
@@ -13,10 +13,12 @@
 #include <time.h>
 #include "rnnlmlib.h"
 #include "hierarchical_cluster_fsthistory.h"
+#include "hierarchical_cluster_discretizer.h"
+#include "transition_table.h"
 
 
-///// fast exp() implementation
-static union
+///// fast exp() implementation (one union per thread, see shareNet())
+static thread_local union
 {
     double d;
     struct
@@ -60,6 +62,7 @@ extern "C" {
 void CRnnLM::setDiscretizer(Discretizer *dis) {
 	disc_map_set = 1;
 	d = dis;
+	hd = dynamic_cast<HierarchicalClusterDiscretizer *>(dis);
 	fsth = new HierarchicalClusterFstHistory();
 }
 
@@ -69,6 +72,12 @@ real CRnnLM::random(real min, real max)
     return rand()/(real)RAND_MAX*(max-min)+min;
 }
 
+void CRnnLM::printPerfCounters(const char *label)
+{
+    perf.print(stderr, label);
+    perf.reset();
+}
+
 void CRnnLM::setTrainFile(char *str)
 {
     strcpy(train_file, str);
@@ -180,11 +189,17 @@ int CRnnLM::searchVocab(char *word)
 int CRnnLM::readWordIndex(FILE *fin)
 {
     char word[MAX_STRING];
+    int index;
+    double t=perf.start();
 
     readWord(word, fin);
-    if (feof(fin)) return -1;
+    if (feof(fin)) 
+        index=-1;
+    else
+        index=searchVocab(word);
+    perf.stop(PERF_TOKENIZE, t);
 
-    return searchVocab(word);
+    return index;
 }
 
 int CRnnLM::addWordToVocab(char *word)
@@ -319,13 +334,11 @@ void CRnnLM::saveWeights()      //saves current weights and unit activations
         neu2b[a].er=neu2[a].er;
     }
     
-    for (b=0; b<layer1_size; b++)
-    {
-        for (a=0; a<layer0_size; a++) 
-        {
-            syn0b[a+b*layer0_size].weight=syn0[a+b*layer0_size].weight;
-        }
-    }
+    for (a=0; a<vocab_size*layer1_size; a++) 
+        syn0wb[a].weight=syn0w[a].weight;
+    
+    for (a=0; a<layer1_size*layer1_size; a++) 
+        syn0hb[a].weight=syn0h[a].weight;
         
     
     if (layerc_size>0) 
@@ -378,8 +391,12 @@ void CRnnLM::restoreWeights()      //restores current weights and unit activatio
         neu2[a].er=neu2b[a].er;
     }
 
-    for (b=0; b<layer1_size; b++) for (a=0; a<layer0_size; a++) {
-        syn0[a+b*layer0_size].weight=syn0b[a+b*layer0_size].weight;
+    for (a=0; a<vocab_size*layer1_size; a++) {
+        syn0w[a].weight=syn0wb[a].weight;
+    }
+    
+    for (a=0; a<layer1_size*layer1_size; a++) {
+        syn0h[a].weight=syn0hb[a].weight;
     }
     
     if (layerc_size>0) {
@@ -453,7 +470,13 @@ void CRnnLM::initNet()
     neuc=(struct neuron *)calloc(layerc_size, sizeof(struct neuron));
     neu2=(struct neuron *)calloc(layer2_size, sizeof(struct neuron));
 
-    syn0=(struct synapse *)calloc(layer0_size*layer1_size, sizeof(struct synapse));
+    syn0w=(struct synapse *)calloc((long long)vocab_size*layer1_size, sizeof(struct synapse));
+    syn0h=(struct synapse *)calloc(layer1_size*layer1_size, sizeof(struct synapse));
+    if ((syn0w==NULL) || (syn0h==NULL)) 
+    {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
     if (layerc_size==0)
 	    syn1=(struct synapse *)calloc(layer1_size*layer2_size, sizeof(struct synapse));
     else 
@@ -486,28 +509,35 @@ void CRnnLM::initNet()
         exit(1);
     }
 
-    //创建神经元备份空间  
-    neu0b=(struct neuron *)calloc(layer0_size, sizeof(struct neuron));
+    //hidden layer copies used by n-best rescoring (small, always allocated)
     neu1b=(struct neuron *)calloc(layer1_size, sizeof(struct neuron));
-    neucb=(struct neuron *)calloc(layerc_size, sizeof(struct neuron));
     neu1b2=(struct neuron *)calloc(layer1_size, sizeof(struct neuron));
-    neu2b=(struct neuron *)calloc(layer2_size, sizeof(struct neuron));
 
-    //创建突触(即权值参数)的备份空间  
-    syn0b=(struct synapse *)calloc(layer0_size*layer1_size, sizeof(struct synapse));
-    //syn1b=(struct synapse *)calloc(layer1_size*layer2_size, sizeof(struct synapse));
-    if (layerc_size==0)
-	    syn1b=(struct synapse *)calloc(layer1_size*layer2_size, sizeof(struct synapse));
-    else 
+    //the backups below are only needed for training
+    if (!inference_only)
     {
-        syn1b=(struct synapse *)calloc(layer1_size*layerc_size, sizeof(struct synapse));
-        syncb=(struct synapse *)calloc(layerc_size*layer2_size, sizeof(struct synapse));
-    }
+        //创建神经元备份空间  
+        neu0b=(struct neuron *)calloc(layer0_size, sizeof(struct neuron));
+        neucb=(struct neuron *)calloc(layerc_size, sizeof(struct neuron));
+        neu2b=(struct neuron *)calloc(layer2_size, sizeof(struct neuron));
 
-    if (syn1b==NULL) 
-    {
-        printf("Memory allocation failed\n");
-        exit(1);
+        //创建突触(即权值参数)的备份空间  
+        syn0wb=(struct synapse *)calloc((long long)vocab_size*layer1_size, sizeof(struct synapse));
+        syn0hb=(struct synapse *)calloc(layer1_size*layer1_size, sizeof(struct synapse));
+        //syn1b=(struct synapse *)calloc(layer1_size*layer2_size, sizeof(struct synapse));
+        if (layerc_size==0)
+	        syn1b=(struct synapse *)calloc(layer1_size*layer2_size, sizeof(struct synapse));
+        else 
+        {
+            syn1b=(struct synapse *)calloc(layer1_size*layerc_size, sizeof(struct synapse));
+            syncb=(struct synapse *)calloc(layerc_size*layer2_size, sizeof(struct synapse));
+        }
+
+        if ((syn0wb==NULL) || (syn0hb==NULL) || (syn1b==NULL)) 
+        {
+            printf("Memory allocation failed\n");
+            exit(1);
+        }
     }
     
     for (a=0; a<layer0_size; a++) 
@@ -534,25 +564,28 @@ void CRnnLM::initNet()
         neu2[a].er=0;
     }
 
-    for (b=0; b<layer1_size; b++) 
-        for (a=0; a<layer0_size; a++) 
-        {
-            syn0[a+b*layer0_size].weight=random(-0.1, 0.1)+random(-0.1, 0.1)+random(-0.1, 0.1);
-        }
+    //in inference-only mode, the weights are read by restoreNet() right after
+    if (!inference_only) 
+    {
+        for (b=0; b<layer1_size; b++) 
+            for (a=0; a<layer0_size; a++) 
+            {
+                getSyn0(a, b)->weight=random(-0.1, 0.1)+random(-0.1, 0.1)+random(-0.1, 0.1);
+            }
 
-    if (layerc_size>0) {
-	for (b=0; b<layerc_size; b++) for (a=0; a<layer1_size; a++) {
-	    syn1[a+b*layer1_size].weight=random(-0.1, 0.1)+random(-0.1, 0.1)+random(-0.1, 0.1);
-	}
+        if (layerc_size>0) 
+        {
+            for (b=0; b<layerc_size; b++) for (a=0; a<layer1_size; a++) 
+                syn1[a+b*layer1_size].weight=random(-0.1, 0.1)+random(-0.1, 0.1)+random(-0.1, 0.1);
 	
-	for (b=0; b<layer2_size; b++) for (a=0; a<layerc_size; a++) {
-	    sync[a+b*layerc_size].weight=random(-0.1, 0.1)+random(-0.1, 0.1)+random(-0.1, 0.1);
-	}
-    }
-    else {
-	for (b=0; b<layer2_size; b++) for (a=0; a<layer1_size; a++) {
-	    syn1[a+b*layer1_size].weight=random(-0.1, 0.1)+random(-0.1, 0.1)+random(-0.1, 0.1);
-	}
+            for (b=0; b<layer2_size; b++) for (a=0; a<layerc_size; a++) 
+                sync[a+b*layerc_size].weight=random(-0.1, 0.1)+random(-0.1, 0.1)+random(-0.1, 0.1);
+        }
+        else 
+        {
+            for (b=0; b<layer2_size; b++) for (a=0; a<layer1_size; a++) 
+                syn1[a+b*layer1_size].weight=random(-0.1, 0.1)+random(-0.1, 0.1)+random(-0.1, 0.1);
+        }
     }
     
     //输入到输出直连的参数初始化为0 
@@ -560,7 +593,7 @@ void CRnnLM::initNet()
     for (aa=0; aa<direct_size; aa++) 
         syn_d[aa]=0;
     
-    if (bptt>0) 
+    if ((bptt>0) && !inference_only) 
     {
         //初始化bptt_history,bptt+bptt_block初始化为-1，后10个int由于是calloc申请，默认为0
         bptt_history=(int *)calloc((bptt+bptt_block+10), sizeof(int));
@@ -574,8 +607,9 @@ void CRnnLM::initNet()
             bptt_hidden[a].er=0;
         }
         //
-        bptt_syn0=(struct synapse *)calloc(layer0_size*layer1_size, sizeof(struct synapse));
-        if (bptt_syn0==NULL) 
+        bptt_syn0w=(struct synapse *)calloc((long long)vocab_size*layer1_size, sizeof(struct synapse));
+        bptt_syn0h=(struct synapse *)calloc(layer1_size*layer1_size, sizeof(struct synapse));
+        if ((bptt_syn0w==NULL) || (bptt_syn0h==NULL)) 
         {
             printf("Memory allocation failed\n");
             exit(1);
@@ -583,7 +617,8 @@ void CRnnLM::initNet()
     }
 
     //saveWeights里面并没有保存输入层到输出层的参数，即syn_d
-    saveWeights();
+    if (!inference_only) 
+        saveWeights();
     
     double df, dd;
     int i;
@@ -676,6 +711,7 @@ void CRnnLM::saveNet()       //will save the whole network structure
     int a, b;
     char str[1000];
     float fl;
+    double t=perf.start();
     
     sprintf(str, "%s.temp", rnnlm_file);
 
@@ -748,7 +784,7 @@ void CRnnLM::saveNet()       //will save the whole network structure
         {
             for (a=0; a<layer0_size; a++) 
             {
-                fprintf(fo, "%.4f\n", syn0[a+b*layer0_size].weight);
+                fprintf(fo, "%.4f\n", getSyn0(a, b)->weight);
             }
         }
     }
@@ -758,7 +794,7 @@ void CRnnLM::saveNet()       //will save the whole network structure
         {
             for (a=0; a<layer0_size; a++) 
             {
-                fl=syn0[a+b*layer0_size].weight;
+                fl=getSyn0(a, b)->weight;
                 fwrite(&fl, 4, 1, fo);
             }
         }
@@ -843,6 +879,7 @@ void CRnnLM::saveNet()       //will save the whole network structure
     //最后将名字更改为指定的rnnlm_file，那为啥最开始要改呢?  
     //这里不太明白 
     rename(str, rnnlm_file);
+    perf.stop(PERF_IO, t);
 }
 
 //从文件流中读取一个字符使其ascii等于delim  
@@ -869,6 +906,7 @@ void CRnnLM::restoreNet()    //will read whole network structure
     float fl;
     char str[MAX_STRING];
     double d;
+    double t=perf.start();
 
     fi=fopen(rnnlm_file, "rb");
     if (fi==NULL) 
@@ -1039,7 +1077,7 @@ void CRnnLM::restoreNet()    //will read whole network structure
             for (a=0; a<layer0_size; a++) 
             {
                 fscanf(fi, "%lf", &d);
-                syn0[a+b*layer0_size].weight=d;
+                getSyn0(a, b)->weight=d;
             }
         }
     }
@@ -1050,7 +1088,7 @@ void CRnnLM::restoreNet()    //will read whole network structure
             for (a=0; a<layer0_size; a++) 
             {
                 fread(&fl, 4, 1, fi);
-                syn0[a+b*layer0_size].weight=fl;
+                getSyn0(a, b)->weight=fl;
             }
         }
     }
@@ -1153,9 +1191,11 @@ void CRnnLM::restoreNet()    //will read whole network structure
     }
     //
     
-    saveWeights();
+    if (!inference_only) 
+        saveWeights();
 
     fclose(fi);
+    perf.stop(PERF_IO, t);
 }
 
 //清除神经元的ac,er值  
@@ -1199,9 +1239,10 @@ void CRnnLM::netReset()   //cleans hidden layer activation + bptt history
         neu1[a].ac=1.0;
     }
 
+    hidden_from_history=0;
     copyHiddenLayerToInput();
 
-    if (bptt>0) 
+    if ((bptt>0) && !inference_only) 
     {
         for (a=1; a<bptt+bptt_block; a++) 
             bptt_history[a]=0;
@@ -1395,6 +1436,7 @@ void CRnnLM::computeClassProbs(int last_word)
     //sum is used for normalization: it's better to have larger precision as many numbers are summed together here
     double sum;
     //real val1, val2, val3, val4;
+    double t=perf.start();
 
     //将last_word对应的神经元ac值为1,也可以看做是对该词的1-of-V的编码 
     if (last_word!=-1) 
@@ -1406,20 +1448,36 @@ void CRnnLM::computeClassProbs(int last_word)
     for (a=0; a<layerc_size; a++) 
         neuc[a].ac=0;
     
-    //这里计算的是s(t-1)与syn0的乘积
+    hidden_from_history=history_loaded;
+    hidden_word=last_word;
+    history_loaded=0;
+
+    //这里计算的是s(t-1)与syn0h的乘积
+    if (recurrent_input!=NULL)
+    {
+        //s(t-1) is a cluster mean whose product has been computed beforehand
+        for (a=0; a<layer1_size; a++) 
+            neu1[a].ac=recurrent_input[a];
+        recurrent_input=NULL;
+    }
+    else
+    {
 #ifdef USE_BLAS
-    cblas_dgemv(CblasRowMajor, CblasNoTrans, layer1_size, layer1_size, 1.0, &syn0[layer0_size-layer1_size].weight,
-    layer0_size, &neu0[layer0_size-layer1_size].ac, 2, 0.0, &neu1[0].ac, 2);
+        cblas_dgemv(CblasRowMajor, CblasNoTrans, layer1_size, layer1_size, 1.0, &syn0h[0].weight,
+        layer1_size, &neu0[vocab_size].ac, 2, 0.0, &neu1[0].ac, 2);
 #else
-    matrixXvector(neu1, neu0, syn0, layer0_size, 0, layer1_size, layer0_size-layer1_size, layer0_size, 0);
+        matrixXvector(neu1, neu0+vocab_size, syn0h, layer1_size, 0, layer1_size, 0, layer1_size, 0);
 #endif
+    }
 
-    //这里计算将last_word编码后的向量(大小是vocab_size,分量只有一个为1,其余为0)与syn0的乘积  
-    for (b=0; b<layer1_size; b++) 
+    //这里计算将last_word编码后的向量(大小是vocab_size,分量只有一个为1,其余为0)与syn0w的乘积  
+    //i.e. one contiguous row of syn0w is added to the hidden layer
+    a=last_word;
+    if (a!=-1) 
     {
-        a=last_word;
-        if (a!=-1) 
-            neu1[b].ac += neu0[a].ac * syn0[a+b*layer0_size].weight;
+        struct synapse *w=&syn0w[(long long)a*layer1_size];
+        for (b=0; b<layer1_size; b++) 
+            neu1[b].ac += neu0[a].ac * w[b].weight;
     }
 
     //activate 1      --sigmoid
@@ -1452,6 +1510,7 @@ void CRnnLM::computeClassProbs(int last_word)
             neuc[a].ac=1/(1+FAST_EXP(val));
         }
     }
+    t=perf.stop(PERF_HIDDEN, t);
         
     //1->2 class
     for (b=vocab_size; b<layer2_size; b++) 
@@ -1466,6 +1525,8 @@ void CRnnLM::computeClassProbs(int last_word)
 	    matrixXvector(neu2, neu1, syn1, layer1_size, vocab_size, layer2_size, 0, layer1_size, 0);
     }
 
+    t=perf.lap(PERF_CLASS, t);
+
     //apply direct connections to classes
     /*
      另外一个要说明的是最大熵模型，rnn结合了最大熵模型，直观的看上去是输入层与输出层连接了起来（虽然作者总是这么说，
@@ -1554,6 +1615,7 @@ void CRnnLM::computeClassProbs(int last_word)
                 else 
                     break;
         }
+        t=perf.stop(PERF_MAXENT, t);
     }
 
     //activation 2   --softmax on classes
@@ -1572,7 +1634,126 @@ void CRnnLM::computeClassProbs(int last_word)
     }
     for (a=vocab_size; a<layer2_size; a++) 
         neu2[a].ac/=sum;         //output layer activations now sum exactly to 1
-    
+    perf.stop(PERF_CLASS, t);
+}
+
+
+
+
+/*************************************************
+ COMPUTE RECURRENT INPUT
+ out = syn0h x s, with the same operations as in
+ computeClassProbs() (so that a cached product gives
+ exactly the same hidden layer)
+*************************************************/
+
+void CRnnLM::computeRecurrentInput(real *out, const real *s)
+{
+    int a;
+    struct neuron *src=(struct neuron *)calloc(layer1_size, sizeof(struct neuron));
+    struct neuron *dest=(struct neuron *)calloc(layer1_size, sizeof(struct neuron));
+
+    for (a=0; a<layer1_size; a++)
+        src[a].ac=s[a];
+#ifdef USE_BLAS
+    cblas_dgemv(CblasRowMajor, CblasNoTrans, layer1_size, layer1_size, 1.0, &syn0h[0].weight,
+    layer1_size, &src[0].ac, 2, 0.0, &dest[0].ac, 2);
+#else
+    matrixXvector(dest, src, syn0h, layer1_size, 0, layer1_size, 0, layer1_size, 0);
+#endif
+    for (a=0; a<layer1_size; a++)
+        out[a]=dest[a].ac;
+
+    free(src);
+    free(dest);
+}
+
+void CRnnLM::shareNet(const CRnnLM &net)
+{
+    //buffers allocated by the constructor
+    free(vocab);
+    free(vocab_hash);
+
+    *this=net;
+    shares_net=1;
+
+    //the discretizer of net is not used by the copy
+    disc_map_set=0;
+    d=NULL;
+    fsth=NULL;
+    hd=NULL;
+    recurrent_input=NULL;
+    transitions=NULL;
+    history_loaded=0;
+    hidden_from_history=0;
+    hidden_word=-1;
+
+    neu0=(struct neuron *)calloc(layer0_size, sizeof(struct neuron));
+    neu1=(struct neuron *)calloc(layer1_size, sizeof(struct neuron));
+    neuc=(struct neuron *)calloc(layerc_size, sizeof(struct neuron));
+    neu2=(struct neuron *)calloc(layer2_size, sizeof(struct neuron));
+    if ((neu0==NULL) || (neu1==NULL) || (neu2==NULL)) 
+    {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    memcpy(neu0, net.neu0, layer0_size*sizeof(struct neuron));
+    memcpy(neu1, net.neu1, layer1_size*sizeof(struct neuron));
+    if (layerc_size>0) memcpy(neuc, net.neuc, layerc_size*sizeof(struct neuron));
+    memcpy(neu2, net.neu2, layer2_size*sizeof(struct neuron));
+
+    //training buffers are never used by a copy
+    neu0b=NULL;
+    neu1b=NULL;
+    neucb=NULL;
+    neu2b=NULL;
+    neu1b2=NULL;
+    syn0wb=NULL;
+    syn0hb=NULL;
+    syn1b=NULL;
+    syncb=NULL;
+    syn_db=NULL;
+    bptt_history=NULL;
+    bptt_hidden=NULL;
+    bptt_syn0w=NULL;
+    bptt_syn0h=NULL;
+}
+
+void CRnnLM::computeHiddenLayer(struct neuron *layer, const real *rec, int last_word) const
+{
+    int a;
+    real val;
+    //local copy of d2i: FAST_EXP is not reentrant
+    union
+    {
+        double d;
+        struct
+        {
+            int j,i;
+        } n;
+    } e;
+
+    e.n.j=0;
+    for (a=0; a<layer1_size; a++) 
+        layer[a].ac=rec[a];
+    if (last_word!=-1) 
+    {
+        struct synapse *w=&syn0w[(long long)last_word*layer1_size];
+        for (a=0; a<layer1_size; a++) 
+            layer[a].ac += w[a].weight;
+    }
+    //same activation as computeClassProbs()
+    for (a=0; a<layer1_size; a++) 
+    {
+        if (layer[a].ac>50) 
+            layer[a].ac=50;
+        if (layer[a].ac<-50) 
+            layer[a].ac=-50;
+        val=-layer[a].ac;
+        e.n.i=EXP_A*(val)+(1072693248-EXP_C);
+        layer[a].ac=1/(1+e.d);
+        layer[a].er=0;
+    }
 }
 
 
@@ -1588,6 +1769,7 @@ void CRnnLM::computeClassWordProbs(int last_word, int word)
     real val;
     double sum;   //sum is used for normalization: it's better to have larger precision as many numbers are summed together here
     real val1, val2, val3, val4;
+    double t=perf.start();
    
     //1->2 word
     
@@ -1609,6 +1791,8 @@ void CRnnLM::computeClassWordProbs(int last_word, int word)
     //apply direct connections to words
     if (word!=-1) if (direct_size>0) 
     {
+        t=perf.lap(PERF_WORD, t);
+
         unsigned long long hash[MAX_NGRAM_ORDER];
             
         for (a=0; a<direct_order; a++) 
@@ -1639,6 +1823,7 @@ void CRnnLM::computeClassWordProbs(int last_word, int word)
                 else 
                     break;
         }
+        t=perf.stop(PERF_MAXENT, t);
     }
 
     //activation 2   --softmax on words
@@ -1658,6 +1843,7 @@ void CRnnLM::computeClassWordProbs(int last_word, int word)
         for (c=0; c<class_cn[vocab[word].class_index]; c++) 
             neu2[class_words[vocab[word].class_index][c]].ac/=sum;
     }
+    perf.stop(PERF_WORD, t);
 }
 
 //word表示要预测的词,last_word表示当前输入层所在的词
@@ -1673,6 +1859,8 @@ void CRnnLM::learnNet(int last_word, int word)
     if (word==-1) 
         return;
 
+    double t_perf=perf.start();
+
     //compute error vectors，计算输出层的(只含word所在类别的所有词)误差向量  
     for (c=0; c<class_cn[vocab[word].class_index]; c++) 
     {
@@ -1693,6 +1881,7 @@ void CRnnLM::learnNet(int last_word, int word)
     neu2[vocab[word].class_index+vocab_size].er=(1-neu2[vocab[word].class_index+vocab_size].ac);	//class part
     
     //计算特征所在syn_d中的下标，和上面一样，针对ME中word部分  
+    t_perf=perf.lap(PERF_BACKPROP, t_perf);
     if (direct_size>0) 
     {	//learn direct connections between words
         if (word!=-1) 
@@ -1759,6 +1948,7 @@ void CRnnLM::learnNet(int last_word, int word)
                 else 
                     break;
         }
+        t_perf=perf.stop(PERF_MAXENT, t_perf);
     }
     //
     
@@ -1847,7 +2037,7 @@ void CRnnLM::learnNet(int last_word, int word)
         }
     }
     
-    //
+    t_perf=perf.stop(PERF_BACKPROP, t_perf);
     
     ///////////////
 
@@ -1858,17 +2048,18 @@ void CRnnLM::learnNet(int last_word, int word)
         //weight update 1->0
         a=last_word;
         if (a!=-1) {
+            struct synapse *w=&syn0w[(long long)a*layer1_size];
             if ((counter%10)==0)
-            for (b=0; b<layer1_size; b++) syn0[a+b*layer0_size].weight+=alpha*neu1[b].er*neu0[a].ac - syn0[a+b*layer0_size].weight*beta2;
+            for (b=0; b<layer1_size; b++) w[b].weight+=alpha*neu1[b].er*neu0[a].ac - w[b].weight*beta2;
             else
-            for (b=0; b<layer1_size; b++) syn0[a+b*layer0_size].weight+=alpha*neu1[b].er*neu0[a].ac;
+            for (b=0; b<layer1_size; b++) w[b].weight+=alpha*neu1[b].er*neu0[a].ac;
         }
 
         if ((counter%10)==0) {
-            for (b=0; b<layer1_size; b++) for (a=layer0_size-layer1_size; a<layer0_size; a++) syn0[a+b*layer0_size].weight+=alpha*neu1[b].er*neu0[a].ac - syn0[a+b*layer0_size].weight*beta2;
+            for (b=0; b<layer1_size; b++) for (a=0; a<layer1_size; a++) syn0h[a+b*layer1_size].weight+=alpha*neu1[b].er*neu0[a+vocab_size].ac - syn0h[a+b*layer1_size].weight*beta2;
         }
         else {
-            for (b=0; b<layer1_size; b++) for (a=layer0_size-layer1_size; a<layer0_size; a++) syn0[a+b*layer0_size].weight+=alpha*neu1[b].er*neu0[a].ac;
+            for (b=0; b<layer1_size; b++) for (a=0; a<layer1_size; a++) syn0h[a+b*layer1_size].weight+=alpha*neu1[b].er*neu0[a+vocab_size].ac;
         }
     }
     else		//BPTT
@@ -1886,20 +2077,23 @@ void CRnnLM::learnNet(int last_word, int word)
                 //weight update 1->0
                 a=bptt_history[step];
                 if (a!=-1)
-                for (b=0; b<layer1_size; b++) 
                 {
-                        bptt_syn0[a+b*layer0_size].weight+=alpha*neu1[b].er;//*neu0[a].ac; --should be always set to 1
+                    struct synapse *w=&bptt_syn0w[(long long)a*layer1_size];
+                    for (b=0; b<layer1_size; b++) 
+                    {
+                        w[b].weight+=alpha*neu1[b].er;//*neu0[a].ac; --should be always set to 1
+                    }
                 }
                 
                 for (a=layer0_size-layer1_size; a<layer0_size; a++) 
                     neu0[a].er=0;
                 
-                matrixXvector(neu0, neu1, syn0, layer0_size, 0, layer1_size, layer0_size-layer1_size, layer0_size, 1);		//propagates errors 1->0
+                matrixXvector(neu0+vocab_size, neu1, syn0h, layer1_size, 0, layer1_size, 0, layer1_size, 1);		//propagates errors 1->0
                 for (b=0; b<layer1_size; b++) 
-                    for (a=layer0_size-layer1_size; a<layer0_size; a++) 
+                    for (a=0; a<layer1_size; a++) 
                     {
-                        //neu0[a].er += neu1[b].er * syn0[a+b*layer0_size].weight;
-                        bptt_syn0[a+b*layer0_size].weight+=alpha*neu1[b].er*neu0[a].ac;
+                        //neu0[a+vocab_size].er += neu1[b].er * syn0h[a+b*layer1_size].weight;
+                        bptt_syn0h[a+b*layer1_size].weight+=alpha*neu1[b].er*neu0[a+vocab_size].ac;
                     }
                 
                 for (a=0; a<layer1_size; a++) 
@@ -1930,18 +2124,18 @@ void CRnnLM::learnNet(int last_word, int word)
             {		//copy temporary syn0
                 if ((counter%10)==0) 
                 {
-                    for (a=layer0_size-layer1_size; a<layer0_size; a++) 
+                    for (a=0; a<layer1_size; a++) 
                     {
-                        syn0[a+b*layer0_size].weight+=bptt_syn0[a+b*layer0_size].weight - syn0[a+b*layer0_size].weight*beta2;
-                        bptt_syn0[a+b*layer0_size].weight=0;
+                        syn0h[a+b*layer1_size].weight+=bptt_syn0h[a+b*layer1_size].weight - syn0h[a+b*layer1_size].weight*beta2;
+                        bptt_syn0h[a+b*layer1_size].weight=0;
                     }
                 }
                 else 
                 {
-                    for (a=layer0_size-layer1_size; a<layer0_size; a++) 
+                    for (a=0; a<layer1_size; a++) 
                     {
-                        syn0[a+b*layer0_size].weight+=bptt_syn0[a+b*layer0_size].weight;
-                        bptt_syn0[a+b*layer0_size].weight=0;
+                        syn0h[a+b*layer1_size].weight+=bptt_syn0h[a+b*layer1_size].weight;
+                        bptt_syn0h[a+b*layer1_size].weight=0;
                     }
                 }
                 
@@ -1950,8 +2144,9 @@ void CRnnLM::learnNet(int last_word, int word)
                     for (step=0; step<bptt+bptt_block-2; step++) 
                         if (bptt_history[step]!=-1) 
                         {
-                            syn0[bptt_history[step]+b*layer0_size].weight+=bptt_syn0[bptt_history[step]+b*layer0_size].weight - syn0[bptt_history[step]+b*layer0_size].weight*beta2;
-                            bptt_syn0[bptt_history[step]+b*layer0_size].weight=0;
+                            a=bptt_history[step];
+                            syn0w[(long long)a*layer1_size+b].weight+=bptt_syn0w[(long long)a*layer1_size+b].weight - syn0w[(long long)a*layer1_size+b].weight*beta2;
+                            bptt_syn0w[(long long)a*layer1_size+b].weight=0;
                         }
                 }
                 else 
@@ -1959,13 +2154,15 @@ void CRnnLM::learnNet(int last_word, int word)
                     for (step=0; step<bptt+bptt_block-2; step++) 
                         if (bptt_history[step]!=-1) 
                         {
-                            syn0[bptt_history[step]+b*layer0_size].weight+=bptt_syn0[bptt_history[step]+b*layer0_size].weight;
-                            bptt_syn0[bptt_history[step]+b*layer0_size].weight=0;
+                            a=bptt_history[step];
+                            syn0w[(long long)a*layer1_size+b].weight+=bptt_syn0w[(long long)a*layer1_size+b].weight;
+                            bptt_syn0w[(long long)a*layer1_size+b].weight=0;
                         }
                 }
             }
         }
-    }	
+    }
+    perf.stop(PERF_BPTT, t_perf);
 }
 
 
@@ -1998,8 +2195,26 @@ void CRnnLM::copyHiddenLayerToInput()
 	if (disc_map_set == 1) 
     {
 		HierarchicalClusterFstHistory *p = dynamic_cast<HierarchicalClusterFstHistory *>(fsth);
-		fsth->setFstHistory(*this, *d);
+		if ((transitions!=NULL) && hidden_from_history && (p!=NULL)) 
+		{
+		    //the hidden layer only depends on the loaded clusters and on the word of the
+		    //forward pass (the input layer may hold other words, see setFstHistory())
+		    int w=-1;
+		    for (a=0; a<vocab_size; a++) 
+		        if (neu0[a].ac==1.0) w=a;
+		    if (transitions->getSuccessor(*p, hidden_word, *p)) 
+		    {
+		        if (w!=-1) p->setLastWord(w);
+		    }
+		    else 
+		        fsth->setFstHistory(*this, *d);
+		}
+		else 
+		    fsth->setFstHistory(*this, *d);
 		fsth->loadAsInput(*this, *d);
+		history_loaded=1;
+		if ((hd!=NULL) && (p!=NULL)) 
+		    recurrent_input=hd->getRecurrentInput(*p);
         //for (a=0; a<layer1_size; a++) 
         //{
         //  printf(" %.3f", neu0[a+layer0_size-layer1_size].ac);
@@ -2023,7 +2238,14 @@ void CRnnLM::trainNet()
     int a, b, word, last_word, wordcn;
     char log_name[200];
     FILE *fi, *flog;
-    clock_t start, now;
+    double start, now;		//wall-clock time, in seconds
+    char perf_label[MAX_STRING];
+
+    if (inference_only) 
+    {
+        printf("ERROR: a network loaded in inference-only mode cannot be trained\n");
+        exit(1);
+    }
 
     sprintf(log_name, "%s.output.txt", rnnlm_file);
 
@@ -2074,7 +2296,9 @@ void CRnnLM::trainNet()
             for (a=0; a<counter; a++) 
                 word=readWordIndex(fi);	//this will skip words that were already learned if the training was interrupted
         
-        start=clock();
+        perf.reset();
+        perf.setWordSet(PERF_WORDS_TRAIN);
+        start=PerfCounters::now();
         
         while (1) 
         {
@@ -2082,9 +2306,9 @@ void CRnnLM::trainNet()
     	    
     	    if ((counter%10000)==0) if ((debug_mode>1)) 
             {
-                now=clock();
+                now=PerfCounters::now();
                 if (train_words>0)
-                    printf("%cIter: %3d\tAlpha: %f\t   TRAIN entropy: %.4f    Progress: %.2f%%   Words/sec: %.1f ", 13, iter, alpha, -logp/log10(2)/counter, counter/(real)train_words*100, counter/((double)(now-start)/1000000.0));
+                    printf("%cIter: %3d\tAlpha: %f\t   TRAIN entropy: %.4f    Progress: %.2f%%   Words/sec: %.1f ", 13, iter, alpha, -logp/log10(2)/counter, counter/(real)train_words*100, counter/(now-start));
                 else
                     printf("%cIter: %3d\tAlpha: %f\t   TRAIN entropy: %.4f    Progress: %dK", 13, iter, alpha, -logp/log10(2)/counter, counter/1000);
                 fflush(stdout);
@@ -2103,6 +2327,7 @@ void CRnnLM::trainNet()
 
             if (word!=-1) 
                 logp+=log10(neu2[vocab[word].class_index+vocab_size].ac * neu2[word].ac);
+            perf.addWords(1);
     	    
     	    if ((logp!=logp) || (isinf(logp))) 
             {
@@ -2140,19 +2365,23 @@ void CRnnLM::trainNet()
                 netReset();
         }
         fclose(fi);
+        perf.setWordSet(PERF_WORDS_OTHER);
 
-	    now=clock();
-    	printf("%cIter: %3d\tAlpha: %f\t   TRAIN entropy: %.4f    Words/sec: %.1f   ", 13, iter, alpha, -logp/log10(2)/counter, counter/((double)(now-start)/1000000.0));
+	    now=PerfCounters::now();
+    	printf("%cIter: %3d\tAlpha: %f\t   TRAIN entropy: %.4f    Words/sec: %.1f   ", 13, iter, alpha, -logp/log10(2)/counter, counter/(now-start));
    
     	if (one_iter==1) 
         {	//no validation data are needed and network is always saved with modified weights
     	    printf("\n");
 	        logp=0;
     	    saveNet();
+            sprintf(perf_label, "iter %d", iter);
+            printPerfCounters(perf_label);
             break;
     	}
 
         //VALIDATION PHASE
+        perf.setWordSet(PERF_WORDS_VALID);
         netFlush();
 
         fi=fopen(valid_file, "rb");
@@ -2186,6 +2415,7 @@ void CRnnLM::trainNet()
                 logp+=log10(neu2[vocab[word].class_index+vocab_size].ac * neu2[word].ac);
                 wordcn++;
     	    }
+            perf.addWords(1);
 
             /*if (word!=-1)
                 fprintf(flog, "%d\t%f\t%s\n", word, neu2[word].ac, vocab[word].word);
@@ -2208,6 +2438,7 @@ void CRnnLM::trainNet()
                 netReset();
         }
         fclose(fi);
+        perf.setWordSet(PERF_WORDS_OTHER);
         
         fprintf(flog, "\niter: %d\n", iter);
         fprintf(flog, "valid log probability: %f\n", logp);
@@ -2216,6 +2447,8 @@ void CRnnLM::trainNet()
         fclose(flog);
     
         printf("VALID entropy: %.4f\n", -logp/log10(2)/wordcn);
+        fflush(stdout);
+        sprintf(perf_label, "iter %d", iter);
         
         counter=0;
 	    train_cur_pos=0;
@@ -2232,6 +2465,7 @@ void CRnnLM::trainNet()
             else 
             {
                 saveNet();
+                printPerfCounters(perf_label);
                 break;
             }
         }
@@ -2242,6 +2476,7 @@ void CRnnLM::trainNet()
         logp=0;
         iter++;
         saveNet();
+        printPerfCounters(perf_label);
     }
 }
 
@@ -2252,7 +2487,15 @@ void CRnnLM::testNet()
     char str[MAX_STRING];
     real prob_other, log_other, log_combine, f;
     
+    if ((dynamic>0) && inference_only) 
+    {
+        printf("ERROR: dynamic models cannot be used in inference-only mode\n");
+        exit(1);
+    }
+    
+    perf.reset();
     restoreNet();
+    perf.setWordSet(PERF_WORDS_TEST);
     
     if (use_lmprob) {
 	lmprob=fopen(lmprob_file, "rb");
@@ -2287,7 +2530,7 @@ void CRnnLM::testNet()
     real utt_logp =0.0;
     
     
-    if (bptt>0) for (a=0; a<bptt+bptt_block; a++) bptt_history[a]=-1;
+    if ((bptt>0) && !inference_only) for (a=0; a<bptt+bptt_block; a++) bptt_history[a]=-1;
     for (a=0; a<MAX_NGRAM_ORDER; a++) history[a]=0;
     if (independent) netReset();
     
@@ -2318,6 +2561,7 @@ void CRnnLM::testNet()
     	    log_other+=log10(prob_other);
             wordcn++;
         }
+        perf.addWords(1);
 
 	if (debug_mode>1) {
     	    if (use_lmprob) {
@@ -2393,6 +2637,7 @@ void CRnnLM::testNet()
     }
     
     fclose(flog);
+    printPerfCounters("test");
 }
 
 void CRnnLM::testNbest()
@@ -2406,7 +2651,9 @@ void CRnnLM::testNbest()
     int nbest_cn=0;
     char ut1[MAX_STRING], ut2[MAX_STRING];
 
+    perf.reset();
     restoreNet();
+    perf.setWordSet(PERF_WORDS_TEST);
     computeNet(0, 0);
     copyHiddenLayerToInput();
     saveContext();
@@ -2496,6 +2743,7 @@ void CRnnLM::testNbest()
     	    }
     	    wordcn++;
         }
+        perf.addWords(1);
         
         //learnNet(last_word, word);    //*** this will be in implemented for dynamic models
         copyHiddenLayerToInput();
@@ -2532,6 +2780,7 @@ void CRnnLM::testNbest()
     }
 
     fclose(flog);
+    printPerfCounters("nbest");
 }
 
 void CRnnLM::testGen()
@@ -16,6 +16,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include "perf_counters.h"
 //#include "hierarchical_cluster_discretizer.h"
 //#include "hierarchical_cluster_fsthistory.h"
 
@@ -30,6 +31,8 @@ typedef double direct_t;	// doubles for ME weights; TODO: check why floats are n
 typedef double real;
 class FstHistory;
 class Discretizer;
+class HierarchicalClusterDiscretizer;
+class TransitionTable;
 
 //rnn中神经元结构,两部分  
 //ac表示激活值,er表示误差值,er用在网络学习时 
@@ -142,10 +145,29 @@ protected:
     int disc_map_set;
     Discretizer *d;
     FstHistory *fsth;
+    HierarchicalClusterDiscretizer *hd;	//d if it is a hierarchical cluster discretizer
     ///////////////////
     
+    //precomputed product of the recurrent weights and of the recurrent part of the
+    //input layer (e.g. a cluster mean), used and reset by the next computeClassProbs()
+    const real *recurrent_input;
+    
+    //successors of the hierarchical clusters (NULL: the hidden layer is discretized);
+    //history_loaded is set when a discretized history has been loaded as input and
+    //hidden_from_history when the last hidden layer has been computed from it, with
+    //the word hidden_word
+    const TransitionTable *transitions;
+    int history_loaded;
+    int hidden_from_history;
+    int hidden_word;
+    
     //one_iter==1的话,只会训练一遍 
     int one_iter;
+    //inference_only!=0: the model is only used for forward passes (testing, tracing, conversion),
+    //the training backups and the BPTT buffers are not allocated
+    int inference_only;
+    //shares_net!=0: the weights, vocabulary and classes belong to another network (see shareNet())
+    int shares_net;
     //表示每训练anti_k个word,会将网络信息保存到rnnlm_file 
     int anti_k;
     
@@ -199,7 +221,8 @@ protected:
     //bptt_hidden从下标0开始存放的是st,st-1,st-2...  
     neuron *bptt_hidden;
     //隐层到输入层的权值,这个使用在BPTT时的 
-    struct synapse *bptt_syn0;
+    struct synapse *bptt_syn0w;
+    struct synapse *bptt_syn0h;
     
     int gen;
     
@@ -213,7 +236,11 @@ protected:
     struct neuron *neuc;        //neurons in hidden layer
     struct neuron *neu2;		//neurons in output layer
 
-    struct synapse *syn0;		//weights between input and hidden layer
+    //weights between input and hidden layer, stored as two separate matrices:
+    //syn0w is vocab_size x layer1_size (one contiguous row of hidden weights per word),
+    //syn0h is layer1_size x layer1_size (recurrent weights, row b feeds hidden neuron b)
+    struct synapse *syn0w;
+    struct synapse *syn0h;
     struct synapse *syn1;		//weights between hidden and output layer (or hidden and compression if compression>0)
     struct synapse *sync;		//weights between hidden and compression layer
     direct_t *syn_d;			//direct parameters between input and output layer (similar to Maximum Entropy model parameters)
@@ -224,7 +251,8 @@ protected:
     struct neuron *neucb;
     struct neuron *neu2b;
 
-    struct synapse *syn0b;
+    struct synapse *syn0wb;
+    struct synapse *syn0hb;
     struct synapse *syn1b;
     struct synapse *syncb;
     direct_t *syn_db;
@@ -232,6 +260,9 @@ protected:
     //backup used in n-bset rescoring:
     struct neuron *neu1b2;
     
+    //wall-clock time spent in the different phases (see perf_counters.h)
+    PerfCounters perf;
+    
     
 public:
 
@@ -252,7 +283,13 @@ public:
         disc_map_set = 0;
         d = NULL;
         fsth = NULL;
+        hd = NULL;
         //////////////////
+        recurrent_input = NULL;
+        transitions = NULL;
+        history_loaded = 0;
+        hidden_from_history = 0;
+        hidden_word = -1;
         
         train_file[0]=0;
         valid_file[0]=0;
@@ -287,7 +324,8 @@ public:
         bptt_block=10;
         bptt_history=NULL;
         bptt_hidden=NULL;
-        bptt_syn0=NULL;
+        bptt_syn0w=NULL;
+        bptt_syn0h=NULL;
         
         gen=0;
         
@@ -298,7 +336,8 @@ public:
         neuc=NULL;
         neu2=NULL;
         
-        syn0=NULL;
+        syn0w=NULL;
+        syn0h=NULL;
         syn1=NULL;
         sync=NULL;
         syn_d=NULL;
@@ -311,7 +350,8 @@ public:
         
         neu1b2=NULL;
         
-        syn0b=NULL;
+        syn0wb=NULL;
+        syn0hb=NULL;
         syn1b=NULL;
         syncb=NULL;
         //
@@ -322,6 +362,8 @@ public:
         old_classes=0;
         
         one_iter=0;
+        inference_only=0;
+        shares_net=0;
         
         debug_mode=1;
         srand(rand_seed);
@@ -334,6 +376,16 @@ public:
     {
         int i;
         
+        if (shares_net) 
+        {
+            //only the activations belong to this network
+            free(neu0);
+            free(neu1);
+            if (neuc!=NULL) free(neuc);
+            free(neu2);
+            return;
+        }
+        
         if (neu0!=NULL) 
         {
             free(neu0);
@@ -341,7 +393,8 @@ public:
             if (neuc!=NULL) free(neuc);
             free(neu2);
             
-            free(syn0);
+            free(syn0w);
+            free(syn0h);
             free(syn1);
             if (sync!=NULL) free(sync);
             
@@ -356,7 +409,8 @@ public:
             
             free(neu1b2);
             
-            free(syn0b);
+            free(syn0wb);
+            free(syn0hb);
             free(syn1b);
             if (syncb!=NULL) free(syncb);
             //
@@ -372,7 +426,8 @@ public:
             
             if (bptt_history!=NULL) free(bptt_history);
             if (bptt_hidden!=NULL) free(bptt_hidden);
-            if (bptt_syn0!=NULL) free(bptt_syn0);
+            if (bptt_syn0w!=NULL) free(bptt_syn0w);
+            if (bptt_syn0h!=NULL) free(bptt_syn0h);
             
             //todo: free bptt variables too
         }
@@ -414,6 +469,12 @@ public:
     void setDebugMode(int newDebug) {debug_mode=newDebug;}
     void setAntiKasparek(int newAnti) {anti_k=newAnti;}
     void setOneIter(int newOneIter) {one_iter=newOneIter;}
+    //has to be called before restoreNet()
+    void setInferenceOnly(int newVal) {inference_only=newVal;}
+    void setPerfMode(int newMode) {perf.setMode(newMode); perf.reset();}
+    PerfCounters &getPerfCounters() {return perf;}
+    //prints the performance summary to stderr (if enabled) and clears the counters
+    void printPerfCounters(const char *label);
     
     struct neuron *getInputLayer() const { return neu0; }
     struct neuron *getHiddenLayer() const { return neu1; }
@@ -430,7 +491,15 @@ public:
     int getWordFromClass(int nth_w, int cl) const { return class_words[cl][nth_w]; }
     const char* getWordString(int word) const { return vocab[word].word; }
     int getWordCount(int word) const { return vocab[word].cn; }
-    real getInputHiddenSynapse(int input_i, int hidden_i) { return syn0[input_i*layer1_size+hidden_i].weight; }
+    real getInputHiddenSynapse(int input_i, int hidden_i) { return getSyn0(input_i, hidden_i)->weight; }
+    
+    //weight between input neuron a (word or previous hidden state) and hidden neuron b,
+    //with the same meaning as the former syn0[a+b*layer0_size]
+    struct synapse *getSyn0(int a, int b)
+    {
+        if (a<vocab_size) return &syn0w[(long long)a*layer1_size+b];
+        return &syn0h[(a-vocab_size)+b*layer1_size];
+    }
     
     //返回单词的哈希值  
     int getWordHash(char *word);
@@ -478,6 +547,20 @@ public:
     void computeNet(int last_word, int word);
     void computeClassWordProbs(int last_word, int word);
     void computeClassProbs(int last_word);
+    //out = syn0h x s (layer1_size values), as computed by computeClassProbs() for a recurrent input s
+    void computeRecurrentInput(real *out, const real *s);
+    //the next computeClassProbs() uses p (or the input layer if p is NULL) as syn0h x s(t-1)
+    void setRecurrentInput(const real *p) {recurrent_input=p;}
+    //layer = sigmoid(rec + row of last_word in syn0w), i.e. the hidden layer computed by
+    //computeClassProbs() from a recurrent product rec (thread-safe, the network is not modified)
+    void computeHiddenLayer(struct neuron *layer, const real *rec, int last_word) const;
+    //makes this (newly constructed) network a copy of net for forward passes only: the weights,
+    //vocabulary and classes of net are shared (net must outlive this copy), the activations are
+    //copied; forward passes of different copies can run in different threads
+    void shareNet(const CRnnLM &net);
+    //with a discretizer, successors are read from the table instead of discretizing the
+    //hidden layer when it has been computed from a hierarchical cluster history
+    void setTransitionTable(const TransitionTable *t) {transitions=t;}
     //反传误差,更新网络权值
     void learnNet(int last_word, int word);
     //将隐层神经元的ac值复制到输入层后layer1_size那部分
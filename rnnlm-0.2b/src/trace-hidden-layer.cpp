@@ -10,14 +10,79 @@
 
 #include "rnnlmlib.h"
 #include "abstract_discretizer.h"
+#include "hierarchical_cluster_discretizer.h"
 #include <string>
 #include <vector>
 
+//number of hidden vectors discretized at once with -discretize
+#define TRACE_BATCH 4096
+
 int debug_mode = 0;
 bool word_id = false;
+int perf_mode = PERF_OFF;
 
 using namespace std;
 
+//with -discretize, the hidden layers are buffered and the cluster ids of all
+//the levels are printed instead of the activations
+Discretizer *dzer = NULL;
+vector<real> batch_x;
+vector<int> batch_n;
+vector<int> batch_w;
+
+void flushTraceBatch(CRnnLM &rnnlm) 
+{
+	int rows = batch_n.size();
+	if (rows == 0) 
+		return;
+	int code_size = dzer->getCodeSize();
+	vector<int> ids(rows*code_size);
+	dzer->discretizeBatch(&ids[0], &batch_x[0], rows, rnnlm.getHiddenLayerSize());
+	for (int r = 0; r < rows; r++) 
+	{
+		printf("%i\t",batch_n[r]);
+		if (word_id) 
+		{
+			printf("%i\t",batch_w[r]);
+		}
+		for (int j = 0; j < code_size-1; j++) 
+		{
+			printf("%i\t",ids[r*code_size+j]);
+		}
+		printf("%i\n",ids[r*code_size+code_size-1]);
+	}
+	batch_x.clear();
+	batch_n.clear();
+	batch_w.clear();
+}
+
+void printTrace(int n, int last_word, const struct neuron *hid, CRnnLM &rnnlm) 
+{
+	int j;
+	if (dzer != NULL) 
+	{
+		for (j = 0; j < rnnlm.getHiddenLayerSize(); j++) 
+		{
+			batch_x.push_back(hid[j].ac);
+		}
+		batch_n.push_back(n);
+		batch_w.push_back(last_word);
+		if ((int) batch_n.size() == TRACE_BATCH) 
+			flushTraceBatch(rnnlm);
+		return;
+	}
+	printf("%i\t",n);
+	if (word_id) 
+	{
+		printf("%i\t",last_word);
+	}
+	for (j = 0; j < rnnlm.getHiddenLayerSize()-1; j++) 
+	{
+		printf("%.6f\t",hid[j].ac);
+	}
+	printf("%.6f\n",hid[j].ac);
+}
+
 void traceHiddenLayer(string fn, CRnnLM &rnnlm) 
 {
 	int n=0;
@@ -31,7 +96,9 @@ void traceHiddenLayer(string fn, CRnnLM &rnnlm)
     struct neuron* hid = rnnlm.getHiddenLayer();
     struct neuron* out = rnnlm.getOutputLayer();
     
+    rnnlm.getPerfCounters().reset();
     rnnlm.restoreNet();
+    rnnlm.getPerfCounters().setWordSet(PERF_WORDS_TEST);
     
     fi=fopen(fn.c_str(), "rb");
 
@@ -41,18 +108,7 @@ void traceHiddenLayer(string fn, CRnnLM &rnnlm)
     log_combine=0;
     prob_other=0;
     rnnlm.copyHiddenLayerToInput();
-	vector<real> one_trace;
-	int j;
-	printf("%i\t",n);
-	if (word_id) 
-    {
-		printf("%i\t",last_word);
-	}
-	for (j = 0; j < rnnlm.getHiddenLayerSize()-1; j++) 
-    {
-		printf("%.6f\t",hid[j].ac);
-	}
-	printf("%.6f\n",hid[j].ac);
+	printTrace(n, last_word, hid, rnnlm);
 	fprintf(stderr, "%i\n", n);
 	n++;
     while (1) 
@@ -61,17 +117,7 @@ void traceHiddenLayer(string fn, CRnnLM &rnnlm)
         rnnlm.computeNet(last_word, word);		//compute probability distribution
         
         //trace
-		vector<real> one_trace;
-		printf("%i\t",n);
-		if (word_id) 
-        {
-			printf("%i\t",last_word);
-		}
-		for (j = 0; j < rnnlm.getHiddenLayerSize()-1; j++) 
-        {
-			printf("%.6f\t",hid[j].ac);
-		}
-		printf("%.6f\n",hid[j].ac);
+		printTrace(n, last_word, hid, rnnlm);
 		if (n > 367390 && n < 367410) 
         {
 		    fprintf(stderr, "%i\t%i\n", last_word, n);
@@ -79,6 +125,7 @@ void traceHiddenLayer(string fn, CRnnLM &rnnlm)
 		n++;
         if (feof(fi)) 
             break;		//end of file
+        rnnlm.getPerfCounters().addWords(1);
 
         rnnlm.copyHiddenLayerToInput();
         
@@ -87,7 +134,10 @@ void traceHiddenLayer(string fn, CRnnLM &rnnlm)
         last_word=word;
     }
     fclose(fi);
+    if (dzer != NULL) 
+        flushTraceBatch(rnnlm);
 
+    rnnlm.printPerfCounters("trace");
 }
 
 
@@ -114,10 +164,15 @@ int main(int argc, char **argv)
 
     int rnnlm_file_set=0;
     int txt_file_set=0;
+    int disc_map_file_set=0;
+    int tree_beam=0;
+    real index_eps=-1;
+    int index_checks=0;
     int rnnlm_exist=0;
     
     char rnnlm_file[MAX_STRING];
     char txt_file[MAX_STRING];
+    char disc_map_file[MAX_STRING];
     
     FILE *f;
     
@@ -131,7 +186,7 @@ int main(int argc, char **argv)
 
     	fprintf(stderr,"Converts a recurrent neural network into a finite state transducer in order to integrate long-span information within the decoding process\n\n");
     	
-    	fprintf(stderr,"Syntax:\n\ttrace-hidden-layer [-with-word-id] -rnnlm <rnn_model> -text <text>\n\n");
+    	fprintf(stderr,"Syntax:\n\ttrace-hidden-layer [-with-word-id] [-discretize <kmeans_file> [-tree-search <beam>] [-cluster-index <eps> [-index-checks <N>]]] [-perf-stats|-perf-json] -rnnlm <rnn_model> -text <text>\n\n");
 
     	return 0;	//***
     }
@@ -164,6 +219,13 @@ int main(int argc, char **argv)
 
     
     
+    //set performance counters (printed to stderr)
+    i=argPos((char *)"-perf-stats", argc, argv);
+    if (i>0) perf_mode=PERF_TEXT;
+    i=argPos((char *)"-perf-json", argc, argv);
+    if (i>0) perf_mode=PERF_JSON;
+    
+    
     //search for rnnlm file
     i=argPos((char *)"-rnnlm", argc, argv);
     if (i>0) 
@@ -205,6 +267,57 @@ int main(int argc, char **argv)
     }    
     
 
+    //set discretization map file (hidden layers are then printed as cluster ids)
+    i=argPos((char *)"-discretize", argc, argv);
+    if (i>0) {
+        if (i+1==argc) {
+            fprintf(stderr,"ERROR: discretization map file not specified!\n");
+            return 0;
+        }
+
+        strcpy(disc_map_file, argv[i+1]);
+
+        if (debug_mode>0)
+        fprintf(stderr,"discretization map file: %s\n", disc_map_file);
+        disc_map_file_set=1;
+    }
+    
+    //set beam of the cluster tree descent
+    i=argPos((char *)"-tree-search", argc, argv);
+    if (i>0) {
+        if (i+1==argc) {
+            fprintf(stderr,"ERROR: tree search beam not specified!\n");
+            return 0;
+        }
+
+        tree_beam=atoi(argv[i+1]);
+
+        if (debug_mode>0)
+        fprintf(stderr,"tree search beam: %d\n", tree_beam);
+    }
+    
+    //set centroid index
+    i=argPos((char *)"-cluster-index", argc, argv);
+    if (i>0) {
+        if (i+1==argc) {
+            fprintf(stderr,"ERROR: cluster index approximation factor not specified!\n");
+            return 0;
+        }
+
+        index_eps=atof(argv[i+1]);
+    }
+    
+    i=argPos((char *)"-index-checks", argc, argv);
+    if (i>0) {
+        if (i+1==argc) {
+            fprintf(stderr,"ERROR: maximum number of index checks not specified!\n");
+            return 0;
+        }
+
+        index_checks=atoi(argv[i+1]);
+    }
+    
+
 // 	if (disc_map_file_set == 0) {
 //         printf("ERROR: no discretization map file specified! Use option -discretize.\n");
 //         return 0;
@@ -215,8 +328,19 @@ int main(int argc, char **argv)
     srand(1);
 	rnnlm.setRnnLMFile(rnnlm_file);
 	rnnlm.setDebugMode(debug_mode);
+	rnnlm.setPerfMode(perf_mode);
+	rnnlm.setInferenceOnly(1);
 	rnnlm.restoreNet();
 	
+	if (disc_map_file_set == 1) 
+	{
+		HierarchicalClusterDiscretizer *hd = new HierarchicalClusterDiscretizer(rnnlm.getHiddenLayerSize(), string(disc_map_file));
+		hd->setTreeSearch(tree_beam);
+		if (index_eps >= 0) 
+			hd->setIndex(index_eps, index_checks);
+		dzer = hd;
+	}
+	
 	
 	//Test RNN
 	traceHiddenLayer(txt_file, rnnlm);
@@ -0,0 +1,277 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Compute the projections of a sign-projection (LSH) discretizer (see
+// lsh_discretizer.h) on a hidden layer trace (as written by
+// trace-hidden-layer, with or without word ids). Projections are random
+// Gaussian directions, or the principal directions of the trace with
+// -pca. Thresholds are the medians of the projections, so that each bit
+// splits the trace in two halves. The projections are written to the
+// standard output, the most reliable bits first.
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include "utils.h"
+
+using namespace std;
+
+#define MAX_BITS 32
+
+int argPos(char *str, int argc, char **argv)
+{
+    int a;
+
+    for (a=1; a<argc; a++) if (!strcmp(str, argv[a])) return a;
+
+    return -1;
+}
+
+/**
+ * Number of leading integer fields of a trace line (position, and word id
+ * with -with-word-id): the neurons are always written with a decimal point
+ */
+int countLeadingFields(const string &line)
+{
+	istringstream strstr(line);
+	string field;
+	int n = 0;
+	while ((strstr >> field) && (field.find('.') == string::npos)) n++;
+	return n;
+}
+
+//uniform value in ]0,1[
+real uniform(unsigned int &seed)
+{
+	seed = seed*1103515245+12345;
+	return ((seed/65536)%32768+0.5)/32768.0;
+}
+
+real gaussian(unsigned int &seed)
+{
+	real u = uniform(seed);
+	real v = uniform(seed);
+	return sqrt(-2.0*log(u))*cos(2.0*M_PI*v);
+}
+
+//orthonormalizes the k rows of the k x d matrix q (modified Gram-Schmidt)
+void orthonormalize(vector<real> &q, int k, int d)
+{
+	for (int a = 0; a < k; a++)
+	{
+		for (int b = 0; b < a; b++)
+		{
+			real s = 0.0;
+			for (int i = 0; i < d; i++) s += q[a*d+i]*q[b*d+i];
+			for (int i = 0; i < d; i++) q[a*d+i] -= s*q[b*d+i];
+		}
+		real norm = 0.0;
+		for (int i = 0; i < d; i++) norm += q[a*d+i]*q[a*d+i];
+		norm = sqrt(norm)+1e-30;
+		for (int i = 0; i < d; i++) q[a*d+i] /= norm;
+	}
+}
+
+/**
+ * k principal directions of the n x d matrix x (centered with mean) by
+ * subspace iteration on the covariance matrix, stored as the rows of q
+ */
+void principalDirections(const vector<real> &x, int n, int d, const vector<real> &mean, int k, unsigned int &seed, vector<real> &q)
+{
+	vector<real> cov(d*d, 0.0);
+	for (int r = 0; r < n; r++)
+	{
+		const real *v = &x[(size_t) r*d];
+		for (int i = 0; i < d; i++)
+		{
+			for (int j = 0; j <= i; j++) cov[i*d+j] += (v[i]-mean[i])*(v[j]-mean[j]);
+		}
+	}
+	for (int i = 0; i < d; i++)
+	{
+		for (int j = 0; j < i; j++) cov[j*d+i] = cov[i*d+j];
+	}
+
+	q.resize(k*d);
+	for (size_t i = 0; i < q.size(); i++) q[i] = gaussian(seed);
+	orthonormalize(q, k, d);
+	vector<real> z(k*d);
+	for (int it = 0; it < 100; it++)
+	{
+		for (int a = 0; a < k; a++)
+		{
+			for (int i = 0; i < d; i++)
+			{
+				real s = 0.0;
+				for (int j = 0; j < d; j++) s += cov[i*d+j]*q[a*d+j];
+				z[a*d+i] = s;
+			}
+		}
+		q = z;
+		orthonormalize(q, k, d);
+	}
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    int n_bits = 0;
+    int n_dims = 0;
+    int n_lead = -1;
+    int max_vectors = 0;
+    bool pca = false;
+    real weak_rate = 0.1;
+    unsigned int seed = 1;
+    string trace_file;
+
+    if (argc==1)
+    {
+    	fprintf(stderr,"Computes the projections of a sign-projection discretizer on a hidden layer trace\n\n");
+    	fprintf(stderr,"Syntax:\n\ttrain-lsh -trace <trace_file> -bits <B> [-pca] [-weak <rate>] [-dims <N>] [-max-vectors <N>] [-rand-seed <S>] > <projection_file>\n\n");
+    	fprintf(stderr,"\t-bits is at most %i\n", MAX_BITS);
+    	fprintf(stderr,"\t-weak is the rate of trace vectors for which a bit is considered as weak (default: 0.1)\n");
+    	fprintf(stderr,"\t-dims is the size of the hidden layer (default: number of fields of the first line minus its leading\n");
+    	fprintf(stderr,"\t      integer fields, i.e. the position and, with -with-word-id, the word id)\n");
+    	return 0;
+    }
+
+    i=argPos((char *)"-trace", argc, argv);
+    if ((i>0) && (i+1<argc)) trace_file = argv[i+1];
+    i=argPos((char *)"-bits", argc, argv);
+    if ((i>0) && (i+1<argc)) n_bits = atoi(argv[i+1]);
+    i=argPos((char *)"-pca", argc, argv);
+    if (i>0) pca = true;
+    i=argPos((char *)"-weak", argc, argv);
+    if ((i>0) && (i+1<argc)) weak_rate = atof(argv[i+1]);
+    i=argPos((char *)"-dims", argc, argv);
+    if ((i>0) && (i+1<argc)) n_dims = atoi(argv[i+1]);
+    i=argPos((char *)"-max-vectors", argc, argv);
+    if ((i>0) && (i+1<argc)) max_vectors = atoi(argv[i+1]);
+    i=argPos((char *)"-rand-seed", argc, argv);
+    if ((i>0) && (i+1<argc)) seed = atoi(argv[i+1]);
+
+    if (trace_file.empty() || (n_bits <= 0) || (n_bits > MAX_BITS))
+    {
+    	fprintf(stderr,"ERROR: -trace and -bits (1 to %i) have to be specified!\n", MAX_BITS);
+    	return 1;
+    }
+
+    //last n_dims fields of each line are the hidden layer
+    vector<real> x;
+    vector<real> fields;
+    int n = 0;
+    fstream in (trace_file.c_str());
+    if (!in)
+    {
+    	fprintf(stderr,"ERROR: cannot open %s\n", trace_file.c_str());
+    	return 1;
+    }
+    string line;
+    while (getline(in, line) && ((max_vectors <= 0) || (n < max_vectors)))
+    {
+    	istringstream strstr(line);
+    	real v;
+    	fields.clear();
+    	while (strstr >> v) fields.push_back(v);
+    	if (n_lead < 0) n_lead = countLeadingFields(line);
+    	if (n_dims == 0) n_dims = (int) fields.size()-n_lead;
+    	if ((n_dims <= 0) || ((int) fields.size() < n_dims)) continue;
+    	x.insert(x.end(), fields.end()-n_dims, fields.end());
+    	n++;
+    }
+    in.close();
+
+    if (n == 0)
+    {
+    	fprintf(stderr,"ERROR: no hidden layer found in %s\n", trace_file.c_str());
+    	return 1;
+    }
+    fprintf(stderr, "%i vectors of %i dims\n", n, n_dims);
+
+    vector<real> mean(n_dims, 0.0);
+    for (int r = 0; r < n; r++)
+    {
+    	for (i = 0; i < n_dims; i++) mean[i] += x[(size_t) r*n_dims+i]/n;
+    }
+
+    //projections: principal directions first (at most n_dims), random directions then
+    vector<real> proj;
+    int n_pca = pca ? min(n_bits, n_dims) : 0;
+    if (n_pca > 0) principalDirections(x, n, n_dims, mean, n_pca, seed, proj);
+    for (int b = n_pca; b < n_bits; b++)
+    {
+    	real norm = 0.0;
+    	for (i = 0; i < n_dims; i++)
+    	{
+    		proj.push_back(gaussian(seed));
+    		norm += proj.back()*proj.back();
+    	}
+    	norm = sqrt(norm);
+    	for (i = 0; i < n_dims; i++) proj[b*n_dims+i] /= norm;
+    }
+
+    //statistics of each bit
+    vector<real> y(n), margin(n);
+    vector<real> threshold(n_bits), weak(n_bits), p1(n_bits), value0(n_bits), value1(n_bits);
+    vector< pair<real,int> > reliability;
+    for (int b = 0; b < n_bits; b++)
+    {
+    	real sum = 0.0, sum2 = 0.0;
+    	for (int r = 0; r < n; r++)
+    	{
+    		real s = 0.0;
+    		for (i = 0; i < n_dims; i++) s += proj[b*n_dims+i]*x[(size_t) r*n_dims+i];
+    		y[r] = s;
+    		sum += s;
+    		sum2 += s*s;
+    	}
+    	vector<real> sorted(y);
+    	nth_element(sorted.begin(), sorted.begin()+n/2, sorted.end());
+    	threshold[b] = sorted[n/2];
+
+    	int n1 = 0;
+    	real s0 = 0.0, s1 = 0.0;
+    	for (int r = 0; r < n; r++)
+    	{
+    		margin[r] = fabs(y[r]-threshold[b]);
+    		if (y[r] > threshold[b]) { n1++; s1 += y[r]; }
+    		else { s0 += y[r]; }
+    	}
+    	value0[b] = (n1 < n) ? s0/(n-n1) : threshold[b];
+    	value1[b] = (n1 > 0) ? s1/n1 : threshold[b];
+    	p1[b] = (n1+1.0)/(n+2.0);
+    	int q = (int) (weak_rate*n);
+    	if (q <= 0) { weak[b] = 0.0; }
+    	else
+    	{
+    		nth_element(margin.begin(), margin.begin()+min(q, n-1), margin.end());
+    		weak[b] = margin[min(q, n-1)];
+    	}
+
+    	//distance between the two halves relative to the spread of the projection
+    	real sd = sqrt(max(sum2/n-(sum/n)*(sum/n), (real) 1e-30));
+    	reliability.push_back(make_pair(-(value1[b]-value0[b])/sd, b));
+    }
+    sort(reliability.begin(), reliability.end());
+
+    printf("# %i projections of %i neurons\n", n_bits, n_dims);
+    for (int k = 0; k < n_bits; k++)
+    {
+    	int b = reliability[k].second;
+    	printf("%.6f %.6f %.6f %.6f %.6f", (double) threshold[b], (double) weak[b], (double) p1[b], (double) value0[b], (double) value1[b]);
+    	for (i = 0; i < n_dims; i++) printf(" %.6f", (double) proj[b*n_dims+i]);
+    	printf("\n");
+    }
+    printf("--\n");
+    for (i = 0; i < n_dims; i++) printf((i > 0) ? " %.6f" : "%.6f", (double) mean[i]);
+    printf("\n");
+
+    return 0;
+}
@@ -0,0 +1,197 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Train the codebooks of a product quantizer (see pq_discretizer.h) on
+// a hidden layer trace (as written by trace-hidden-layer, with or without
+// word ids): the hidden layer is split into M sub-spaces of consecutive
+// neurons and each of them is clustered into K codewords by the k-means
+// of kmeans/ (seq_kmeans.c).
+// The codebooks are written to the standard output.
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include "utils.h"
+
+extern "C" {
+#include "kmeans.h"
+}
+
+using namespace std;
+
+int argPos(char *str, int argc, char **argv)
+{
+    int a;
+
+    for (a=1; a<argc; a++) if (!strcmp(str, argv[a])) return a;
+
+    return -1;
+}
+
+/**
+ * Number of leading integer fields of a trace line (position, and word id
+ * with -with-word-id): the neurons are always written with a decimal point
+ */
+int countLeadingFields(const string &line)
+{
+	istringstream strstr(line);
+	string field;
+	int n = 0;
+	while ((strstr >> field) && (field.find('.') == string::npos)) n++;
+	return n;
+}
+
+/**
+ * k-means (kmeans/seq_kmeans.c) of the columns first ... first+d-1 of
+ * the n x ld matrix x, codewords are stored in c (k x d), add-one smoothed
+ * priors in prior. The vectors are shuffled first, seq_kmeans() starting
+ * from the first k of them.
+ */
+void trainCodebook(const vector<real> &x, int n, int ld, int first, int d, int k, float threshold, unsigned int &seed, vector<real> &c, vector<real> &prior)
+{
+	vector<int> order(n);
+	vector<float> sub((size_t) n*d);
+	vector<float *> objects(n);
+	vector<int> membership(n);
+	vector<int> count(k, 0);
+
+	for (int r = 0; r < n; r++) order[r] = r;
+	for (int r = n-1; r > 0; r--)
+	{
+		seed = seed*1103515245+12345;
+		swap(order[r], order[(seed/65536)%(r+1)]);
+	}
+	for (int r = 0; r < n; r++)
+	{
+		for (int i = 0; i < d; i++) sub[(size_t) r*d+i] = (float) x[(size_t) order[r]*ld+first+i];
+		objects[r] = &sub[(size_t) r*d];
+	}
+
+	float **clusters = seq_kmeans(&objects[0], d, n, k, threshold, &membership[0]);
+
+	c.resize((size_t) k*d);
+	prior.resize(k);
+	for (int j = 0; j < k; j++)
+	{
+		for (int i = 0; i < d; i++) c[(size_t) j*d+i] = clusters[j][i];
+	}
+	for (int r = 0; r < n; r++) count[membership[r]]++;
+	for (int j = 0; j < k; j++)
+	{
+		prior[j] = (count[j]+1.0)/(n+k);
+	}
+	free(clusters[0]);
+	free(clusters);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    int n_sub = 0;
+    int n_codes = 0;
+    int n_dims = 0;
+    int n_lead = -1;
+    float threshold = 0.001;
+    int max_vectors = 0;
+    unsigned int seed = 1;
+    string trace_file;
+
+    if (argc==1)
+    {
+    	fprintf(stderr,"Trains the codebooks of a product quantizer on a hidden layer trace\n\n");
+    	fprintf(stderr,"Syntax:\n\ttrain-pq -trace <trace_file> -subspaces <M> -codes <K> [-dims <N>] [-threshold <T>] [-max-vectors <N>] [-rand-seed <S>] > <codebook_file>\n\n");
+    	fprintf(stderr,"\t-dims is the size of the hidden layer (default: number of fields of the first line minus its leading\n");
+    	fprintf(stderr,"\t      integer fields, i.e. the position and, with -with-word-id, the word id)\n");
+    	fprintf(stderr,"\t-threshold is the fraction of vectors changing of codeword below which k-means stops (default: 0.001)\n");
+    	return 0;
+    }
+
+    i=argPos((char *)"-trace", argc, argv);
+    if ((i>0) && (i+1<argc)) trace_file = argv[i+1];
+    i=argPos((char *)"-subspaces", argc, argv);
+    if ((i>0) && (i+1<argc)) n_sub = atoi(argv[i+1]);
+    i=argPos((char *)"-codes", argc, argv);
+    if ((i>0) && (i+1<argc)) n_codes = atoi(argv[i+1]);
+    i=argPos((char *)"-dims", argc, argv);
+    if ((i>0) && (i+1<argc)) n_dims = atoi(argv[i+1]);
+    i=argPos((char *)"-threshold", argc, argv);
+    if ((i>0) && (i+1<argc)) threshold = atof(argv[i+1]);
+    i=argPos((char *)"-max-vectors", argc, argv);
+    if ((i>0) && (i+1<argc)) max_vectors = atoi(argv[i+1]);
+    i=argPos((char *)"-rand-seed", argc, argv);
+    if ((i>0) && (i+1<argc)) seed = atoi(argv[i+1]);
+
+    if (trace_file.empty() || (n_sub <= 0) || (n_codes <= 0))
+    {
+    	fprintf(stderr,"ERROR: -trace, -subspaces and -codes have to be specified!\n");
+    	return 1;
+    }
+
+    //last n_dims fields of each line are the hidden layer
+    vector<real> x;
+    vector<real> fields;
+    int n = 0;
+    fstream in (trace_file.c_str());
+    if (!in)
+    {
+    	fprintf(stderr,"ERROR: cannot open %s\n", trace_file.c_str());
+    	return 1;
+    }
+    string line;
+    while (getline(in, line) && ((max_vectors <= 0) || (n < max_vectors)))
+    {
+    	istringstream strstr(line);
+    	real v;
+    	fields.clear();
+    	while (strstr >> v) fields.push_back(v);
+    	if (n_lead < 0) n_lead = countLeadingFields(line);
+    	if (n_dims == 0) n_dims = (int) fields.size()-n_lead;
+    	if ((n_dims <= 0) || ((int) fields.size() < n_dims)) continue;
+    	x.insert(x.end(), fields.end()-n_dims, fields.end());
+    	n++;
+    }
+    in.close();
+
+    if (n == 0)
+    {
+    	fprintf(stderr,"ERROR: no hidden layer found in %s\n", trace_file.c_str());
+    	return 1;
+    }
+    if (n_codes > n)
+    {
+    	fprintf(stderr,"ERROR: more codes (%i) than vectors (%i)!\n", n_codes, n);
+    	return 1;
+    }
+    if (n_sub > n_dims)
+    {
+    	fprintf(stderr,"ERROR: more sub-spaces (%i) than neurons (%i)!\n", n_sub, n_dims);
+    	return 1;
+    }
+    fprintf(stderr, "%i vectors of %i dims\n", n, n_dims);
+
+    //sub-spaces of consecutive neurons, as balanced as possible
+    int first = 0;
+    vector<real> c, prior;
+    for (int m = 0; m < n_sub; m++)
+    {
+    	int d = n_dims/n_sub+((m < n_dims%n_sub) ? 1 : 0);
+    	fprintf(stderr, "sub-space %i: neurons %i-%i\n", m, first, first+d-1);
+    	trainCodebook(x, n, n_dims, first, d, n_codes, threshold, seed, c, prior);
+    	for (int j = 0; j < n_codes; j++)
+    	{
+    		printf("%g", (double) prior[j]);
+    		for (int k = 0; k < d; k++) printf(" %.6f", (double) c[(size_t) j*d+k]);
+    		printf("\n");
+    	}
+    	printf("--\n");
+    	first += d;
+    }
+
+    return 0;
+}
@@ -0,0 +1,241 @@
+/************************************************************************
+ * Successors of the states of a hierarchical cluster discretizer.
+ *
+ ***********************************************************************/
+
+#include "transition_table.h"
+#include "centroid_index.h"
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <atomic>
+
+using namespace std;
+
+#define HEADER_INTS 4	//n_levels, n_words, n_dims, beam
+
+TransitionTable::TransitionTable()
+{
+	n_levels = 0;
+	n_words = 0;
+	n_dims = 0;
+	beam = 0;
+	fingerprint = 0;
+	max_bytes = (size_t) DEFAULT_TRANSITION_TABLE_MB << 20;
+}
+
+size_t TransitionTable::computeBytes(const HierarchicalClusterDiscretizer &dzer, int vocab_size)
+{
+	size_t n = 0;
+	for (int l = 0; l < dzer.getNumLevels(); l++)
+	{
+		n += (size_t) dzer.getLevel(l).getNumClusters()*(vocab_size+1);
+	}
+	return n*dzer.getNumLevels()*sizeof(int32_t);
+}
+
+void TransitionTable::setLayout(const HierarchicalClusterDiscretizer &dzer, int vocab_size)
+{
+	n_levels = dzer.getNumLevels();
+	n_words = vocab_size+1;
+	n_dims = dzer.getNumDims();
+	beam = dzer.getTreeSearch();
+	level_size.resize(n_levels);
+	level_start.resize(n_levels);
+	size_t n = 0;
+	for (int l = 0; l < n_levels; l++)
+	{
+		level_size[l] = dzer.getLevel(l).getNumClusters();
+		level_start[l] = n;
+		n += (size_t) level_size[l]*n_words;
+	}
+	next.assign(n*n_levels, -1);
+}
+
+//FNV-1a over the weights which lead to the hidden layer, the means and the search settings
+static void hashBytes(uint64_t &h, const void *p, size_t n)
+{
+	const unsigned char *c = (const unsigned char *) p;
+	for (size_t i = 0; i < n; i++)
+	{
+		h ^= c[i];
+		h *= 1099511628211ULL;
+	}
+}
+
+uint64_t TransitionTable::computeFingerprint(CRnnLM &rnnlm, const HierarchicalClusterDiscretizer &dzer)
+{
+	uint64_t h = 14695981039346656037ULL;
+	int n_in = rnnlm.getVocabSize()+rnnlm.getHiddenLayerSize();
+	for (int a = 0; a < n_in; a++)
+	{
+		for (int b = 0; b < rnnlm.getHiddenLayerSize(); b++)
+		{
+			real w = rnnlm.getSyn0(a, b)->weight;
+			hashBytes(h, &w, sizeof(real));
+		}
+	}
+	for (int l = 0; l < dzer.getNumLevels(); l++)
+	{
+		const ClusterDiscretizer &level = dzer.getLevel(l);
+		for (int c = 0; c < level.getNumClusters(); c++)
+		{
+			hashBytes(h, level.getMeans()+(size_t) c*level.getStride(), dzer.getNumDims()*sizeof(real));
+			int p = level.getParent(c);
+			hashBytes(h, &p, sizeof(int));
+		}
+		//an approximate index may give other clusters than a full scan
+		real eps = -1.0;
+		int checks = 0;
+		if (level.getIndex() != NULL)
+		{
+			eps = level.getIndex()->getEps();
+			checks = level.getIndex()->getMaxChecks();
+		}
+		hashBytes(h, &eps, sizeof(real));
+		hashBytes(h, &checks, sizeof(int));
+	}
+	return h;
+}
+
+bool TransitionTable::build(CRnnLM &rnnlm, const HierarchicalClusterDiscretizer &dzer, int n_threads)
+{
+	size_t bytes = computeBytes(dzer, rnnlm.getVocabSize());
+	if (bytes > max_bytes)
+	{
+		fprintf(stderr, "WARNING: the transition table would take %.1f MB (limit: %li MB), the successors are discretized instead\n", (double) bytes/(1 << 20), (long) (max_bytes >> 20));
+		next.clear();
+		return false;
+	}
+	setLayout(dzer, rnnlm.getVocabSize());
+	fingerprint = computeFingerprint(rnnlm, dzer);
+	if (n_threads < 1) { n_threads = 1; }
+
+	//rows (level, cluster) are handed out to the threads one at a time
+	vector< pair<int,int> > rows;
+	for (int l = 0; l < n_levels; l++)
+	{
+		for (int c = 0; c < level_size[l]; c++)
+		{
+			rows.push_back(make_pair(l, c));
+		}
+	}
+	atomic<size_t> next_row(0);
+
+	auto work = [&]()
+	{
+		int hsize = rnnlm.getHiddenLayerSize();
+		vector<struct neuron> hidden(hsize);
+		vector<real> mean(hsize), rec(hsize);
+		HierarchicalClusterFstHistory h;
+		size_t r;
+		while ((r = next_row++) < rows.size())
+		{
+			int l = rows[r].first, c = rows[r].second;
+			const real *p = dzer.getLevel(l).getRecurrentInput(c);
+			if (p == NULL)
+			{
+				for (int i = 0; i < hsize; i++)
+				{
+					mean[i] = dzer.getLevel(l).getMean(c, i);
+				}
+				rnnlm.computeRecurrentInput(&rec[0], &mean[0]);
+				p = &rec[0];
+			}
+			for (int w = 0; w < n_words; w++)
+			{
+				rnnlm.computeHiddenLayer(&hidden[0], p, (w == n_words-1) ? -1 : w);
+				dzer.discretize(h, &hidden[0]);
+				int32_t *ids = &next[(level_start[l]+(size_t) c*n_words+w)*n_levels];
+				for (int i = 0; i < n_levels; i++)
+				{
+					ids[i] = h.getDiscretized(i);
+				}
+			}
+		}
+	};
+
+	vector<thread> pool;
+	for (int t = 1; t < n_threads; t++)
+	{
+		pool.push_back(thread(work));
+	}
+	work();
+	for (size_t t = 0; t < pool.size(); t++)
+	{
+		pool[t].join();
+	}
+	return true;
+}
+
+bool TransitionTable::save(string fn) const
+{
+	FILE *f = fopen(fn.c_str(), "wb");
+	if (f == NULL)
+	{
+		return false;
+	}
+	int32_t header[HEADER_INTS] = { n_levels, n_words, n_dims, beam };
+	bool ok = (fwrite(TRANSITION_TABLE_MAGIC, 1, 8, f) == 8) && (fwrite(header, sizeof(int32_t), HEADER_INTS, f) == HEADER_INTS);
+	for (int l = 0; ok && (l < n_levels); l++)
+	{
+		int32_t n = level_size[l];
+		ok = (fwrite(&n, sizeof(int32_t), 1, f) == 1);
+	}
+	ok = ok && (fwrite(&fingerprint, sizeof(uint64_t), 1, f) == 1);
+	ok = ok && (fwrite(&next[0], sizeof(int32_t), next.size(), f) == next.size());
+	if (fclose(f) != 0)
+	{
+		ok = false;
+	}
+	return ok;
+}
+
+bool TransitionTable::load(string fn, CRnnLM &rnnlm, const HierarchicalClusterDiscretizer &dzer)
+{
+	if (computeBytes(dzer, rnnlm.getVocabSize()) > max_bytes)
+	{
+		next.clear();
+		return false;
+	}
+	FILE *f = fopen(fn.c_str(), "rb");
+	if (f == NULL)
+	{
+		return false;
+	}
+	char magic[8];
+	int32_t header[HEADER_INTS];
+	if ((fread(magic, 1, 8, f) != 8) || (memcmp(magic, TRANSITION_TABLE_MAGIC, 8) != 0)
+	    || (fread(header, sizeof(int32_t), HEADER_INTS, f) != HEADER_INTS))
+	{
+		fprintf(stderr, "WARNING: %s is not a transition table\n", fn.c_str());
+		fclose(f);
+		return false;
+	}
+	setLayout(dzer, rnnlm.getVocabSize());
+	bool ok = (header[0] == n_levels) && (header[1] == n_words) && (header[2] == n_dims) && (header[3] == beam);
+	for (int l = 0; ok && (l < n_levels); l++)
+	{
+		int32_t n;
+		ok = (fread(&n, sizeof(int32_t), 1, f) == 1) && (n == level_size[l]);
+	}
+	uint64_t fp;
+	ok = ok && (fread(&fp, sizeof(uint64_t), 1, f) == 1) && (fp == computeFingerprint(rnnlm, dzer));
+	if (!ok)
+	{
+		fprintf(stderr, "WARNING: %s was not built for this model and these clusters\n", fn.c_str());
+		fclose(f);
+		next.clear();
+		return false;
+	}
+	fingerprint = fp;
+	if (fread(&next[0], sizeof(int32_t), next.size(), f) != next.size())
+	{
+		fprintf(stderr, "WARNING: %s is truncated\n", fn.c_str());
+		fclose(f);
+		next.clear();
+		return false;
+	}
+	fclose(f);
+	return true;
+}
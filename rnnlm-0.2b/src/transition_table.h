@@ -0,0 +1,101 @@
+/************************************************************************
+ * Successors of the states of a hierarchical cluster discretizer.
+ *
+ * The hidden layer computed from a discretized history only depends on
+ * the mean loaded as s(t-1) (finest cluster of the history) and on the
+ * last word, and so do the clusters it is assigned to. The table stores
+ * them for every cluster c of every level l and every word w (plus "no
+ * last word"), so that the successor of a state is looked up instead of
+ * being discretized.
+ *
+ * File format (native byte order):
+ * header: "RNNTRS01", n_levels, n_words (vocabulary size + 1), n_dims,
+ *         beam (int32), then the number of clusters of each level (int32),
+ *         then a fingerprint of the model and of the means (uint64)
+ * then the successors: for each level l, cluster c and word w (last one
+ * for no word), the n_levels cluster ids of the successor (int32).
+ *
+ * The table takes n_levels x (number of clusters) x n_words x 4 bytes: it
+ * is neither built nor loaded above a memory limit (see setMaxBytes()),
+ * the successors then being discretized as without a table.
+ *
+ ***********************************************************************/
+
+#ifndef _TRANSITION_TABLE_H_
+#define _TRANSITION_TABLE_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "rnnlmlib.h"
+#include "hierarchical_cluster_discretizer.h"
+#include "hierarchical_cluster_fsthistory.h"
+
+using namespace std;
+
+#define TRANSITION_TABLE_MAGIC "RNNTRS01"
+
+//default memory limit of a table
+#define DEFAULT_TRANSITION_TABLE_MB 1024
+
+class TransitionTable
+{
+
+	protected:
+	int n_levels;
+	int n_words;	//vocabulary size + 1 (last column: no last word)
+	int n_dims;
+	int beam;
+	vector<int> level_size;
+	vector<size_t> level_start;	//first entry of each level
+	vector<int32_t> next;	//n_levels cluster ids per entry
+	uint64_t fingerprint;
+	size_t max_bytes;
+
+	void setLayout(const HierarchicalClusterDiscretizer &dzer, int vocab_size);
+	static uint64_t computeFingerprint(CRnnLM &rnnlm, const HierarchicalClusterDiscretizer &dzer);
+
+	public:
+
+	TransitionTable();
+
+	//memory of the table for these clusters and this vocabulary
+	static size_t computeBytes(const HierarchicalClusterDiscretizer &dzer, int vocab_size);
+	void setMaxBytes(size_t bytes) { max_bytes = bytes; }
+
+	//computes the successors of all the (cluster, word) pairs with n_threads threads,
+	//false (empty table) if the table would take more than the memory limit
+	bool build(CRnnLM &rnnlm, const HierarchicalClusterDiscretizer &dzer, int n_threads = 1);
+	//reads a table, false if it cannot be read, was not built for this model and these clusters
+	//or is above the memory limit
+	bool load(string fn, CRnnLM &rnnlm, const HierarchicalClusterDiscretizer &dzer);
+	bool save(string fn) const;
+
+	bool isEmpty() const { return next.empty(); }
+	size_t getNumEntries() const { return next.size()/(n_levels > 0 ? n_levels : 1); }
+
+	//n_levels cluster ids of the successor of cluster cl of level lvl after word w (-1: no word)
+	const int32_t *getSuccessor(int lvl, int cl, int w) const
+	{
+		if (w < 0) { w = n_words-1; }
+		return &next[(level_start[lvl]+(size_t) cl*n_words+w)*n_levels];
+	}
+
+	//sets the clusters of to (from and to may be the same history) to those of the
+	//successor of from after word w, false if from has no cluster
+	bool getSuccessor(const HierarchicalClusterFstHistory &from, int w, HierarchicalClusterFstHistory &to) const
+	{
+		if (isEmpty() || (from.getNumClusters() == 0)) { return false; }
+		const int32_t *ids = getSuccessor(from.getNumClusters()-1, from.getFinestDiscretized(), w);
+		to.resetDiscretization();
+		for (int i = 0; i < n_levels; i++)
+		{
+			to.setDiscretized(i, ids[i]);
+		}
+		return true;
+	}
+
+};
+
+#endif
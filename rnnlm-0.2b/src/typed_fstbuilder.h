@@ -0,0 +1,462 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Base of the builders for a given pair of history and discretizer
+// types. Histories are discretized, loaded in the RNN and compared
+// through the concrete types, i.e. without virtual calls nor
+// dynamic_cast in the conversion loop; the virtual interface of
+// FstBuilder is only used by rnn2fst to call convertRNN().
+//
+// H is the history type (see history_pool.h), D the discretizer
+// type (with discretize(H&, layer) and undiscretize(layer, const H&)),
+// B the builder from which the other methods are inherited.
+//
+// With B = BackoffFstBuilder, convertWithBackoff() is the conversion
+// shared by the builders whose backoff states are given by their
+// histories (hierarchical clusters, product quantization, sign
+// projections): they only provide getBackoff() and getPosterior(), and
+// possibly setSuccessorHistory().
+//
+///////////////////////////////////////////////////////////////////////
+
+
+
+#ifndef _TYPED_FSTBUILDER_H_
+#define _TYPED_FSTBUILDER_H_
+
+#include <queue>
+#include <thread>
+#include <atomic>
+#include "abstract_fstbuilder.h"
+#include "pruning_policy.h"
+#include "history_pool.h"
+#include "distribution_cache.h"
+
+using namespace std;
+using namespace fst;
+
+//maximum number of states of the queue expanded at once (see convertWithBackoff())
+#ifndef EXPANSION_BATCH_SIZE
+#define EXPANSION_BATCH_SIZE 4096
+#endif
+
+
+//what is added to the FST for a state, which only depends on its history
+template <class H>
+struct FstExpansion {
+	H bo_fsth;	//backoff state
+	H new_fsth;	//successors (but their last word)
+	bool backoff;	//at least one word is backing off
+	vector<int> to_be_added;	//kept words
+	vector<real> to_be_added_prob;	//and their probabilities (-log)
+	real entropy;
+	int n_skipped_classes;	//classes whose word layer was not computed (class pruning)
+};
+
+
+template <class H, class D, class B = FstBuilder>
+class TypedFstBuilder : public B {
+
+	protected:
+
+	D *typed_dzer;
+
+	//history of each state (the ids of the pool are the state ids)
+	HistoryPool<H> h2state;
+
+	//distributions of the backoff histories
+	DistributionCache dist_cache;
+
+
+	/**
+	 * Try to add a state in the FST for a given history and return the ID
+	 * of the new state.
+	 * If the history already exists, the ID of the corresponding state is
+	 * just returned and the FST is not modified.
+	 */
+	bool addFstState(FstIndex &id, const H &h, VectorFst<LogArc> &fst) {
+		bool added;
+		id = (FstIndex) h2state.insert(h, added);
+		//if new history, then add
+		if (added) {
+			fst.AddState();
+		}
+		return added;
+	}
+
+	/**
+	 * Add the final state, whose history (a copy of h) is never looked up
+	 */
+	void addFstFinalState(const H &h, VectorFst<LogArc> &fst) {
+		h2state.append(h);
+		fst.AddState();
+	}
+
+	/**
+	 * ID of the state of a history, -1 if it has not been added (may be
+	 * called from the threads of expandStates())
+	 */
+	int findFstState(const H &h) const {
+		return h2state.find(h);
+	}
+
+	/**
+	 * History of a state, which stays at the same address until the
+	 * builder is deleted
+	 */
+	const H &getFstHistory(FstIndex id) const {
+		return h2state[(int) id];
+	}
+
+	/**
+	 * Discretize the current state of the RNN (last word of the input
+	 * layer and hidden layer)
+	 */
+	void setFstHistory(H &fsth, CRnnLM &rnnlm) const {
+		struct neuron* layer = rnnlm.getInputLayer();
+		for (int i=0; i < rnnlm.getVocabSize(); i++) {
+			if (layer[i].ac == 1.0) {
+				fsth.setLastWord(i);
+			}
+		}
+		typed_dzer->discretize(fsth, rnnlm.getHiddenLayer());
+	}
+
+	/**
+	 * Overwrite the current input layer using a history
+	 */
+	void loadAsInput(const H &fsth, CRnnLM &rnnlm) const {
+		struct neuron* in = rnnlm.getInputLayer();
+		for (int i=0; i < rnnlm.getVocabSize(); i++) {
+			in[i].ac = 0.0;
+		}
+		if (fsth.getLastWord() != -1) {
+			in[fsth.getLastWord()].ac = 1.0;
+		}
+		typed_dzer->undiscretize(in+rnnlm.getVocabSize(), fsth);
+		//skips the recurrent product in the next forward pass if it has been cached
+		rnnlm.setRecurrentInput(typed_dzer->getRecurrentInput(fsth));
+	}
+
+	//Computation of probs
+	vector<real> computeAllConditionals(CRnnLM &rnnlm, const H &fsth) {
+		loadAsInput(fsth, rnnlm);
+		return B::computeAllConditionals(rnnlm, fsth.getLastWord());
+	}
+
+	vector<real> computeSomeConditionals(CRnnLM &rnnlm, const H &fsth, vector<int> &words) {
+		loadAsInput(fsth, rnnlm);
+		return B::computeSomeConditionals(rnnlm, fsth.getLastWord(), words);
+	}
+
+	void computeEntropyAndConditionals(real &entropy, vector<real> &res, CRnnLM &rnnlm, const H &fsth, real posterior = 0.0) {
+		loadAsInput(fsth, rnnlm);
+		B::computeEntropyAndConditionals(entropy, res, rnnlm, fsth.getLastWord(), posterior);
+	}
+
+	/**
+	 * Conditionals of a state to be pruned, whose classes may be skipped
+	 * (B must be a BackoffFstBuilder, see computeEntropyAndConditionalsByClass())
+	 */
+	int computeEntropyAndConditionalsByClass(real &entropy, vector<real> &res, vector<bool> &skipped, CRnnLM &rnnlm, const H &fsth, real posterior, const vector<real> &bo_prob) {
+		loadAsInput(fsth, rnnlm);
+		return B::computeEntropyAndConditionalsByClass(entropy, res, skipped, rnnlm, fsth.getLastWord(), posterior, bo_prob);
+	}
+
+	/**
+	 * Empty the cache of the backoff distributions and size it for the
+	 * vocabulary of rnnlm (to be called at the beginning of a conversion)
+	 */
+	void initDistributionCache(CRnnLM &rnnlm) {
+		dist_cache.setSize(B::dist_cache_bytes, rnnlm.getVocabSize());
+	}
+
+	/**
+	 * Conditionals of a backoff history, as computed by
+	 * computeEntropyAndConditionals(), read from the cache if possible.
+	 * On a hit, the RNN is left unchanged: the caller must not read its
+	 * layers afterwards.
+	 */
+	void computeBackoffConditionals(vector<real> &res, CRnnLM &rnnlm, const H &fsth) {
+		vector<uint64_t> key;
+		real entropy;
+		if (dist_cache.enabled()) {
+			fsth.packKey(key);
+			if (dist_cache.get(key, res)) {
+				return;
+			}
+		}
+		computeEntropyAndConditionals(entropy, res, rnnlm, fsth);
+		dist_cache.put(key, res);
+	}
+
+	/**
+	 * Same as computeSomeConditionals() for a backoff candidate, whose
+	 * whole distribution is cached
+	 */
+	vector<real> computeBackoffSomeConditionals(CRnnLM &rnnlm, const H &fsth, vector<int> &words) {
+		vector<real> res;
+		vector<uint64_t> key;
+		if (dist_cache.enabled()) {
+			fsth.packKey(key);
+		}
+		if (!dist_cache.enabled() || !dist_cache.get(key, res)) {
+			res = computeAllConditionals(rnnlm, fsth);
+			dist_cache.put(key, res);
+		}
+		vector<real> mask(res.size(), MY_LOG_ZERO);
+		for (size_t i = 0; i < words.size(); i++) {
+			mask[words[i]] = 0.0;
+		}
+		for (size_t w = 0; w < res.size(); w++) {
+			res[w] = mask[w] + res[w];
+		}
+		return res;
+	}
+
+	/**
+	 * Backoff history of the state id, whose history is fsth (builders
+	 * with backoff). States may be expanded concurrently: only the states
+	 * created before id may be looked up.
+	 */
+	virtual H getBackoff(const H &fsth, FstIndex id) {
+		H bo(fsth);
+		bo.setLastWord(-1);
+		return bo;
+	}
+
+	/**
+	 * -log P(h) of a history, for the pruning criterion (builders with backoff)
+	 */
+	virtual real getPosterior(CRnnLM &rnnlm, const H &fsth, int total_counts) const {
+		return 0.0;
+	}
+
+	/**
+	 * History of the successors of fsth but their last word, the hidden
+	 * layer of rnnlm being computed from fsth
+	 */
+	virtual void setSuccessorHistory(H &new_fsth, CRnnLM &rnnlm, const H &fsth) const {
+		setFstHistory(new_fsth, rnnlm);
+	}
+
+	/**
+	 * Compute the backoff state, the kept words and the successors of the
+	 * state id. Only the given RNN (and the buffers) is modified, so that
+	 * states can be expanded concurrently with different copies of the RNN.
+	 */
+	void expandState(CRnnLM &rnnlm, FstIndex id, int total_counts, vector<real> &all_prob, vector<real> &all_bo_prob, vector<bool> &skipped, PruningBuffers &buffers, FstExpansion<H> &ex) {
+		const H &fsth = getFstHistory(id);
+		ex.to_be_added.clear();
+		ex.to_be_added_prob.clear();
+
+		ex.bo_fsth = getBackoff(fsth, id);
+		//(shared by many states: read from the cache; fsth is loaded in the RNN below)
+		computeBackoffConditionals(all_bo_prob, rnnlm, ex.bo_fsth);
+
+		real p_post = getPosterior(rnnlm, fsth, total_counts);
+		ex.n_skipped_classes = computeEntropyAndConditionalsByClass(ex.entropy, all_prob, skipped, rnnlm, fsth, p_post, all_bo_prob);
+
+		//test which edges have to be kept or backed off
+		B::selectKeptWords(ex.to_be_added, buffers, fsth.getLastWord(), p_post, all_prob, all_bo_prob, skipped);
+		for (size_t i=0; i < ex.to_be_added.size(); i++) {
+			ex.to_be_added_prob.push_back(all_prob[ex.to_be_added[i]]);
+		}
+		ex.backoff = ((int) ex.to_be_added.size() < rnnlm.getVocabSize());
+
+		setSuccessorHistory(ex.new_fsth, rnnlm, fsth);
+	}
+
+	/**
+	 * Expand the given states with one thread per RNN of nets
+	 * (res[i] is the expansion of states[i])
+	 */
+	void expandStates(vector<CRnnLM*> &nets, const vector<FstIndex> &states, int total_counts, vector< FstExpansion<H> > &res) {
+		atomic<size_t> next_state(0);
+		if (res.size() < states.size()) {
+			res.resize(states.size());
+		}
+
+		//states are handed out to the threads one at a time
+		auto work = [&](CRnnLM *net)
+		{
+			vector<real> all_prob(net->getVocabSize());
+			vector<real> all_bo_prob(net->getVocabSize());
+			vector<bool> skipped(net->getVocabSize());
+			PruningBuffers buffers;
+			size_t i;
+			while ((i = next_state++) < states.size()) {
+				expandState(*net, states[i], total_counts, all_prob, all_bo_prob, skipped, buffers, res[i]);
+			}
+		};
+
+		vector<thread> pool;
+		for (size_t t = 1; t < nets.size(); t++) {
+			pool.push_back(thread(work, nets[t]));
+		}
+		work(nets[0]);
+		for (size_t t = 0; t < pool.size(); t++) {
+			pool[t].join();
+		}
+	}
+
+	/**
+	 * Sum of the counts of the words, for getPosterior()
+	 */
+	static int getTotalCounts(CRnnLM &rnnlm) {
+		int total_counts = 0;
+		for (int i=0; i < rnnlm.getVocabSize(); i++) {
+			total_counts += rnnlm.getWordCount(i);
+		}
+		return total_counts;
+	}
+
+	/**
+	 * Copies of rnnlm sharing its weights, one per thread (the first one
+	 * is rnnlm itself, the others are to be deleted by the caller)
+	 */
+	vector<CRnnLM*> createThreadNets(CRnnLM &rnnlm) const {
+		vector<CRnnLM*> nets(1, &rnnlm);
+		for (int t=1; t < B::n_threads; t++) {
+			CRnnLM *net = new CRnnLM();
+			net->shareNet(rnnlm);
+			nets.push_back(net);
+		}
+		return nets;
+	}
+
+	/**
+	 * Create an FST based on an RNN by a breadth-first expansion of the
+	 * states from the initial state, the words which do not pass the
+	 * pruning policy backing off (B must be a BackoffFstBuilder).
+	 * The states are expanded by batches (in parallel with several
+	 * threads), then added to the FST in the order of the queue, which
+	 * gives the same state ids as a state-by-state conversion.
+	 */
+	void convertWithBackoff(CRnnLM &rnnlm, VectorFst<LogArc> &fst) {
+		queue<FstIndex> q;
+		H fsth;
+		FstIndex id = 0;
+		FstIndex new_id;
+
+		//states expanded at once and their expansions
+		vector<FstIndex> batch;
+		vector< FstExpansion<H> > expansions;
+		//RNN of each thread (the first one is rnnlm, the others share its weights)
+		vector<CRnnLM*> nets = createThreadNets(rnnlm);
+
+		map< FstIndex,set<FstIndex> > pred;
+
+		FstIndex n_added = 0;
+		FstIndex n_processed = 0;
+		FstIndex n_backoff = 0;
+		long n_skipped_classes = 0;
+
+		int v = rnnlm.getVocabSize();
+		int total_counts = getTotalCounts(rnnlm);
+		initDistributionCache(rnnlm);
+
+		// Initialize
+		rnnlm.copyHiddenLayerToInput();
+
+		// Initial state ( 0 | hidden layer after </s>)
+		setFstHistory(fsth, rnnlm);
+		fsth.setLastWord(0);
+		addFstState(id, fsth, fst);
+		q.push(id);
+		fst.SetStart(INIT_STATE);
+
+		// Final state (don't care about the associated discrete representation)
+		addFstFinalState(fsth, fst);
+		fst.SetFinal(FINAL_STATE, LogWeight::One());
+
+		while (!q.empty()) {
+			batch.clear();
+			while (!q.empty() && (batch.size() < EXPANSION_BATCH_SIZE)) {
+				id = q.front();
+				q.pop();
+				B::state2h.push_back(&getFstHistory(id));
+				if (id != FINAL_STATE) {
+					batch.push_back(id);
+				}
+			}
+
+			expandStates(nets, batch, total_counts, expansions);
+
+			for (size_t b = 0; b < batch.size(); b++) {
+				id = batch[b];
+				FstExpansion<H> &ex = expansions[b];
+
+				if (n_processed/100000 != (n_processed+v)/100000) {
+					fprintf(stderr, "\rH=%.5f / N proc'd=%li / N added=%li (%.5f %%) / N bo=%li / %li/%li Nodes (%2.1f %%)", ex.entropy, n_processed, n_added, ((float) n_added/ (float)(n_processed+1))*100.0, n_backoff, id, id+q.size(), 100.0 - (float) (100.0*id/(id+q.size())));
+				}
+				n_processed += v;
+				n_added += ex.to_be_added.size();
+				n_skipped_classes += ex.n_skipped_classes;
+
+				//if at least one word is backing off
+				if (ex.backoff) {
+					n_backoff++;
+					if (addFstState(new_id, ex.bo_fsth, fst)) {
+						q.push(new_id);
+					}
+					fst.AddArc(id, LogArc(EPSILON, EPSILON, LogWeight::Zero(), new_id));
+					B::addPred(pred, new_id, id);
+				}
+
+				for (size_t i = 0; i < ex.to_be_added.size(); i++) {
+					int w = ex.to_be_added[i];
+					real p = ex.to_be_added_prob[i];
+					if (w == 0) {
+						fst.AddArc(id, LogArc(FstWord(w),FstWord(w),p,FINAL_STATE));
+					}
+					else {
+						ex.new_fsth.setLastWord(w);
+						if (addFstState(new_id, ex.new_fsth, fst)) {
+							q.push(new_id);
+						}
+						fst.AddArc(id, LogArc(FstWord(w),FstWord(w),p,new_id));
+					}
+				}
+			}
+		}
+
+		for (size_t t=1; t < nets.size(); t++) {
+			delete nets[t];
+		}
+
+		cout << endl;
+		dist_cache.printStats(stdout);
+		if (B::class_pruning) {
+			printf("Class pruning: %li classes skipped out of %li\n", n_skipped_classes, (long) (n_processed/v)*rnnlm.getClassSize());
+		}
+
+		//compute backoff weights
+		B::computeAllBackoff(fst, pred, B::n_threads);
+
+		//Fill the table of symbols
+		SymbolTable dic("dictionnary");
+		dic.AddSymbol("*", 0);
+		for (int i=0; i<rnnlm.getVocabSize(); i++) {
+			dic.AddSymbol(string(rnnlm.getWordString(i)), i+1);
+		}
+		fst.SetInputSymbols(&dic);
+		fst.SetOutputSymbols(&dic);
+
+		cout << "END" << endl;
+	}
+
+	public:
+	TypedFstBuilder(D *d) : B(d) {
+		typed_dzer = d;
+	}
+
+	TypedFstBuilder(D *d, real t, int bol) : B(d, t, bol) {
+		typed_dzer = d;
+	}
+
+	virtual ~TypedFstBuilder() {}
+
+};
+
+
+#endif